@@ -30,6 +30,7 @@
 #include <Button.hpp>
 #include <SparseFeatureVector.hpp>
 #include <BitSet.hpp>
+#include <DiagonalKernel.hpp>
 #include "Helpers.hpp"
 #include "RankingBrowserBase.hpp"
 #include "RankingBrowser.hpp"
@@ -843,6 +844,7 @@ public:
 			return;
 		}
 
+#if WANT_FRAG
 		for ( long long r = 0; r < m; r++ ) {
 			const int c_upper = r == 0 ? (int) n : 1;
 
@@ -865,12 +867,7 @@ public:
 					buffer[t] = currentTerm;
 				}
 
-#if WANT_FRAG
 				process( r, c, distance );
-#else
-				if ( distance < rowMin[r] ) rowMin[r] = distance;
-				if ( distance < colMin[c] ) colMin[c] = distance;
-#endif
 
 				for ( size_t offset = 1, buffptr = 0;
 					offset < diagLength;
@@ -885,16 +882,18 @@ public:
 					buffer[buffptr] = currentTerm;
 					distance += currentTerm;
 
-#if WANT_FRAG
 					process( r + offset, c + offset, distance );
-#else
-					if ( distance < rowMin[r + offset] ) rowMin[r + offset] = distance;
-					if ( distance < colMin[c + offset] ) colMin[c + offset] = distance;
-#endif
 				}
 			}
 
 		}
+#else
+		DiagonalKernel::RowColMinima(
+			query.data(), subject.data(), kmerLength, m, n,
+			[matrix]( Symbol q, Symbol s ) { return matrix->Difference( s, q ); },
+			rowMin.data(), colMin.data()
+		);
+#endif
 	}
 
 	static void PopulateBytes(
@@ -105,7 +105,7 @@ namespace QutBio {
 		template<typename T>
 		void Encode( const Symbol s[], size_t len, size_t charsPerWord, vector<T> & code ) const {
 			size_t size = symbols.size();
-			size_t words = len - charsPerWord + 1;
+			size_t words = len >= charsPerWord ? len - charsPerWord + 1 : 0;
 			code.resize( words );
 
 			for ( size_t offset = 0; offset < words; offset++ ) {
@@ -197,6 +197,22 @@ namespace QutBio {
 			size_t charsPerWord, 
 			vector<vector<KmerWord>> & code 
 		) const {
+			CheckEncodable( len, kmerLength, charsPerWord );
+
+			size_t rows = EncodedRows( kmerLength, charsPerWord );
+			code.resize( rows );
+
+			for ( size_t i = 0; i < rows; i++ ) {
+				code[i].resize( EncodedRowWords( len, kmerLength, charsPerWord, i ) );
+				EncodeRow( s, len, kmerLength, charsPerWord, i, code[i].data() );
+			}
+		}
+
+		/**
+		 *	Throws if a string cannot be encoded with the designated kmer length and
+		 *	density. See Encode for details.
+		 */
+		void CheckEncodable( size_t len, size_t kmerLength, size_t charsPerWord ) const {
 			// TODO: Get RID of this !!!
 			// Assert::IsTrue( charsPerWord * this->BitsPerSymbol() <= KWORD_BITS, FileAndLine );
 
@@ -222,24 +238,50 @@ namespace QutBio {
 						<< "\n";
 					throw Exception( str.str(), FileAndLine );
 				}
+			}
+		}
 
-				code.resize( charsPerWord );
+		/**
+		 *	Gets the number of rows produced by Encode: one per offset if a kmer
+		 *	spans several words, otherwise one row of whole kmers.
+		 */
+		static size_t EncodedRows( size_t kmerLength, size_t charsPerWord ) {
+			return kmerLength > charsPerWord ? charsPerWord : 1;
+		}
 
-				for ( size_t i = 0; i < charsPerWord; i++ ) {
-					size_t codeWordsNeeded = WordsRequiredToPack( len - i, charsPerWord );
-					code[i].resize( codeWordsNeeded );
-					Encode( s + i, len - i, charsPerWord, code[i].data() );
-				}
+		/**
+		 *	Gets the number of words in a row produced by Encode.
+		 *	@param len The number of characters to encode.
+		 *	@param kmerLength The number of characters in each kmer.
+		 *	@param charsPerWord The number of encoded characters packed into each word.
+		 *	@param row The row index, 0 <= row < EncodedRows( kmerLength, charsPerWord ).
+		 */
+		static size_t EncodedRowWords( size_t len, size_t kmerLength, size_t charsPerWord, size_t row ) {
+			return kmerLength > charsPerWord
+				? WordsRequiredToPack( len - row, charsPerWord )
+				: len - kmerLength + 1;
+		}
+
+		/**
+		 *	Computes one row of the output of Encode into caller-supplied storage,
+		 *	which must hold EncodedRowWords( len, kmerLength, charsPerWord, row ) words.
+		 *	The arguments must have been validated by CheckEncodable.
+		 */
+		void EncodeRow( 
+			const Symbol s[], 
+			size_t len, 
+			size_t kmerLength, 
+			size_t charsPerWord, 
+			size_t row, 
+			KmerWord * code 
+		) const {
+			if ( kmerLength > charsPerWord ) {
+				Encode( s + row, len - row, charsPerWord, code );
 			}
 			else {
 				// This is primarily for DNA;
-				code.resize( 1 );
-				code[0].clear();
-
 				for ( size_t i = 0; i < len - kmerLength + 1; i++ ) {
-					KmerWord codeWord;
-					Encode( s + i, kmerLength, charsPerWord, &codeWord );
-					code[0].push_back( codeWord );
+					Encode( s + i, kmerLength, charsPerWord, code + i );
 				}
 			}
 		}
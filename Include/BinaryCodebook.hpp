@@ -0,0 +1,344 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DistanceType.hpp"
+#include "EncodedFastaSequence.hpp"
+#include "EncodedKmer.hpp"
+#include "Exception.hpp"
+#include "Kmer.hpp"
+#include "MappedFile.hpp"
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	Read-only, memory-mapped kmer codebook, equivalent to the text
+	 *	cluster file written by AAClust but loaded without parsing. The file is
+	 *	produced by BinaryCodebook::Writer and read by the corresponding
+	 *	KmerCodebook constructor.
+	 *
+	 *	Each cluster records its prototype ID and packed encoding, its
+	 *	metadata, and its members. A member is the first instance of a kmer,
+	 *	given as a (sequence number, position) pair, with its distance to the
+	 *	prototype. Sequence numbers index a table of sequence IDs, so each
+	 *	distinct ID is looked up once rather than once per member.
+	 *
+	 *	Layout: Header, followed by 8-byte aligned sections
+	 *		seqIdOffsets	uint64[S+1]			byte offsets of sequence IDs within seqIdChars.
+	 *		seqIdChars		char[]				concatenated sequence IDs.
+	 *		protoIdOffsets	uint64[C+1]			byte offsets of prototype IDs within protoIdChars.
+	 *		protoIdChars	char[]				concatenated prototype IDs.
+	 *		protoCodes		KmerWord[C*W]		packed prototype encodings, W words each.
+	 *		metaOffsets		uint64[C+1]			byte offsets of cluster metadata within metaChars.
+	 *		metaChars		char[]				concatenated "key:value;" metadata.
+	 *		memberOffsets	uint64[C+1]			offsets of cluster members within members.
+	 *		members			Member[M]			cluster members.
+	 */
+	class BinaryCodebook {
+	public:
+		struct Header {
+			char tag[8];
+			uint64_t kmerLength;
+			uint64_t charsPerWord;
+			uint64_t wordsPerKmer;
+			uint64_t clusterCount;
+			uint64_t memberCount;
+			uint64_t seqCount;
+			uint64_t seqIdOffsets;
+			uint64_t seqIdChars;
+			uint64_t protoIdOffsets;
+			uint64_t protoIdChars;
+			uint64_t protoCodes;
+			uint64_t metaOffsets;
+			uint64_t metaChars;
+			uint64_t memberOffsets;
+			uint64_t members;
+			uint64_t fileSize;
+		};
+
+		struct Member {
+			uint32_t seq;
+			uint32_t position;
+			Distance distance;
+		};
+
+		static const char * Tag() {
+			return "CODEBK1";
+		}
+
+	private:
+		MappedFile file;
+		const Header * header;
+		const uint64_t * seqIdOffsets;
+		const char * seqIdChars;
+		const uint64_t * protoIdOffsets;
+		const char * protoIdChars;
+		const KmerWord * protoCodes;
+		const uint64_t * metaOffsets;
+		const char * metaChars;
+		const uint64_t * memberOffsets;
+		const Member * members;
+
+	public:
+		/**
+		 *	Map a binary codebook.
+		 *	@param fileName The name of a file created by BinaryCodebook::Writer.
+		 *	@throws Exception if the file is not a valid binary codebook.
+		 */
+		BinaryCodebook( const string & fileName ) : file( fileName ) {
+			if ( !file.StartsWith( Tag(), sizeof( header->tag ) ) ) {
+				throw Exception( "File " + fileName + " is not a binary codebook.", FileAndLine );
+			}
+
+			header = file.At<Header>( 0 );
+
+			if ( header->fileSize != file.Size() ) {
+				throw Exception( "File " + fileName + " is truncated or corrupt.", FileAndLine );
+			}
+
+			auto S = header->seqCount;
+			auto C = header->clusterCount;
+
+			seqIdOffsets = file.At<uint64_t>( header->seqIdOffsets, S + 1 );
+			seqIdChars = file.At<char>( header->seqIdChars, seqIdOffsets[S] );
+			protoIdOffsets = file.At<uint64_t>( header->protoIdOffsets, C + 1 );
+			protoIdChars = file.At<char>( header->protoIdChars, protoIdOffsets[C] );
+			protoCodes = file.At<KmerWord>( header->protoCodes, C * header->wordsPerKmer );
+			metaOffsets = file.At<uint64_t>( header->metaOffsets, C + 1 );
+			metaChars = file.At<char>( header->metaChars, metaOffsets[C] );
+			memberOffsets = file.At<uint64_t>( header->memberOffsets, C + 1 );
+			members = file.At<Member>( header->members, memberOffsets[C] );
+
+			if ( memberOffsets[C] != header->memberCount ) {
+				throw Exception( "File " + fileName + " is truncated or corrupt.", FileAndLine );
+			}
+
+			for ( size_t i = 0; i < header->memberCount; i++ ) {
+				if ( members[i].seq >= S ) {
+					throw Exception( "File " + fileName + " is truncated or corrupt.", FileAndLine );
+				}
+			}
+		}
+
+		/**
+		 *	Returns true iff the named file exists and carries the binary
+		 *	codebook tag.
+		 */
+		static bool IsBinary( const string & fileName ) {
+			ifstream str( fileName, ios::binary );
+			char tag[sizeof( Header::tag )] = { 0 };
+			str.read( tag, sizeof( tag ) );
+			return str.gcount() == sizeof( tag ) && memcmp( tag, Tag(), sizeof( tag ) ) == 0;
+		}
+
+		size_t KmerLength() const {
+			return header->kmerLength;
+		}
+
+		size_t CharsPerWord() const {
+			return header->charsPerWord;
+		}
+
+		size_t WordsPerKmer() const {
+			return header->wordsPerKmer;
+		}
+
+		/** Gets the number of clusters. */
+		size_t Size() const {
+			return header->clusterCount;
+		}
+
+		/** Gets the total number of cluster members. */
+		size_t MemberCount() const {
+			return header->memberCount;
+		}
+
+		/** Gets the number of distinct sequences referenced by members. */
+		size_t SeqCount() const {
+			return header->seqCount;
+		}
+
+		/** Gets the ID of sequence number s. */
+		string SeqId( size_t s ) const {
+			return string( seqIdChars + seqIdOffsets[s], seqIdChars + seqIdOffsets[s + 1] );
+		}
+
+		/** Gets the ID of the prototype of cluster c. */
+		string ProtoId( size_t c ) const {
+			return string( protoIdChars + protoIdOffsets[c], protoIdChars + protoIdOffsets[c + 1] );
+		}
+
+		/** Gets the packed encoding of the prototype of cluster c. */
+		const KmerWord * ProtoCode( size_t c ) const {
+			return protoCodes + c * header->wordsPerKmer;
+		}
+
+		/** Gets the metadata of cluster c, as a list of "key:value;" pairs. */
+		string Metadata( size_t c ) const {
+			return string( metaChars + metaOffsets[c], metaChars + metaOffsets[c + 1] );
+		}
+
+		/** Gets the address of the first member of cluster c. */
+		const Member * MembersBegin( size_t c ) const {
+			return members + memberOffsets[c];
+		}
+
+		/** Gets the address past the last member of cluster c. */
+		const Member * MembersEnd( size_t c ) const {
+			return members + memberOffsets[c + 1];
+		}
+
+		/**
+		 *	Accumulates clusters and writes them as a binary codebook.
+		 */
+		class Writer {
+			string fileName;
+			size_t kmerLength;
+			size_t charsPerWord;
+			size_t wordsPerKmer;
+
+			unordered_map<const EncodedFastaSequence *, uint32_t> seqNumber;
+			vector<uint64_t> seqIdOffsets{ 0 };
+			string seqIdChars;
+			vector<uint64_t> protoIdOffsets{ 0 };
+			string protoIdChars;
+			vector<KmerWord> protoCodes;
+			vector<uint64_t> metaOffsets{ 0 };
+			string metaChars;
+			vector<uint64_t> memberOffsets{ 0 };
+			vector<Member> members;
+
+		public:
+			/**
+			 *	Initialise a writer.
+			 *	@param fileName The name of the file to write when Close is called.
+			 *	@param kmerLength The kmer length.
+			 *	@param charsPerWord The number of symbols packed into each word of a prototype encoding.
+			 */
+			Writer( const string & fileName, size_t kmerLength, size_t charsPerWord ) :
+				fileName( fileName ),
+				kmerLength( kmerLength ),
+				charsPerWord( charsPerWord ),
+				wordsPerKmer( Alphabet::WordsRequiredToPack( kmerLength, charsPerWord ) ) {}
+
+			/**
+			 *	Appends a cluster. The data is copied, so the cluster need not
+			 *	outlive the writer.
+			 */
+			template <typename Cluster>
+			void Add( const Cluster & cluster ) {
+				protoIdChars += cluster.prototype->FirstInstance().sequence.IdStr();
+				protoIdOffsets.push_back( protoIdChars.size() );
+
+				auto code = cluster.prototype->PackedEncoding();
+				protoCodes.insert( protoCodes.end(), code, code + wordsPerKmer );
+
+				for ( auto & kvp : cluster.metadata ) {
+					metaChars += kvp.first + ":" + kvp.second + ";";
+				}
+
+				metaOffsets.push_back( metaChars.size() );
+
+				for ( auto & kmer : cluster.kmers ) {
+					auto & instance = kmer.first->FirstInstance();
+					members.push_back( Member{ SeqNumber( instance.sequence ), (uint32_t) instance.kmerPosition, kmer.second } );
+				}
+
+				memberOffsets.push_back( members.size() );
+			}
+
+			/**
+			 *	Writes the file.
+			 *	@throws Exception if the file cannot be written.
+			 */
+			void Close() {
+				const size_t C = protoIdOffsets.size() - 1;
+
+				Header h;
+				memset( &h, 0, sizeof( h ) );
+				memcpy( h.tag, Tag(), sizeof( h.tag ) );
+				h.kmerLength = kmerLength;
+				h.charsPerWord = charsPerWord;
+				h.wordsPerKmer = wordsPerKmer;
+				h.clusterCount = C;
+				h.memberCount = members.size();
+				h.seqCount = seqIdOffsets.size() - 1;
+
+				uint64_t pos = sizeof( Header );
+
+				auto place = [&pos]( uint64_t & field, uint64_t bytes ) {
+					field = pos;
+					pos = (pos + bytes + 7) & ~uint64_t( 7 );
+				};
+
+				place( h.seqIdOffsets, seqIdOffsets.size() * sizeof( uint64_t ) );
+				place( h.seqIdChars, seqIdChars.size() );
+				place( h.protoIdOffsets, protoIdOffsets.size() * sizeof( uint64_t ) );
+				place( h.protoIdChars, protoIdChars.size() );
+				place( h.protoCodes, protoCodes.size() * sizeof( KmerWord ) );
+				place( h.metaOffsets, metaOffsets.size() * sizeof( uint64_t ) );
+				place( h.metaChars, metaChars.size() );
+				place( h.memberOffsets, memberOffsets.size() * sizeof( uint64_t ) );
+				place( h.members, members.size() * sizeof( Member ) );
+				h.fileSize = pos;
+
+				ofstream str( fileName, ios::binary );
+
+				if ( str.fail() ) {
+					throw Exception( "Unable to create file " + fileName, FileAndLine );
+				}
+
+				uint64_t written = 0;
+
+				auto emit = [&]( uint64_t offset, const void * data, uint64_t bytes ) {
+					static const char zeros[8] = { 0 };
+					str.write( zeros, offset - written );
+					str.write( (const char *) data, bytes );
+					written = offset + bytes;
+				};
+
+				emit( 0, &h, sizeof( h ) );
+				emit( h.seqIdOffsets, seqIdOffsets.data(), seqIdOffsets.size() * sizeof( uint64_t ) );
+				emit( h.seqIdChars, seqIdChars.data(), seqIdChars.size() );
+				emit( h.protoIdOffsets, protoIdOffsets.data(), protoIdOffsets.size() * sizeof( uint64_t ) );
+				emit( h.protoIdChars, protoIdChars.data(), protoIdChars.size() );
+				emit( h.protoCodes, protoCodes.data(), protoCodes.size() * sizeof( KmerWord ) );
+				emit( h.metaOffsets, metaOffsets.data(), metaOffsets.size() * sizeof( uint64_t ) );
+				emit( h.metaChars, metaChars.data(), metaChars.size() );
+				emit( h.memberOffsets, memberOffsets.data(), memberOffsets.size() * sizeof( uint64_t ) );
+				emit( h.members, members.data(), members.size() * sizeof( Member ) );
+				emit( h.fileSize, 0, 0 );
+
+				if ( str.fail() ) {
+					throw Exception( "Error writing file " + fileName, FileAndLine );
+				}
+			}
+
+		private:
+			uint32_t SeqNumber( EncodedFastaSequence & seq ) {
+				auto item = seqNumber.find( &seq );
+
+				if ( item != seqNumber.end() ) return item->second;
+
+				uint32_t s = (uint32_t) seqNumber.size();
+				seqNumber.emplace( &seq, s );
+				seqIdChars += seq.IdStr();
+				seqIdOffsets.push_back( seqIdChars.size() );
+				return s;
+			}
+		};
+	};
+}
@@ -13,6 +13,7 @@
 #include <iostream>
 
 #include <FastaSequence.hpp>
+#include <FastaLoader.hpp>
 #include <EncodedFastaSequence.hpp>
 #include <KmerClusterPrototype.hpp>
 #include <KmerCodebook.hpp>
@@ -35,7 +36,7 @@ namespace QutBio {
 			size_t idIndex,
 			Alphabet * alphabet
 		) {
-			return FastaSequence::Read(fileName, idIndex, alphabet);
+			return FastaLoader::Read(fileName, idIndex, alphabet);
 		}
 
 		static vector<FastaSequence *> Fasta(
@@ -123,6 +124,14 @@ namespace QutBio {
 		) {
 			KmerCodebook<DistanceFunction, Kmer> *codebook = 0;
 
+			if (BinaryCodebook::IsBinary(inFile)) {
+				BinaryCodebook saved(inFile);
+				return new KmerCodebook<DistanceFunction, Kmer>(
+					alphabet, distanceFunction, charsPerWord, kmerLength, dbIndex,
+					protoIndex, kmerIndex, saved
+					);
+			}
+
 			FILE * f = fopen(inFile.c_str(), "r");
 
 			if (f) {
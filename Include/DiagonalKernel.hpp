@@ -0,0 +1,287 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "DistanceType.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DIAGONAL_KERNEL_AVX2 1
+#include <immintrin.h>
+#else
+#define DIAGONAL_KERNEL_AVX2 0
+#endif
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	Computes the row and column minima of the kmer distance matrix between
+	 *	two sequences, where the distance between kmers is the sum of a
+	 *	per-symbol term over aligned positions. This is the inner loop of the
+	 *	Projector family of rankers.
+	 *
+	 *	The scalar path walks one diagonal at a time with a circular buffer,
+	 *	exactly as DiagonalGenerator does. The AVX2 path processes 16 adjacent
+	 *	diagonals at once in 16-bit lanes. It builds a profile holding the
+	 *	term for each distinct query symbol against every subject position,
+	 *	so that the terms entering and leaving the sliding windows of all 16
+	 *	diagonals are contiguous loads. Row minima are reduced horizontally
+	 *	with minpos; column minima are carried in a register which shifts one
+	 *	lane per row, so that each column is written once per strip.
+	 *
+	 *	The AVX2 path is selected at run time when the CPU supports it and
+	 *	every kmer distance fits in 16 bits without sign; otherwise the
+	 *	scalar path is used.
+	 */
+	class DiagonalKernel {
+	public:
+		/**
+		 *	Returns true iff the AVX2 path is compiled in and supported by the CPU.
+		 */
+		static bool HasAvx2() {
+#if DIAGONAL_KERNEL_AVX2
+			static const bool supported = __builtin_cpu_supports( "avx2" );
+			return supported;
+#else
+			return false;
+#endif
+		}
+
+		/**
+		 *	Updates rowMinima and colMinima with the minimum kmer distances in
+		 *	each row and column of the distance matrix. The caller initialises
+		 *	both arrays, usually to a large value.
+		 *	@param query The query symbols; at least m + k - 1 of them.
+		 *	@param subject The subject symbols; at least n + k - 1 of them.
+		 *	@param k The kmer length.
+		 *	@param m The number of query kmers.
+		 *	@param n The number of subject kmers.
+		 *	@param term Function (querySymbol, subjectSymbol) -> Distance, the distance between aligned symbols.
+		 *	@param rowMinima Array of m query kmer minima.
+		 *	@param colMinima Array of n subject kmer minima.
+		 */
+		template<typename QuerySymbol, typename SubjectSymbol, typename TermFunction>
+		static void RowColMinima(
+			const QuerySymbol * query,
+			const SubjectSymbol * subject,
+			size_t k,
+			size_t m,
+			size_t n,
+			TermFunction term,
+			Distance * rowMinima,
+			Distance * colMinima
+		) {
+			if ( !HasAvx2() || !RowColMinimaSimd( query, subject, k, m, n, term, rowMinima, colMinima ) ) {
+				RowColMinimaScalar( query, subject, k, m, n, term, rowMinima, colMinima );
+			}
+		}
+
+		/**
+		 *	Scalar version of RowColMinima, walking one diagonal at a time.
+		 */
+		template<typename QuerySymbol, typename SubjectSymbol, typename TermFunction>
+		static void RowColMinimaScalar(
+			const QuerySymbol * query,
+			const SubjectSymbol * subject,
+			size_t k,
+			size_t m,
+			size_t n,
+			TermFunction term,
+			Distance * rowMinima,
+			Distance * colMinima
+		) {
+			vector<Distance> buffer( k );
+
+			for ( size_t r = 0; r < m; r++ ) {
+				const size_t c_upper = r == 0 ? n : 1;
+
+				for ( size_t c = 0; c < c_upper; c++ ) {
+					const SubjectSymbol * a = subject + c;
+					const QuerySymbol * b = query + r;
+					Distance distance = 0;
+
+					size_t diagLength = std::min( m - r, n - c );
+
+					for ( size_t t = 0; t < k; t++, a++, b++ ) {
+						Distance currentTerm = term( *b, *a );
+						distance += currentTerm;
+						buffer[t] = currentTerm;
+					}
+
+					if ( distance < rowMinima[r] ) rowMinima[r] = distance;
+					if ( distance < colMinima[c] ) colMinima[c] = distance;
+
+					for ( size_t offset = 1, buffptr = 0; offset < diagLength; a++, b++, offset++, buffptr++ ) {
+						if ( buffptr >= k ) {
+							buffptr = 0;
+						}
+
+						distance -= buffer[buffptr];
+						Distance currentTerm = term( *b, *a );
+						buffer[buffptr] = currentTerm;
+						distance += currentTerm;
+
+						if ( distance < rowMinima[r + offset] ) rowMinima[r + offset] = distance;
+						if ( distance < colMinima[c + offset] ) colMinima[c + offset] = distance;
+					}
+				}
+			}
+		}
+
+		/**
+		 *	AVX2 version of RowColMinima.
+		 *	@returns false, having done nothing, if the AVX2 path is unavailable
+		 *		or some kmer distance might not fit in 16 bits.
+		 */
+		template<typename QuerySymbol, typename SubjectSymbol, typename TermFunction>
+		static bool RowColMinimaSimd(
+			const QuerySymbol * query,
+			const SubjectSymbol * subject,
+			size_t k,
+			size_t m,
+			size_t n,
+			TermFunction term,
+			Distance * rowMinima,
+			Distance * colMinima
+		) {
+#if DIAGONAL_KERNEL_AVX2
+			if ( m == 0 || n == 0 || k == 0 ) return true;
+
+			const size_t M = m + k - 1;
+			const size_t N = n + k - 1;
+
+			vector<QuerySymbol> symbols( query, query + M );
+			std::sort( symbols.begin(), symbols.end() );
+			symbols.erase( std::unique( symbols.begin(), symbols.end() ), symbols.end() );
+
+			vector<uint32_t> profileOffset( M );
+			const size_t stride = N + 2 * Lanes;
+
+			for ( size_t i = 0; i < M; i++ ) {
+				size_t u = std::lower_bound( symbols.begin(), symbols.end(), query[i] ) - symbols.begin();
+				profileOffset[i] = (uint32_t) (u * stride + Lanes);
+			}
+
+			// Zero padding either side lets out-of-range lanes slide harmlessly.
+			vector<uint16_t> profile( symbols.size() * stride, 0 );
+			Distance maxTerm = 0;
+
+			for ( size_t u = 0; u < symbols.size(); u++ ) {
+				uint16_t * row = profile.data() + u * stride + Lanes;
+
+				for ( size_t p = 0; p < N; p++ ) {
+					Distance t = term( symbols[u], subject[p] );
+
+					if ( t < 0 || t > 0xffff ) return false;
+
+					if ( t > maxTerm ) maxTerm = t;
+
+					row[p] = (uint16_t) t;
+				}
+			}
+
+			// 0xffff marks lanes outside the matrix, so real distances must stay below it.
+			if ( (uint64_t) maxTerm * k >= 0xffff ) return false;
+
+			RowColMinimaAvx2( profile.data(), profileOffset.data(), k, m, n, rowMinima, colMinima );
+			return true;
+#else
+			return false;
+#endif
+		}
+
+	private:
+		static const size_t Lanes = 16;
+
+#if DIAGONAL_KERNEL_AVX2
+		__attribute__( (target( "avx2" )) )
+		static void RowColMinimaAvx2(
+			const uint16_t * profile,
+			const uint32_t * profileOffset,
+			size_t k,
+			size_t m,
+			size_t n,
+			Distance * rowMinima,
+			Distance * colMinima
+		) {
+			const __m256i lanes = _mm256_setr_epi16( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 );
+			const __m256i ones = _mm256_set1_epi16( -1 );
+			const __m256i topLane = _mm256_setr_epi16( 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, -1 );
+			const ptrdiff_t M = (ptrdiff_t) m;
+			const ptrdiff_t N = (ptrdiff_t) n;
+			const ptrdiff_t L = (ptrdiff_t) Lanes;
+
+			// Lane l of a strip holds diagonal d0 + l, i.e. cell (i, i + d0 + l) at row i.
+#define DIAGONAL_KERNEL_TERMS(i) _mm256_loadu_si256( (const __m256i *) (profile + profileOffset[i] + (i) + d0) )
+
+			for ( ptrdiff_t d0 = 1 - M; d0 < N; d0 += L ) {
+				const ptrdiff_t iStart = std::max<ptrdiff_t>( 0, -(d0 + L - 1) );
+				const ptrdiff_t iEnd = std::min<ptrdiff_t>( M, N - d0 );
+
+				if ( iStart >= iEnd ) continue;
+
+				__m256i sum = _mm256_setzero_si256();
+
+				for ( ptrdiff_t t = 0; t < (ptrdiff_t) k; t++ ) {
+					sum = _mm256_add_epi16( sum, DIAGONAL_KERNEL_TERMS( iStart + t ) );
+				}
+
+				__m256i cols = ones;
+
+				for ( ptrdiff_t i = iStart; i < iEnd; i++ ) {
+					const ptrdiff_t c = i + d0;
+
+					if ( i > iStart ) {
+						// Lane 0 held column c - 1, which no later row of this strip touches.
+						if ( c > 0 ) {
+							Distance done = (uint16_t) _mm256_extract_epi16( cols, 0 );
+							if ( done < colMinima[c - 1] ) colMinima[c - 1] = done;
+						}
+
+						cols = _mm256_alignr_epi8( _mm256_permute2x128_si256( cols, cols, 0x81 ), cols, 2 );
+						cols = _mm256_or_si256( cols, topLane );
+
+						sum = _mm256_sub_epi16( sum, DIAGONAL_KERNEL_TERMS( i - 1 ) );
+						sum = _mm256_add_epi16( sum, DIAGONAL_KERNEL_TERMS( i + k - 1 ) );
+					}
+
+					const ptrdiff_t lo = std::min<ptrdiff_t>( std::max<ptrdiff_t>( -c, 0 ), L );
+					const ptrdiff_t hi = std::min<ptrdiff_t>( std::max<ptrdiff_t>( N - c, 0 ), L );
+					const __m256i valid = _mm256_and_si256(
+						_mm256_cmpgt_epi16( lanes, _mm256_set1_epi16( (short) (lo - 1) ) ),
+						_mm256_cmpgt_epi16( _mm256_set1_epi16( (short) hi ), lanes )
+					);
+					const __m256i dist = _mm256_or_si256( sum, _mm256_andnot_si256( valid, ones ) );
+
+					cols = _mm256_min_epu16( cols, dist );
+
+					__m128i half = _mm_min_epu16( _mm256_castsi256_si128( dist ), _mm256_extracti128_si256( dist, 1 ) );
+					Distance rowMin = _mm_cvtsi128_si32( _mm_minpos_epu16( half ) ) & 0xffff;
+
+					if ( rowMin < rowMinima[i] ) rowMinima[i] = rowMin;
+				}
+
+				alignas(32) uint16_t last[Lanes];
+				_mm256_store_si256( (__m256i *) last, cols );
+
+				for ( ptrdiff_t l = 0; l < L; l++ ) {
+					const ptrdiff_t c = iEnd - 1 + d0 + l;
+
+					if ( c >= 0 && c < N && last[l] < colMinima[c] ) colMinima[c] = last[l];
+				}
+			}
+
+#undef DIAGONAL_KERNEL_TERMS
+		}
+#endif
+	};
+}
@@ -0,0 +1,461 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Alphabet.hpp"
+#include "EncodedFastaSequence.hpp"
+#include "EncodedKmer.hpp"
+#include "Exception.hpp"
+#include "FastaLoader.hpp"
+#include "FastaSequence.hpp"
+
+#if !defined(_WIN32)
+#include "MappedFile.hpp"
+#endif
+
+#if USE_OMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	A list of EncodedFastaSequence objects whose packed kmer encodings are
+	 *	all held in one aligned arena, rather than in a matrix of vectors per
+	 *	sequence. The GetEncodedKmer* accessors of the sequences work as usual,
+	 *	and the codes are identical to those produced by Load::Encoded.
+	 *
+	 *	The encodings of sequence i occupy words [Offset(i), Offset(i + 1))
+	 *	of the arena: the 1-char encoding, followed by the rows of the
+	 *	charsPerWord encoding (see EncodedFastaSequence::EncodeInto). Each
+	 *	block starts on an Alignment-byte boundary. Offsets are relative to the
+	 *	start of the arena, so its image does not depend on where it is loaded.
+	 *
+	 *	A database loaded from a FASTA file may be saved to a cache file, which
+	 *	later runs map instead of parsing and encoding the FASTA file again.
+	 *	The cache is keyed by the size and hash of the FASTA file and by the
+	 *	encoding parameters; a cache with a different key is rebuilt.
+	 *
+	 *	Cache layout: Header, followed by sections aligned to Alignment bytes
+	 *		defLineOffsets	uint64[N+1]	byte offsets of definition lines within defLines.
+	 *		defLines		char[]		concatenated definition lines.
+	 *		symbolOffsets	uint64[N+1]	byte offsets of residues within symbols.
+	 *		symbols			byte[]		concatenated (padded) residue codes.
+	 *		wordOffsets		uint64[N+1]	word offsets of encodings within words.
+	 *		words			KmerWord[]	the arena.
+	 *
+	 *	The database owns its EncodedFastaSequence objects, and also the
+	 *	FastaSequence objects if it loaded them itself.
+	 */
+	class EncodedDatabase {
+	public:
+		/** The alignment, in bytes, of the arena and of the block of each sequence. */
+		static const size_t Alignment = 64;
+
+		/** The parameters which determine the content of a cache file. */
+		struct Key {
+			uint64_t sourceSize;
+			uint64_t sourceHash;
+			int64_t idIndex;
+			int64_t classIndex;
+			uint64_t kmerLength;
+			uint64_t charsPerWord;
+			uint64_t defaultSymbol;
+			uint64_t alphabetHash;
+		};
+
+		struct Header {
+			char tag[8];
+			Key key;
+			uint64_t count;
+			uint64_t defLineOffsets;
+			uint64_t defLines;
+			uint64_t symbolOffsets;
+			uint64_t symbols;
+			uint64_t wordOffsets;
+			uint64_t words;
+			uint64_t fileSize;
+		};
+
+		static const char * Tag() {
+			return "ENCDB01";
+		}
+
+	private:
+		vector<FastaSequence *> fasta;
+		vector<EncodedFastaSequence *> sequences;
+		vector<uint64_t> offsets;
+		vector<KmerWord> storage;
+		KmerWord * arena = 0;
+
+		// Row pointer table for the charsPerWord encodings of all sequences.
+		vector<KmerWord *> rows;
+
+#if !defined(_WIN32)
+		unique_ptr<MappedFile> file;
+#endif
+
+	public:
+		/**
+		 *	Encodes a list of sequences into a new arena.
+		 *	@param db The sequences to encode. These are padded to at least kmerLength.
+		 *	@param classIndex The index of the metadata field holding class labels, or -1.
+		 *	@param alphabet The alphabet used to pack the encodings.
+		 *	@param kmerLength The kmer length.
+		 *	@param charsPerWord The number of symbols packed into each word of the second encoding.
+		 *	@param defaultSymbol The symbol used to pad short sequences.
+		 */
+		EncodedDatabase(
+			const vector<FastaSequence *> & db,
+			int classIndex,
+			Alphabet * alphabet,
+			size_t kmerLength,
+			size_t charsPerWord,
+			Symbol defaultSymbol
+		) {
+			Encode( db, classIndex, alphabet, kmerLength, charsPerWord, defaultSymbol );
+		}
+
+		/**
+		 *	Loads and encodes a FASTA file, using a cache file if one is supplied.
+		 *	If the cache file exists and its key matches, it is mapped; otherwise
+		 *	the FASTA file is parsed and encoded and the cache file is (re)written.
+		 *	@param fastaFile The name of the FASTA file.
+		 *	@param cacheFile The name of the cache file, or empty to disable caching.
+		 *	@param idIndex The index of the metadata field holding sequence IDs.
+		 *	@param classIndex The index of the metadata field holding class labels, or -1.
+		 *	@param alphabet The alphabet used to pack the encodings.
+		 *	@param kmerLength The kmer length.
+		 *	@param charsPerWord The number of symbols packed into each word of the second encoding.
+		 *	@param defaultSymbol The symbol used to pad short sequences.
+		 */
+		EncodedDatabase(
+			const string & fastaFile,
+			const string & cacheFile,
+			int idIndex,
+			int classIndex,
+			Alphabet * alphabet,
+			size_t kmerLength,
+			size_t charsPerWord,
+			Symbol defaultSymbol
+		) {
+#if !defined(_WIN32)
+			if ( cacheFile.size() > 0 ) {
+				Key key = GetKey( fastaFile, idIndex, classIndex, alphabet, kmerLength, charsPerWord, defaultSymbol );
+
+				if ( Map( cacheFile, key, idIndex, classIndex, alphabet, defaultSymbol ) ) return;
+
+				FastaLoader::Read( fastaFile, idIndex, alphabet, fasta );
+				Encode( fasta, classIndex, alphabet, kmerLength, charsPerWord, defaultSymbol );
+				Save( cacheFile, key );
+				return;
+			}
+#endif
+
+			FastaLoader::Read( fastaFile, idIndex, alphabet, fasta );
+			Encode( fasta, classIndex, alphabet, kmerLength, charsPerWord, defaultSymbol );
+		}
+
+		EncodedDatabase( const EncodedDatabase & other ) = delete;
+
+		EncodedDatabase & operator=( const EncodedDatabase & other ) = delete;
+
+		virtual ~EncodedDatabase() {
+			for ( auto seq : sequences ) {
+				delete seq;
+			}
+
+			for ( auto seq : fasta ) {
+				delete seq;
+			}
+		}
+
+		/** Gets the list of sequences. */
+		vector<EncodedFastaSequence *> & Sequences() {
+			return sequences;
+		}
+
+		/** Gets the number of sequences. */
+		size_t Size() const {
+			return sequences.size();
+		}
+
+		EncodedFastaSequence * operator[]( size_t i ) const {
+			return sequences[i];
+		}
+
+		/** Gets the address of the arena. */
+		const KmerWord * Words() const {
+			return arena;
+		}
+
+		/** Gets the number of words in the arena. */
+		size_t WordCount() const {
+			return offsets.back();
+		}
+
+		/** Gets the offset, in words, of the encodings of sequence i, 0 <= i <= Size(). */
+		size_t Offset( size_t i ) const {
+			return offsets[i];
+		}
+
+		/** Returns true iff the arena is mapped from a cache file. */
+		bool IsMapped() const {
+#if !defined(_WIN32)
+			return file != nullptr;
+#else
+			return false;
+#endif
+		}
+
+		/**
+		 *	Gets the 64-bit FNV-1a hash of a block of bytes.
+		 */
+		static uint64_t Hash( const void * data, size_t size, uint64_t hash = 14695981039346656037ull ) {
+			auto p = (const unsigned char *) data;
+
+			for ( size_t i = 0; i < size; i++ ) {
+				hash = (hash ^ p[i]) * 1099511628211ull;
+			}
+
+			return hash;
+		}
+
+	private:
+		void Encode(
+			const vector<FastaSequence *> & db,
+			int classIndex,
+			Alphabet * alphabet,
+			size_t kmerLength,
+			size_t charsPerWord,
+			Symbol defaultSymbol
+		) {
+			const size_t n = db.size();
+			const size_t wordsPerBlock = Alignment / sizeof( KmerWord );
+
+			sequences.reserve( n );
+			offsets.resize( n + 1 );
+			offsets[0] = 0;
+
+			// Class labels are registered in a shared table, so sequences are
+			// constructed in order.
+			for ( size_t i = 0; i < n; i++ ) {
+				auto seq = new EncodedFastaSequence( db[i], classIndex, alphabet, kmerLength, charsPerWord, defaultSymbol, EncodedFastaSequence::DeferEncoding() );
+				sequences.push_back( seq );
+				size_t words = seq->EncodedWords();
+				offsets[i + 1] = offsets[i] + (words + wordsPerBlock - 1) / wordsPerBlock * wordsPerBlock;
+			}
+
+			storage.resize( offsets[n] + wordsPerBlock );
+			arena = storage.data();
+
+			while ( ((uintptr_t) arena) % Alignment != 0 ) arena++;
+
+			const size_t rowsPerSeq = RowsPerSequence( kmerLength, charsPerWord );
+			rows.resize( n * rowsPerSeq );
+
+#if USE_OMP
+#pragma omp parallel for schedule(dynamic,256)
+#endif
+			for ( size_t i = 0; i < n; i++ ) {
+				sequences[i]->EncodeInto( arena + offsets[i], rows.data() + i * rowsPerSeq );
+			}
+		}
+
+		static size_t RowsPerSequence( size_t kmerLength, size_t charsPerWord ) {
+			return charsPerWord > 1 ? Alphabet::EncodedRows( kmerLength, charsPerWord ) : 0;
+		}
+
+#if !defined(_WIN32)
+		static Key GetKey(
+			const string & fastaFile,
+			int idIndex,
+			int classIndex,
+			Alphabet * alphabet,
+			size_t kmerLength,
+			size_t charsPerWord,
+			Symbol defaultSymbol
+		) {
+			MappedFile source( fastaFile );
+			string symbols = alphabet->Symbols();
+
+			Key key;
+			memset( &key, 0, sizeof( key ) );
+			key.sourceSize = source.Size();
+			key.sourceHash = Hash( source.Data(), source.Size() );
+			key.idIndex = idIndex;
+			key.classIndex = classIndex;
+			key.kmerLength = kmerLength;
+			key.charsPerWord = charsPerWord;
+			key.defaultSymbol = defaultSymbol.value;
+			key.alphabetHash = Hash( symbols.data(), symbols.size() );
+			return key;
+		}
+
+		/**
+		 *	Maps a cache file and builds the sequences from it.
+		 *	@returns false if the file does not exist or does not match the key.
+		 *	@throws Exception if the file matches the key but is truncated or corrupt.
+		 */
+		bool Map(
+			const string & cacheFile,
+			const Key & key,
+			int idIndex,
+			int classIndex,
+			Alphabet * alphabet,
+			Symbol defaultSymbol
+		) {
+			if ( !ifstream( cacheFile ) ) return false;
+
+			unique_ptr<MappedFile> mapped( new MappedFile( cacheFile ) );
+
+			if ( !mapped->StartsWith( Tag(), sizeof( Header::tag ) ) || mapped->Size() < sizeof( Header ) ) {
+				return false;
+			}
+
+			auto header = mapped->At<Header>( 0 );
+
+			if ( memcmp( &header->key, &key, sizeof( key ) ) != 0 ) return false;
+
+			if ( header->fileSize != mapped->Size() ) {
+				throw Exception( "File " + cacheFile + " is truncated or corrupt.", FileAndLine );
+			}
+
+			const size_t n = header->count;
+			auto defLineOffsets = mapped->At<uint64_t>( header->defLineOffsets, n + 1 );
+			auto defLines = mapped->At<char>( header->defLines, defLineOffsets[n] );
+			auto symbolOffsets = mapped->At<uint64_t>( header->symbolOffsets, n + 1 );
+			auto symbols = mapped->At<byte>( header->symbols, symbolOffsets[n] );
+			auto wordOffsets = mapped->At<uint64_t>( header->wordOffsets, n + 1 );
+			auto words = mapped->At<KmerWord>( header->words, wordOffsets[n] );
+
+			fasta.reserve( n );
+			sequences.reserve( n );
+			offsets.assign( wordOffsets, wordOffsets + n + 1 );
+			arena = (KmerWord *) words;
+
+			const size_t rowsPerSeq = RowsPerSequence( key.kmerLength, key.charsPerWord );
+			rows.resize( n * rowsPerSeq );
+
+			vector<Symbol> residues;
+
+			for ( size_t i = 0; i < n; i++ ) {
+				string defLine( defLines + defLineOffsets[i], defLines + defLineOffsets[i + 1] );
+				residues.resize( symbolOffsets[i + 1] - symbolOffsets[i] );
+
+				for ( size_t j = 0; j < residues.size(); j++ ) {
+					residues[j] = Symbol::From( symbols[symbolOffsets[i] + j] );
+				}
+
+				auto charData = new FastaSequence( defLine, residues, idIndex, alphabet );
+				fasta.push_back( charData );
+
+				auto seq = new EncodedFastaSequence( charData, classIndex, alphabet, key.kmerLength, key.charsPerWord, defaultSymbol, EncodedFastaSequence::DeferEncoding() );
+				sequences.push_back( seq );
+
+				if ( seq->EncodedWords() > offsets[i + 1] - offsets[i] ) {
+					throw Exception( "File " + cacheFile + " is truncated or corrupt.", FileAndLine );
+				}
+
+				seq->AttachEncoding( arena + offsets[i], rows.data() + i * rowsPerSeq );
+			}
+
+			file = std::move( mapped );
+			return true;
+		}
+
+		/**
+		 *	Writes the database to a cache file. The file is written under a
+		 *	temporary name unique to this process and then renamed, so that a
+		 *	concurrent or interrupted run never sees a partial cache.
+		 */
+		void Save( const string & cacheFile, const Key & key ) const {
+			const size_t n = sequences.size();
+
+			vector<uint64_t> defLineOffsets( n + 1 );
+			string defLines;
+			vector<uint64_t> symbolOffsets( n + 1 );
+			vector<byte> symbols;
+
+			for ( size_t i = 0; i < n; i++ ) {
+				defLineOffsets[i] = defLines.size();
+				defLines += sequences[i]->base->DefLine();
+
+				symbolOffsets[i] = symbols.size();
+
+				for ( auto s : sequences[i]->base->Sequence() ) {
+					symbols.push_back( s.value );
+				}
+			}
+
+			defLineOffsets[n] = defLines.size();
+			symbolOffsets[n] = symbols.size();
+
+			Header h;
+			memset( &h, 0, sizeof( h ) );
+			memcpy( h.tag, Tag(), sizeof( h.tag ) );
+			h.key = key;
+			h.count = n;
+
+			uint64_t pos = sizeof( Header );
+
+			auto place = [&pos]( uint64_t & field, uint64_t bytes ) {
+				pos = (pos + Alignment - 1) / Alignment * Alignment;
+				field = pos;
+				pos += bytes;
+			};
+
+			place( h.defLineOffsets, defLineOffsets.size() * sizeof( uint64_t ) );
+			place( h.defLines, defLines.size() );
+			place( h.symbolOffsets, symbolOffsets.size() * sizeof( uint64_t ) );
+			place( h.symbols, symbols.size() );
+			place( h.wordOffsets, offsets.size() * sizeof( uint64_t ) );
+			place( h.words, offsets.back() * sizeof( KmerWord ) );
+			h.fileSize = pos;
+
+			string tempFile = MappedFile::TempFileName( cacheFile );
+			ofstream str( tempFile, ios::binary );
+
+			if ( str.fail() ) {
+				throw Exception( "Unable to create file " + tempFile, FileAndLine );
+			}
+
+			uint64_t written = 0;
+
+			auto emit = [&]( uint64_t offset, const void * data, uint64_t bytes ) {
+				static const char zeros[Alignment] = { 0 };
+				str.write( zeros, offset - written );
+				str.write( (const char *) data, bytes );
+				written = offset + bytes;
+			};
+
+			emit( 0, &h, sizeof( h ) );
+			emit( h.defLineOffsets, defLineOffsets.data(), defLineOffsets.size() * sizeof( uint64_t ) );
+			emit( h.defLines, defLines.data(), defLines.size() );
+			emit( h.symbolOffsets, symbolOffsets.data(), symbolOffsets.size() * sizeof( uint64_t ) );
+			emit( h.symbols, symbols.data(), symbols.size() );
+			emit( h.wordOffsets, offsets.data(), offsets.size() * sizeof( uint64_t ) );
+			emit( h.words, arena, offsets.back() * sizeof( KmerWord ) );
+			str.close();
+
+			if ( str.fail() || rename( tempFile.c_str(), cacheFile.c_str() ) != 0 ) {
+				remove( tempFile.c_str() );
+				throw Exception( "Error writing file " + cacheFile, FileAndLine );
+			}
+		}
+#endif
+	};
+}
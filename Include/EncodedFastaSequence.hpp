@@ -35,6 +35,20 @@ namespace QutBio {
 		// Update (hacky!) When switching to the centroid-based codebook, I need to access one-char and two-char encodings.
 		EncodingMatrix encoding1, encoding2;
 
+	protected:
+		// Row addresses used by the GetEncodedKmer* accessors. packed1 is the 1-char
+		// encoding; packed2[i] is row i of the charsPerWord encoding. They refer
+		// either to encoding1 and encoding2 or, if inArena is true, to the arena of
+		// an EncodedDatabase, in which case the encoding matrices are empty.
+		KmerWord * packed1 = 0;
+		KmerWord ** packed2 = 0;
+		vector<KmerWord *> packedRows;
+		bool inArena = false;
+
+	public:
+		/** Tag which selects the constructor that leaves the sequence unencoded. */
+		struct DeferEncoding {};
+
 		EncodedFastaSequence(const EncodedFastaSequence & other) = delete;
 
 		EncodedFastaSequence & operator= (const EncodedFastaSequence & other) = delete;
@@ -56,6 +70,7 @@ namespace QutBio {
 			classNumbers = std::move(classNumbers);
 			encoding1 = std::move(other.encoding1);
 			encoding2 = std::move(other.encoding2);
+			MoveRows(other);
 			return *this;
 		}
 
@@ -76,7 +91,9 @@ namespace QutBio {
 			classNumbers(std::move(classNumbers)),
 			encoding1(std::move(other.encoding1)),
 			encoding2(std::move(other.encoding2))
-		{}
+		{
+			MoveRows(other);
+		}
 
 		static EncodedFastaSequence & Zero() {
 			static EncodedFastaSequence zero(FastaSequence::Zero(), -1, nullptr, 0, 0, Symbol::From(0));
@@ -126,6 +143,25 @@ namespace QutBio {
 			Init(classIndex, alphabet, kmerLength, charsPerWord, defaultSymbol);
 		}
 
+		/**
+		 *	Constructs a sequence whose class labels are set but whose kmers are not
+		 *	yet packed. The sequence is padded and its encoding parameters are set,
+		 *	so EncodedWords() is valid, but EncodeInto must be called before the
+		 *	GetEncodedKmer* accessors are used.
+		 */
+		EncodedFastaSequence(
+			FastaSequence * charData,
+			int classIndex,
+			pAlphabet alphabet,
+			size_t kmerLength,
+			size_t charsPerWord,
+			Symbol defaultSymbol,
+			DeferEncoding
+		) : SequenceWrapper(charData) {
+			SetClassLabel(classIndex);
+			PrepareEncoding(alphabet, kmerLength, charsPerWord, defaultSymbol);
+		}
+
 		void Init(
 			int classIndex,
 			pAlphabet alphabet,
@@ -133,6 +169,11 @@ namespace QutBio {
 			size_t charsPerWord,
 			Symbol defaultSymbol
 		) {
+			SetClassLabel(classIndex);
+			Encode(alphabet, kmerLength, charsPerWord, defaultSymbol);
+		}
+
+		void SetClassLabel(int classIndex) {
 			this->classLabel = classIndex >= 0 ? base->Metadata(classIndex) : "";
 
 			// cerr << "classLabel = '" << classLabel << "'\n";
@@ -145,8 +186,6 @@ namespace QutBio {
 					classNumbers.push_back(classNumber);
 				}
 			}
-
-			Encode(alphabet, kmerLength, charsPerWord, defaultSymbol);
 		}
 
 		virtual ~EncodedFastaSequence() {
@@ -257,19 +296,94 @@ namespace QutBio {
 		*/
 
 		void Encode(Alphabet *alphabet, size_t kmerLength, size_t charsPerWord, Symbol defaultSymbol ) {
-			base->EnsureLengthAtLeast( kmerLength, alphabet->Decode(defaultSymbol) );
+			PrepareEncoding(alphabet, kmerLength, charsPerWord, defaultSymbol);
 
 			auto sequence = base->Sequence().data();
 			auto len = base->Length();
 
-			this->charsPerWord = charsPerWord;
-			this->kmerLength = kmerLength;
-			base->Pad(kmerLength, defaultSymbol);
 			alphabet->Encode(sequence, len, kmerLength, 1, encoding1);
 
 			if (charsPerWord > 1) {
 				alphabet->Encode(sequence, len, kmerLength, charsPerWord, encoding2);
 			}
+
+			inArena = false;
+			SetRows();
+		}
+
+		/**
+		 *	Gets the number of KmerWords needed to hold both packed encodings of this
+		 *	sequence, in the layout produced by EncodeInto.
+		 */
+		size_t EncodedWords() const {
+			size_t len = base->Length();
+			size_t words = Alphabet::EncodedRowWords(len, kmerLength, 1, 0);
+
+			for (size_t i = 0; i < Rows2(); i++) {
+				words += Alphabet::EncodedRowWords(len, kmerLength, charsPerWord, i);
+			}
+
+			return words;
+		}
+
+		/**
+		 *	Packs the kmers of a sequence prepared by the DeferEncoding constructor
+		 *	into caller-supplied storage: the 1-char encoding, followed by the rows
+		 *	of the charsPerWord encoding. The codes are those produced by Encode.
+		 *	@param words The address of EncodedWords() words, which must remain valid
+		 *		for the lifetime of this object.
+		 *	@param rows The address of charsPerWord row pointers, which must also remain
+		 *		valid for the lifetime of this object. Not used if charsPerWord <= 1.
+		 */
+		void EncodeInto(KmerWord * words, KmerWord ** rows) {
+			auto sequence = base->Sequence().data();
+			auto len = base->Length();
+
+			alphabet->CheckEncodable(len, kmerLength, 1);
+			alphabet->EncodeRow(sequence, len, kmerLength, 1, 0, words);
+
+			if (charsPerWord > 1) {
+				alphabet->CheckEncodable(len, kmerLength, charsPerWord);
+			}
+
+			KmerWord * row = words + Alphabet::EncodedRowWords(len, kmerLength, 1, 0);
+
+			for (size_t i = 0; i < Rows2(); i++) {
+				alphabet->EncodeRow(sequence, len, kmerLength, charsPerWord, i, row);
+				row += Alphabet::EncodedRowWords(len, kmerLength, charsPerWord, i);
+			}
+
+			AttachEncoding(words, rows);
+		}
+
+		/**
+		 *	Points the accessors of a sequence prepared by the DeferEncoding constructor
+		 *	at encodings previously laid out by EncodeInto, for example in a mapped
+		 *	EncodedDatabase cache file. Arguments are as for EncodeInto.
+		 */
+		void AttachEncoding(KmerWord * words, KmerWord ** rows) {
+			auto len = base->Length();
+
+			encoding1.clear();
+			encoding2.clear();
+			packedRows.clear();
+			packedRows.shrink_to_fit();
+
+			packed1 = words;
+			packed2 = charsPerWord > 1 ? rows : 0;
+			inArena = true;
+
+			words += Alphabet::EncodedRowWords(len, kmerLength, 1, 0);
+
+			for (size_t i = 0; i < Rows2(); i++) {
+				packed2[i] = words;
+				words += Alphabet::EncodedRowWords(len, kmerLength, charsPerWord, i);
+			}
+		}
+
+		/** Returns true iff the packed encodings are held in an EncodedDatabase arena. */
+		bool InArena() const {
+			return inArena;
 		}
 
 		EncodedKmer GetEncodedKmer(size_t pos) {
@@ -278,26 +392,65 @@ namespace QutBio {
 
 		EncodedKmer GetEncodedKmerGeneral(size_t pos) {
 			return kmerLength <= charsPerWord
-				? &encoding2[0][pos]
-				: &encoding2[pos % charsPerWord][pos / charsPerWord];
+				? packed2[0] + pos
+				: packed2[pos % charsPerWord] + pos / charsPerWord;
 		}
 
 		EncodedKmer GetEncodedKmer1(size_t pos) {
-			return &encoding1[0][pos];
+			return packed1 + pos;
 		}
 
 		EncodedKmer GetEncodedKmer2(size_t pos) {
-			return kmerLength <= charsPerWord ? GetEncodedKmer1(pos) : &encoding2[pos % 2][pos / 2];
+			return kmerLength <= charsPerWord ? GetEncodedKmer1(pos) : packed2[pos % 2] + pos / 2;
 		}
 
 		EncodedKmer GetEncodedKmer3(size_t pos) {
-			return kmerLength <= charsPerWord ? GetEncodedKmer1(pos) : &encoding2[pos % 3][pos / 3];
+			return kmerLength <= charsPerWord ? GetEncodedKmer1(pos) : packed2[pos % 3] + pos / 3;
 		}
 
 		EncodedKmer GetEncodedKmerError(size_t pos) {
 			(cerr << "GetEncodedKmerError -- this function should never be called.\n").flush();
 			return 0;
 		}
+
+	private:
+		void PrepareEncoding(Alphabet *alphabet, size_t kmerLength, size_t charsPerWord, Symbol defaultSymbol) {
+			base->EnsureLengthAtLeast( kmerLength, alphabet->Decode(defaultSymbol) );
+
+			this->alphabet = alphabet;
+			this->charsPerWord = charsPerWord;
+			this->kmerLength = kmerLength;
+			base->Pad(kmerLength, defaultSymbol);
+		}
+
+		/** Gets the number of rows in the charsPerWord encoding. */
+		size_t Rows2() const {
+			return charsPerWord > 1 ? Alphabet::EncodedRows(kmerLength, charsPerWord) : 0;
+		}
+
+		/** Points the accessors at encoding1 and encoding2. */
+		void SetRows() {
+			packed1 = encoding1.size() > 0 ? encoding1[0].data() : 0;
+			packedRows.resize(encoding2.size());
+
+			for (size_t i = 0; i < encoding2.size(); i++) {
+				packedRows[i] = encoding2[i].data();
+			}
+
+			packed2 = packedRows.data();
+		}
+
+		void MoveRows(const EncodedFastaSequence & other) {
+			inArena = other.inArena;
+
+			if (inArena) {
+				packed1 = other.packed1;
+				packed2 = other.packed2;
+			}
+			else {
+				SetRows();
+			}
+		}
 	};
 
 	struct pFastaHash {
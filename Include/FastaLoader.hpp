@@ -0,0 +1,177 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Alphabet.hpp"
+#include "Exception.hpp"
+#include "FastaSequence.hpp"
+
+#if !defined(_WIN32)
+#include "MappedFile.hpp"
+#endif
+
+#if USE_OMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	Parallel FASTA file loader. The file is memory-mapped and split into
+	 *	chunks which start at definition lines, and the chunks are parsed
+	 *	concurrently. Sequence IDs are then registered in file order, so the
+	 *	result, including FastaSequence id numbers, is the same as that of
+	 *	FastaSequence::Read.
+	 *
+	 *	On Windows, where MappedFile is not available, this falls back to
+	 *	FastaSequence::Read.
+	 */
+	class FastaLoader {
+	public:
+		/** The nominal number of bytes in a chunk. */
+		static const size_t ChunkSize = 1 << 20;
+
+		/**
+		 *	Parses a FASTA file.
+		 *	@param fileName The name of the file.
+		 *	@param idIndex The index of the pipe-separated field (counting from 0) that contains the id number.
+		 *	@param alphabet The alphabet used to encode the sequences.
+		 *	@param sequences A list onto which the sequences from the file will be appended.
+		 *	@throws Exception if the file cannot be read or a definition line has no ID field.
+		 */
+		static void Read(
+			const string & fileName,
+			int idIndex,
+			Alphabet * alphabet,
+			vector<FastaSequence *> & sequences
+		) {
+#if defined(_WIN32)
+			ifstream reader( fileName );
+			FastaSequence::Read( reader, idIndex, alphabet, sequences );
+#else
+			MappedFile file( fileName );
+			const char * data = file.Data();
+			const size_t size = file.Size();
+
+			vector<size_t> chunkStart{ 0 };
+
+			// Chunks start at a '>' at the beginning of a line, which FastaSequence::Read
+			// also treats as a definition line.
+			for ( size_t pos = ChunkSize; pos < size; pos = chunkStart.back() + ChunkSize ) {
+				size_t start = size;
+
+				for ( size_t s = pos - 1; s < size; ) {
+					auto nl = (const char *) memchr( data + s, '\n', size - s );
+
+					if ( !nl ) break;
+
+					s = nl - data + 1;
+
+					if ( s < size && data[s] == '>' ) {
+						start = s;
+						break;
+					}
+				}
+
+				if ( start >= size ) break;
+
+				chunkStart.push_back( start );
+			}
+
+			chunkStart.push_back( size );
+
+			const size_t chunks = chunkStart.size() - 1;
+			vector<vector<FastaSequence *>> parsed( chunks );
+
+#if USE_OMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+			for ( size_t c = 0; c < chunks; c++ ) {
+				ParseChunk( data + chunkStart[c], data + chunkStart[c + 1], idIndex, alphabet, parsed[c] );
+			}
+
+			size_t first = sequences.size();
+
+			for ( auto & chunk : parsed ) {
+				sequences.insert( sequences.end(), chunk.begin(), chunk.end() );
+			}
+
+			for ( size_t i = first; i < sequences.size(); i++ ) {
+				sequences[i]->RegisterId();
+			}
+#endif
+		}
+
+		/**
+		 *	Parses a FASTA file.
+		 *	@returns A list containing the sequences from the file.
+		 */
+		static vector<FastaSequence *> Read(
+			const string & fileName,
+			int idIndex,
+			Alphabet * alphabet
+		) {
+			vector<FastaSequence *> sequences;
+			Read( fileName, idIndex, alphabet, sequences );
+			return sequences;
+		}
+
+	private:
+		/**
+		 *	Parses the records in [begin, end) line by line, following the
+		 *	rules of FastaSequence::Read: lines are trimmed of blanks; a line
+		 *	which then starts with '>' is a definition line; other lines are
+		 *	sequence data; records with no sequence data are discarded.
+		 */
+		static void ParseChunk(
+			const char * begin,
+			const char * end,
+			int idIndex,
+			Alphabet * alphabet,
+			vector<FastaSequence *> & sequences
+		) {
+			string defLine;
+			string sequence;
+
+			auto update = [&]() {
+				if ( sequence.size() > 0 ) {
+					sequences.push_back( new FastaSequence( defLine, sequence, idIndex, alphabet, FastaSequence::DeferRegistration() ) );
+				}
+			};
+
+			for ( const char * line = begin; line < end; ) {
+				const char * next = (const char *) memchr( line, '\n', end - line );
+				const char * lineEnd = next ? next : end;
+				const char * a = line;
+				const char * b = lineEnd;
+
+				while ( a < b && isblank( *a ) ) a++;
+				while ( b > a && isblank( b[-1] ) ) b--;
+
+				if ( a < b && *a == '>' ) {
+					update();
+					sequence.clear();
+					defLine.assign( a + 1, b );
+				}
+				else {
+					sequence.append( a, b );
+				}
+
+				line = next ? next + 1 : end;
+			}
+
+			update();
+		}
+	};
+}
@@ -134,6 +134,27 @@ namespace QutBio {
 			alphabet->Encode( sequence.data(), sequence.size(), 2, digrams );
 		}
 
+		/// Tag which selects the constructor that defers ID registration.
+		struct DeferRegistration {};
+
+		/**
+		 * Construct a new FastaSequence from a string of sequence data, as the
+		 * first constructor does, but without registering the sequence ID. This
+		 * allows a file to be parsed concurrently; the caller must then call
+		 * RegisterId on each sequence, in file order, before the sequence is used,
+		 * so that id numbers are the same as those assigned by Read.
+		*/
+		FastaSequence(
+			const string &defLine,
+			const string &sequence,
+			int idIndex,
+			Alphabet * alphabet,
+			DeferRegistration
+		) : idIndex( idIndex ), alphabet( alphabet ) {
+			SetSequence( sequence );
+			ParseDefLine( defLine );
+		}
+
 		FastaSequence( const FastaSequence & other ) = delete;
 
 		FastaSequence & operator=( const FastaSequence & other ) = delete;
@@ -204,6 +225,10 @@ namespace QutBio {
 		 * supplied default symbol if not.
 		 */
 		void EnsureLengthAtLeast( size_t minLength, Symbol defaultSymbol ) {
+			// charData is already normalised, so unless the sequence has been padded,
+			// re-parsing it would not change anything.
+			if ( charData.size() >= minLength && sequence.size() == charData.size() ) return;
+
 			string copy = charData;
 
 			while ( copy.size() < minLength ) copy.push_back( alphabet->Decode(defaultSymbol) );
@@ -294,12 +319,19 @@ namespace QutBio {
 		 */
 
 		void SetDefLine( const string &defLine ) {
-			metadata = String::Split( defLine, '|' );
-
-			if ( metadata.size() > 0 && metadata[0][0] == '>' ) {
-				metadata[0].erase( 0, 1 );
-			}
+			ParseDefLine( defLine );
+			RegisterId();
+		}
 
+		/**
+		 * Assigns the unique id number of the sequence by registering its ID.
+		 * This is done by SetDefLine, so it need only be called for sequences
+		 * constructed with DeferRegistration.
+		 *
+		 * @throws Exception is thrown if the idIndex equals or exceeds the
+		 * 	size of the metadata vector.
+		 */
+		void RegisterId() {
 			idNumber = Register( IdStr() );
 		}
 
@@ -725,6 +757,18 @@ namespace QutBio {
 	private:
 		int nameIndex = -1;
 
+		/**
+		 * Replaces the contents of the metadata vector by splitting the
+		 * supplied definition line, without registering the ID.
+		 */
+		void ParseDefLine( const string &defLine ) {
+			metadata = String::Split( defLine, '|' );
+
+			if ( metadata.size() > 0 && metadata[0][0] == '>' ) {
+				metadata[0].erase( 0, 1 );
+			}
+		}
+
 	public:
 		/// Get the optional position of the sequence name in the metadata list.
 		int NameIndex() const { return nameIndex; }
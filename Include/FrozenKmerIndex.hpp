@@ -0,0 +1,369 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <vector>
+
+#include "Alphabet.hpp"
+#include "EncodedFastaSequence.hpp"
+#include "Exception.hpp"
+#include "Kmer.hpp"
+#include "RadixSort.hpp"
+
+#if USE_OMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	Compact, read-only alternative to KmerIndex and KmerHashIndex. Each
+	 *	kmer is packed into a 64-bit integer code (the perfect hash computed
+	 *	by Alphabet::Encode), and the codes are held in an open-addressing
+	 *	table which is filled once by the constructor and thereafter only
+	 *	probed, so Find may be called from any number of threads without
+	 *	locking.
+	 *
+	 *	The instances of all kmers are stored in a single flat array, grouped
+	 *	by kmer (CSR layout). Kmers are numbered in ascending order of code.
+	 *	Within a group, instances are in the order in which they occur in the
+	 *	dataset, as in the instance list of the corresponding Kmer in
+	 *	KmerIndex.
+	 *
+	 *	The index is built in parallel by sort-and-group: the (code, sequence,
+	 *	position) triple of every kmer occurrence is generated, the triples
+	 *	are sorted by a stable parallel radix sort on code, and runs of equal
+	 *	code become the kmers.
+	 *
+	 *	Tools which cluster Kmer objects can obtain them from GetKmers, which
+	 *	constructs them in a single block with exactly sized instance lists.
+	 */
+	class FrozenKmerIndex {
+	public:
+		/** The location of an instance of a kmer. */
+		struct Instance {
+			/** The index of the containing sequence in the dataset. */
+			uint32_t sequence;
+
+			/** The offset of the kmer from the start of the sequence. */
+			uint32_t kmerPosition;
+		};
+
+		/** The instances of a kmer: a contiguous range of the instance array. */
+		class InstanceRange {
+			const Instance * first;
+			const Instance * last;
+
+		public:
+			InstanceRange( const Instance * first, const Instance * last ) : first( first ), last( last ) {}
+
+			const Instance * begin() const { return first; }
+
+			const Instance * end() const { return last; }
+
+			size_t size() const { return last - first; }
+
+			bool empty() const { return first == last; }
+		};
+
+	private:
+		static const uint32_t Empty = numeric_limits<uint32_t>::max();
+
+		/** A kmer occurrence, the unit sorted during construction. */
+		struct Entry {
+			uint64_t code;
+			uint32_t sequence;
+			uint32_t kmerPosition;
+		};
+
+		vector<EncodedFastaSequence *> dataset;
+		size_t kmerLength;
+		const Alphabet * alphabet;
+
+		/** Open-addressing table: the code held in each slot, and the number of the kmer, or Empty. */
+		vector<uint64_t> slotCode;
+		vector<uint32_t> slotKmer;
+		size_t mask = 0;
+		int shift = 64;
+
+		/** The code of each kmer, in ascending order. */
+		vector<uint64_t> codes;
+
+		/** Instances of kmer i occupy instances[offsets[i]..offsets[i+1]). */
+		vector<size_t> offsets;
+		vector<Instance> instances;
+
+		/** Kmer objects materialised by GetKmers, constructed in a single block. */
+		Kmer * kmerStore = nullptr;
+		vector<Kmer *> kmers;
+
+	public:
+		/**
+		 *	Constructs a FrozenKmerIndex.
+		 *	@param dataset a list of sequences; the index of each sequence in this list is the sequence number recorded in its instances.
+		 *	@param kmerLength the word length for tiling.
+		 *	@param alphabet the alphabet used to encode the sequences and generate codes.
+		 *	@throws Exception if kmers cannot be packed into 64 bits, or if the dataset has more sequences, or more distinct kmers, than can be numbered in 32 bits.
+		 */
+		FrozenKmerIndex(
+			const vector<EncodedFastaSequence *> & dataset,
+			size_t kmerLength,
+			const Alphabet * alphabet
+		) :
+			dataset( dataset ),
+			kmerLength( kmerLength ),
+			alphabet( alphabet )
+			//
+		{
+			const size_t N = dataset.size();
+
+			if ( pow( (double) alphabet->Size(), (double) kmerLength ) > pow( 2.0, 64 ) ) {
+				throw Exception( "Kmers are too long to pack into 64 bits for FrozenKmerIndex.", FileAndLine );
+			}
+
+			if ( N >= Empty ) {
+				throw Exception( "Too many sequences for FrozenKmerIndex.", FileAndLine );
+			}
+
+			// Offset of the first kmer of each sequence in the list of all kmers.
+			vector<size_t> start( N + 1, 0 );
+
+			for ( size_t i = 0; i < N; i++ ) {
+				auto & seq = *dataset[i];
+				size_t kmerCount = seq.Sequence().size() < kmerLength ? 0 : seq.KmerCount( kmerLength );
+				start[i + 1] = start[i] + kmerCount;
+			}
+
+			const size_t total = start[N];
+			vector<Entry> entries( total );
+
+#if USE_OMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+			for ( int64_t i = 0; i < (int64_t) N; i++ ) {
+				auto residues = dataset[i]->Sequence().data();
+
+				for ( size_t pos = 0; pos < start[i + 1] - start[i]; pos++ ) {
+					uint64_t code = alphabet->Encode<uint64_t>( residues + pos, kmerLength );
+					entries[start[i] + pos] = Entry{ code, (uint32_t) i, (uint32_t) pos };
+				}
+			}
+
+			// The largest possible code, Size^k - 1, bounds the number of radix passes.
+			uint64_t maxCode = 0;
+
+			for ( size_t i = 0; i < kmerLength; i++ ) {
+				maxCode = maxCode * alphabet->Size() + ( alphabet->Size() - 1 );
+			}
+
+			RadixSort::Sort( entries, maxCode, []( const Entry & e ) { return e.code; } );
+			Group( entries );
+			BuildTable();
+		}
+
+		FrozenKmerIndex( const FrozenKmerIndex & other ) = delete;
+
+		FrozenKmerIndex & operator=( const FrozenKmerIndex & other ) = delete;
+
+		virtual ~FrozenKmerIndex() {
+			for ( size_t i = 0; i < kmers.size(); i++ ) {
+				kmerStore[i].~Kmer();
+			}
+
+			::operator delete( kmerStore );
+		}
+
+		/**
+		 *	Gets the instances of the kmer with the designated code. If the
+		 *	kmer does not occur in the dataset the range is empty.
+		 */
+		InstanceRange Find( uint64_t code ) const {
+			uint32_t kmer = slotKmer[Probe( code )];
+
+			if ( kmer == Empty ) return InstanceRange( nullptr, nullptr );
+
+			return Instances( kmer );
+		}
+
+		/**
+		 *	Gets the instances of the kmer which starts at the designated symbol.
+		 */
+		InstanceRange Find( const Symbol * chars ) const {
+			return Find( alphabet->Encode<uint64_t>( chars, kmerLength ) );
+		}
+
+		/**
+		 *	Gets the instances of kmer number i, 0 <= i < size().
+		 */
+		InstanceRange Instances( size_t i ) const {
+			const Instance * base = instances.data();
+			return InstanceRange( base + offsets[i], base + offsets[i + 1] );
+		}
+
+		/**
+		 *	Gets the code of kmer number i, 0 <= i < size().
+		 */
+		uint64_t Code( size_t i ) const {
+			return codes[i];
+		}
+
+		/** Gets the number of distinct kmers. */
+		size_t size() const {
+			return codes.size();
+		}
+
+		/** Gets the total number of kmer instances. */
+		size_t InstanceCount() const {
+			return instances.size();
+		}
+
+		size_t KmerLength() const {
+			return kmerLength;
+		}
+
+		/**
+		 *	Constructs, on first call, a Kmer object for each distinct kmer,
+		 *	with serial number equal to its kmer number, and returns the list
+		 *	by reference. The Kmer objects are owned by the index. Not safe to
+		 *	call concurrently with itself.
+		 */
+		vector<Kmer *> & GetKmers() {
+			const size_t K = codes.size();
+
+			if ( kmerStore ) return kmers;
+
+			kmerStore = static_cast<Kmer *>( ::operator new( K * sizeof( Kmer ) ) );
+			kmers.resize( K );
+
+#if USE_OMP
+#pragma omp parallel for schedule(dynamic, 1024)
+#endif
+			for ( int64_t i = 0; i < (int64_t) K; i++ ) {
+				auto range = Instances( i );
+				auto first = range.begin();
+				auto kmer = new ( kmerStore + i ) Kmer( *dataset[first->sequence], first->kmerPosition, kmerLength );
+
+				kmer->Reserve( range.size() );
+
+				for ( auto p = first + 1; p < range.end(); p++ ) {
+					kmer->Add( *dataset[p->sequence], p->kmerPosition );
+				}
+
+				kmer->SetSerialNumber( i );
+				kmers[i] = kmer;
+			}
+
+			return kmers;
+		}
+
+	private:
+		/**
+		 *	Collapses the sorted entries into the kmer list and the grouped
+		 *	instance array, releasing the entries. Group boundaries are
+		 *	counted per block, then recorded in parallel.
+		 */
+		void Group( vector<Entry> & entries ) {
+			const size_t n = entries.size();
+			const size_t blocks = RadixSort::BlockCount();
+			const size_t blockSize = ( n + blocks - 1 ) / blocks;
+			vector<size_t> firstKmer( blocks + 1, 0 );
+
+			auto isGroupStart = [&entries]( size_t i ) {
+				return i == 0 || entries[i].code != entries[i - 1].code;
+			};
+
+#if USE_OMP
+#pragma omp parallel for schedule(static, 1)
+#endif
+			for ( int64_t b = 0; b < (int64_t) blocks; b++ ) {
+				size_t end = std::min( n, ( b + 1 ) * blockSize );
+
+				for ( size_t i = b * blockSize; i < end; i++ ) {
+					if ( isGroupStart( i ) ) firstKmer[b + 1]++;
+				}
+			}
+
+			for ( size_t b = 0; b < blocks; b++ ) {
+				firstKmer[b + 1] += firstKmer[b];
+			}
+
+			const size_t K = firstKmer[blocks];
+
+			if ( K >= Empty ) {
+				throw Exception( "Too many distinct kmers for FrozenKmerIndex.", FileAndLine );
+			}
+
+			codes.resize( K );
+			offsets.resize( K + 1 );
+			offsets[K] = n;
+			instances.resize( n );
+
+#if USE_OMP
+#pragma omp parallel for schedule(static, 1)
+#endif
+			for ( int64_t b = 0; b < (int64_t) blocks; b++ ) {
+				size_t end = std::min( n, ( b + 1 ) * blockSize );
+				size_t k = firstKmer[b];
+
+				for ( size_t i = b * blockSize; i < end; i++ ) {
+					if ( isGroupStart( i ) ) {
+						codes[k] = entries[i].code;
+						offsets[k] = i;
+						k++;
+					}
+
+					instances[i] = Instance{ entries[i].sequence, entries[i].kmerPosition };
+				}
+			}
+
+			entries = vector<Entry>();
+		}
+
+		/**
+		 *	Inserts the kmers into an open-addressing table with load factor
+		 *	at most one half.
+		 */
+		void BuildTable() {
+			size_t capacity = 1024;
+
+			while ( capacity < 2 * codes.size() ) capacity *= 2;
+
+			slotCode.assign( capacity, 0 );
+			slotKmer.assign( capacity, (uint32_t) Empty );
+			mask = capacity - 1;
+
+			for ( shift = 64; ( (size_t) 1 << ( 64 - shift ) ) < capacity; shift-- ) {}
+
+			for ( size_t i = 0; i < codes.size(); i++ ) {
+				size_t slot = Probe( codes[i] );
+				slotCode[slot] = codes[i];
+				slotKmer[slot] = (uint32_t) i;
+			}
+		}
+
+		/**
+		 *	Gets the slot which holds code, or the empty slot at which
+		 *	linear probing for code terminates.
+		 */
+		size_t Probe( uint64_t code ) const {
+			// Fibonacci hashing: the high bits of the product depend on all bits of the code.
+			size_t slot = (size_t) ( ( code * 0x9E3779B97F4A7C15ULL ) >> shift );
+
+			while ( slotKmer[slot] != Empty && slotCode[slot] != code ) {
+				slot = ( slot + 1 ) & mask;
+			}
+
+			return slot;
+		}
+	};
+}
@@ -117,6 +117,14 @@ namespace QutBio {
 			}
 		}
 
+		/**
+		**	Summary:
+		**		Reserves storage for the designated number of instances.
+		*/
+		void Reserve(size_t capacity) {
+			instances.reserve(capacity);
+		}
+
 		const Substring & Substr() const {
 			return substring;
 		}
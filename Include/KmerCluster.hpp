@@ -16,6 +16,7 @@
 #include <limits>
 #include <cstdlib>
 #include <csignal>
+#include <chrono>
 
 #include "FastaSequence.hpp"
 #include "Kmer.hpp"
@@ -244,6 +245,11 @@ namespace QutBio {
 			vector<size_t> allAssigned;
 			allAssigned.reserve(numRemaining);
 
+			// Distances are integral, so this accepts exactly the kmers with dist <= threshold.
+			const Distance bound = (Distance) std::floor(threshold);
+			vector<uint> wordOrder;
+			symbolCodeDist.GetWordOrder(prototypeEncoding, K, wordOrder);
+
 #if USE_OMP
 #pragma omp parallel
 #endif
@@ -256,12 +262,12 @@ namespace QutBio {
 				for (size_t i = firstUnalloc; i < kmers.size(); i++) {
 					KmerType *kmer = kmers[i];
 					auto kmerEncoding = kmer->PackedEncoding();
-					auto dist = symbolCodeDist(kmerEncoding, prototypeEncoding, K);
+					Distance dist;
 
 					//#pragma omp critical
 					//					(cerr << "i = " << i << ", dist = " << dist << "\n").flush();
 
-					if (dist <= threshold) {
+					if (symbolCodeDist.IsWithin(prototypeEncoding, kmerEncoding, K, wordOrder.data(), bound, dist)) {
 						kmer->SetDistanceFromPrototype(dist);
 						assigned.push_back(i);
 					}
@@ -298,6 +304,9 @@ namespace QutBio {
 
 			QutBio::Kmer * protoKmer = newCluster->prototype;
 			auto prototypeEncoding = protoKmer->PackedEncoding();
+			const Distance bound = (Distance) std::floor(threshold);
+			vector<uint> wordOrder;
+			symbolCodeDist.GetWordOrder(prototypeEncoding, K, wordOrder);
 
 #if USE_OMP
 #pragma omp parallel
@@ -309,12 +318,12 @@ namespace QutBio {
 				for (size_t i = firstUnalloc; i < kmers.size(); i++) {
 					KmerType *kmer = kmers[i];
 					auto kmerEncoding = kmer->PackedEncoding();
-					auto dist = symbolCodeDist(kmerEncoding, prototypeEncoding, K);
+					Distance dist;
 
 					//#pragma omp critical
 					//					(cerr << "i = " << i << ", dist = " << dist << "\n").flush();
 
-					if (dist <= threshold) {
+					if (symbolCodeDist.IsWithin(prototypeEncoding, kmerEncoding, K, wordOrder.data(), bound, dist)) {
 #pragma omp critical
 						{
 							newCluster->Add(kmer, dist);
@@ -344,10 +353,13 @@ namespace QutBio {
 			if (firstUnalloc >= kmers.size()) return;
 
 			vector<EncodedKmer> prototypeEncoding(C);
+			vector<vector<uint>> wordOrder(C);
+			const Distance bound = (Distance) std::floor(threshold);
 
 			for (size_t c = 0; c < C; c++) {
 				auto protoKmer = newClusters[c]->prototype;
 				prototypeEncoding[c] = protoKmer->PackedEncoding();
+				symbolCodeDist.GetWordOrder(prototypeEncoding[c], K, wordOrder[c]);
 			}
 
 #if USE_OMP
@@ -363,12 +375,12 @@ namespace QutBio {
 
 					for (size_t c = 0; c < C; c++) {
 						auto protoEncoding = prototypeEncoding[c];
-						auto dist = symbolCodeDist(kmerEncoding, protoEncoding, K);
+						Distance dist;
 
 						//#pragma omp critical
 						//					(cerr << "i = " << i << ", dist = " << dist << "\n").flush();
 
-						if (dist <= threshold) {
+						if (symbolCodeDist.IsWithin(protoEncoding, kmerEncoding, K, wordOrder[c].data(), bound, dist)) {
 #if USE_OMP
 #pragma omp critical
 #endif
@@ -475,6 +487,230 @@ namespace QutBio {
 			return newClusters;
 		}
 
+		/**
+		 *	Incremental clustering which seeds many prototypes per round.
+		 *
+		 *	Each round takes the next increment unassigned kmers as candidate
+		 *	seeds and selects a conflict-free subset of them: the
+		 *	lexicographically first maximal independent set of the graph in
+		 *	which two candidates are adjacent if they lie within threshold of
+		 *	one another. The pairwise tests are done in parallel and the set
+		 *	is then read off in a single serial pass. Every unassigned kmer
+		 *	(including the rejected candidates, each of which lies within
+		 *	threshold of an earlier seed) is tested in parallel against the
+		 *	seeds and joins the first one it lies within threshold of. The
+		 *	unassigned kmers are then compacted in parallel, preserving their
+		 *	order, so each round rescans only what remains.
+		 *
+		 *	Results do not depend on the number of threads. Each seed is the
+		 *	first member of its cluster; other members are in kmer order.
+		 *
+		 *	Kmers whose self-match distance exceeds threshold cannot be cluster
+		 *	centres and are excluded, as in DoExhaustiveIncrementalClustering.
+		 *
+		 *	@returns The clusters, in the order in which they were created.
+		 */
+		static vector<Cluster *> DoParallelIncrementalClustering(
+			vector<KmerType *> & allKmers,
+			int wordLength,
+			double threshold,
+			DistanceFunction &distanceFunction,
+			UniformRealRandom &rand,
+			size_t increment,
+			function<KmerClusterPrototype *(Kmer *kmer)> createPrototype,
+			vector<function<void(KmerClusterPrototype *proto, KmerCluster * cluster)>> & process
+		) {
+			const size_t N = allKmers.size();
+			const Distance bound = (Distance)std::floor(threshold);
+			const uint32_t Unassigned = numeric_limits<uint32_t>::max();
+			const size_t BlockSize = 1 << 16;
+
+			for (size_t i = 0; i < N; i++) {
+				auto newLoc = (size_t)(rand() * N);
+				std::swap(allKmers[i], allKmers[newLoc]);
+			}
+
+			size_t firstUnalloc = 0;
+
+			for (size_t i = 0; i < N; i++) {
+				auto encoding = allKmers[i]->PackedEncoding();
+				Distance selfMatchDistance = distanceFunction(encoding, encoding, wordLength);
+
+				if (selfMatchDistance > threshold) {
+					std::swap(allKmers[i], allKmers[firstUnalloc]);
+					firstUnalloc++;
+				}
+			}
+
+			vector<Cluster *> clusters;
+			vector<uint32_t> label;
+			vector<Distance> distance;
+			vector<KmerType *> scratch;
+			size_t round = 0;
+
+			while (firstUnalloc < N) {
+				auto roundStart = chrono::steady_clock::now();
+				const size_t U = N - firstUnalloc;
+				const size_t M = std::min(increment, U);
+				KmerType ** pool = allKmers.data() + firstUnalloc;
+
+				// earlier[j] lists the earlier candidates that candidate j lies
+				// within threshold of.
+				vector<vector<uint>> earlier(M);
+				vector<vector<uint>> candidateOrder(M);
+
+				for (size_t j = 0; j < M; j++) {
+					distanceFunction.GetWordOrder(pool[j]->PackedEncoding(), wordLength, candidateOrder[j]);
+				}
+
+#if USE_OMP
+#pragma omp parallel for schedule(dynamic, 16)
+#endif
+				for (int64_t j = 1; j < (int64_t)M; j++) {
+					auto encoding = pool[j]->PackedEncoding();
+					Distance dist;
+
+					for (size_t i = 0; i < (size_t)j; i++) {
+						if (distanceFunction.IsWithin(pool[i]->PackedEncoding(), encoding, wordLength, candidateOrder[i].data(), bound, dist)) {
+							earlier[j].push_back((uint)i);
+						}
+					}
+				}
+
+				vector<bool> isSeed(M);
+				vector<KmerClusterPrototype *> newProtos;
+				vector<Cluster *> newClusters;
+				vector<EncodedKmer> protoEncoding;
+				vector<vector<uint>> wordOrder;
+
+				for (size_t j = 0; j < M; j++) {
+					bool conflict = false;
+
+					for (auto i : earlier[j]) {
+						if (isSeed[i]) {
+							conflict = true;
+							break;
+						}
+					}
+
+					if (conflict) continue;
+
+					isSeed[j] = true;
+					KmerClusterPrototype *proto = createPrototype(pool[j]);
+					Cluster *newCluster = new Cluster(proto->SingletonKmer(), 0, distanceFunction);
+					newProtos.push_back(proto);
+					newClusters.push_back(newCluster);
+					protoEncoding.push_back(newCluster->prototype->PackedEncoding());
+					wordOrder.push_back(std::move(candidateOrder[j]));
+				}
+
+				const size_t S = newClusters.size();
+
+				// Assign every unassigned kmer to the first seed within threshold.
+				label.resize(U);
+				distance.resize(U);
+
+#if USE_OMP
+#pragma omp parallel for schedule(dynamic, 256)
+#endif
+				for (int64_t i = 0; i < (int64_t)U; i++) {
+					auto encoding = pool[i]->PackedEncoding();
+					label[i] = Unassigned;
+
+					for (size_t c = 0; c < S; c++) {
+						if (distanceFunction.IsWithin(protoEncoding[c], encoding, wordLength, wordOrder[c].data(), bound, distance[i])) {
+							label[i] = (uint32_t)c;
+							break;
+						}
+					}
+				}
+
+				// Counting sort of the assigned kmers into their clusters.
+				vector<size_t> start(S + 1, 0);
+
+				for (size_t i = 0; i < U; i++) {
+					if (label[i] != Unassigned) start[label[i] + 1]++;
+				}
+
+				partial_sum(start.begin(), start.end(), start.begin());
+
+				vector<uint32_t> members(start[S]);
+				vector<size_t> next(start.begin(), start.end() - 1);
+
+				for (size_t i = 0; i < U; i++) {
+					if (label[i] != Unassigned) members[next[label[i]]++] = (uint32_t)i;
+				}
+
+#if USE_OMP
+#pragma omp parallel for schedule(dynamic, 16)
+#endif
+				for (int64_t c = 0; c < (int64_t)S; c++) {
+					Cluster *cluster = newClusters[c];
+					cluster->kmers.reserve(start[c + 1] - start[c]);
+
+					for (size_t m = start[c]; m < start[c + 1]; m++) {
+						cluster->Add(pool[members[m]], distance[members[m]]);
+					}
+				}
+
+				// Stable parallel compaction: assigned kmers move to the front of
+				// the pool, unassigned kmers follow in their original order.
+				const size_t A = start[S];
+				const size_t B = (U + BlockSize - 1) / BlockSize;
+				vector<size_t> assignedBefore(B + 1, 0);
+
+#if USE_OMP
+#pragma omp parallel for
+#endif
+				for (int64_t b = 0; b < (int64_t)B; b++) {
+					size_t count = 0;
+
+					for (size_t i = b * BlockSize; i < std::min(U, (b + 1) * BlockSize); i++) {
+						if (label[i] != Unassigned) count++;
+					}
+
+					assignedBefore[b + 1] = count;
+				}
+
+				partial_sum(assignedBefore.begin(), assignedBefore.end(), assignedBefore.begin());
+				scratch.assign(pool, pool + U);
+
+#if USE_OMP
+#pragma omp parallel for
+#endif
+				for (int64_t b = 0; b < (int64_t)B; b++) {
+					size_t a = assignedBefore[b];
+					size_t u = A + b * BlockSize - assignedBefore[b];
+
+					for (size_t i = b * BlockSize; i < std::min(U, (b + 1) * BlockSize); i++) {
+						pool[label[i] != Unassigned ? a++ : u++] = scratch[i];
+					}
+				}
+
+				firstUnalloc += A;
+
+				for (size_t c = 0; c < S; c++) {
+					for (auto proc : process) {
+						proc(newProtos[c], newClusters[c]);
+					}
+				}
+
+				clusters.insert(clusters.end(), newClusters.begin(), newClusters.end());
+
+				double elapsed = chrono::duration<double>(chrono::steady_clock::now() - roundStart).count();
+
+				(cerr << "round " << ++round
+					<< ": " << U << " unassigned kmers"
+					<< ", " << S << " seeds from " << M << " candidates"
+					<< ", " << A << " kmers assigned in " << elapsed << "s"
+					<< " (" << (size_t)(U / std::max(elapsed, 1e-9)) << " kmers/s scanned).\n").flush();
+			}
+
+			(cerr << "added " << clusters.size() << " prototypes.\n").flush();
+
+			return clusters;
+		}
+
 		static void InitialiseClusters(
 			vector<KmerClusterPrototype *> & protos,
 			size_t wordLength,
@@ -18,6 +18,7 @@
 
 #include "Assert.hpp"
 #include "Alphabet.hpp"
+#include "BinaryCodebook.hpp"
 #include "FastaSequence.hpp"
 #include "Kmer.hpp"
 #include "KmerClusterPrototype.hpp"
@@ -223,19 +224,129 @@ namespace QutBio {
 				memcpy(buffer, lastLineStart, nextReadLoc);
 			}
 
-			size_t kmerCount = GetKmerCount();
+			Finish();
+		}
 
-			if (splitClusterThreshold > 0) {
-				SplitLargeClusters();
-#if defined(PARANOID_CODEBOOK)
-				size_t splitKmerCount = GetKmerCount();
-				assert_equal(kmerCount, splitKmerCount);
-#endif
+		/**
+		 *	Loads a codebook from a binary file written by BinaryCodebook::Writer.
+		 *	The result is the same as that of parsing the equivalent text file.
+		 *	@throws Exception if the codebook parameters do not match, or if a
+		 *		prototype, sequence or kmer cannot be found.
+		 */
+		KmerCodebook(
+			//---------------------------------------
+			pAlphabet alphabet,
+			const D &distanceFunction,
+			uint charsPerWord,
+			uint kmerLength,
+			Index<EncodedFastaSequence> &dbIndex,
+			Index<KmerClusterPrototype> &protoIndex,
+			KmerIndex &kmerIndex,
+			const BinaryCodebook &savedCodebook,
+			int splitClusterThreshold = -1,
+			bool ignoreInstances = false
+			//---------------------------------------
+		) : alphabet(alphabet),
+			distanceFunction(distanceFunction),
+			charsPerWord(charsPerWord),
+			kmerLength(kmerLength),
+			splitClusterThreshold(splitClusterThreshold),
+			dbIndex(dbIndex),
+			protoIndex(protoIndex),
+			kmerIndex(kmerIndex),
+			ignoreInstances(ignoreInstances)
+			//---------------------------------------
+		{
+			if (savedCodebook.KmerLength() != kmerLength) {
+				throw Exception("Invalid kmerLength", FileAndLine);
 			}
 
-			CopyKmerDataNonRecursive((int)Alphabet::WordsRequiredToPack(kmerLength, charsPerWord));
+			if (savedCodebook.CharsPerWord() != charsPerWord) {
+				throw Exception("Invalid charsPerWord", FileAndLine);
+			}
 
-			(cerr << codebook.size() << " clusters parsed, indexing " << kmerCount << " kmers.\n").flush();
+			const size_t C = savedCodebook.Size();
+			const size_t wordsPerKmer = savedCodebook.WordsPerKmer();
+			codebook.reserve(C);
+
+			for (size_t c = 0; c < C; c++) {
+				string protoId = savedCodebook.ProtoId(c);
+				auto item{ protoIndex.find(protoId) };
+
+				if (item == protoIndex.end()) {
+					ostringstream s;
+					s << "Unable to find prototype " << protoId << " in the prototype index.";
+					throw Exception(s.str(), FileAndLine);
+				}
+
+				K *prototype = new K(*item->second, 0, kmerLength);
+
+				if (memcmp(prototype->PackedEncoding(), savedCodebook.ProtoCode(c), wordsPerKmer * sizeof(KmerWord)) != 0) {
+					ostringstream s;
+					s << "Prototype " << protoId << " does not match the encoding saved in the codebook.";
+					throw Exception(s.str(), FileAndLine);
+				}
+
+				size_t expectedSize = savedCodebook.MembersEnd(c) - savedCodebook.MembersBegin(c);
+				pCluster cluster = new Cluster(prototype, expectedSize, distanceFunction);
+				cluster->index = codebook.size();
+				codebook.push_back(cluster);
+
+				for (auto &pair : String::Split(savedCodebook.Metadata(c), ';')) {
+					auto colon = pair.find(':');
+
+					if (colon != string::npos) {
+						cluster->AddMetadata(pair.substr(0, colon), pair.substr(colon + 1));
+					}
+				}
+			}
+
+			if (!ignoreInstances) {
+				const size_t S = savedCodebook.SeqCount();
+				vector<EncodedFastaSequence *> seqs(S);
+
+				for (size_t s = 0; s < S; s++) {
+					string seqId = savedCodebook.SeqId(s);
+					auto seqItem = dbIndex.find(seqId);
+
+					if (seqItem == dbIndex.end()) {
+						throw Exception(string("sequence with Id ") + seqId + " cannot be found in database.", FileAndLine);
+					}
+
+					seqs[s] = seqItem->second;
+				}
+
+				string error;
+
+#if USE_OMP
+#pragma omp parallel for schedule(dynamic, 16)
+#endif
+				for (int64_t c = 0; c < (int64_t)C; c++) {
+					pCluster cluster = codebook[c];
+					cluster->kmers.reserve(cluster->expectedSize);
+
+					for (auto m = savedCodebook.MembersBegin(c); m < savedCodebook.MembersEnd(c); m++) {
+						Substring kmerText(seqs[m->seq]->Sequence().data(), m->position, kmerLength);
+						auto kmer = kmerIndex.find(kmerText);
+
+						if (kmer == kmerIndex.end()) {
+							ostringstream s;
+							s << "kmer " << kmerText << " not found in index!";
+#pragma omp critical
+							if (error.empty()) error = s.str();
+							break;
+						}
+
+						cluster->Add(kmer->second, m->distance);
+					}
+				}
+
+				if (!error.empty()) {
+					throw Exception(error, FileAndLine);
+				}
+			}
+
+			Finish();
 		}
 
 		virtual ~KmerCodebook() {
@@ -254,6 +365,28 @@ namespace QutBio {
 			}
 		}
 
+	private:
+		/**
+		 *	Splits large clusters if requested and copies the prototype encodings
+		 *	into kmerData, after the clusters have been loaded.
+		 */
+		void Finish() {
+			size_t kmerCount = GetKmerCount();
+
+			if (splitClusterThreshold > 0) {
+				SplitLargeClusters();
+#if defined(PARANOID_CODEBOOK)
+				size_t splitKmerCount = GetKmerCount();
+				assert_equal(kmerCount, splitKmerCount);
+#endif
+			}
+
+			CopyKmerDataNonRecursive((int)Alphabet::WordsRequiredToPack(kmerLength, charsPerWord));
+
+			(cerr << codebook.size() << " clusters parsed, indexing " << kmerCount << " kmers.\n").flush();
+		}
+
+	public:
 		void AllocateKmersToThreads(size_t numThreads) {
 			for (pCluster cluster : codebook) {
 				cluster->AllocateKmersToThreads(numThreads);
@@ -563,115 +696,96 @@ namespace QutBio {
 			}
 		}
 
+	public:
+		/**
+		 *	Assigns every kmer in the index to its nearest cluster, or to no
+		 *	cluster if threshold is non-zero and the nearest prototype is
+		 *	further away than threshold.
+		 *
+		 *	Done in two passes without locks: the nearest cluster of each
+		 *	kmer is computed in parallel, then the kmers are counting-sorted
+		 *	by cluster and each cluster's member list is filled from one
+		 *	contiguous run. Members appear in the order of the kmer index,
+		 *	as they would in a serial assignment.
+		 */
 		void AddWordsToClusters2(Distance threshold = 0) {
-			size_t n = kmerIndex.size();
-			vector<pKmer> allKmers;
+			const size_t C = codebook.size();
+			vector<K *> allKmers;
+			allKmers.reserve(kmerIndex.size());
 
 			for (auto &pair : kmerIndex) {
 				allKmers.push_back(pair.second);
 			}
 
-#if USE_OMP
-			vector<omp_lock_t> clusterLock(codebook_size);
+			const int64_t N = (int64_t)allKmers.size();
+			const uint32_t Unassigned = numeric_limits<uint32_t>::max();
+			vector<uint32_t> nearest(N);
+			vector<Distance> distance(N);
 
-#pragma omp parallel for
-			for (uint c = 0; c < codebook_size; c++) {
-				omp_init_lock(&clusterLock[c]);
-				this->codebook[c]->kmers.reserve(n / codebook_size);
-			}
-#else
-			for (uint c = 0; c < codebook_size; c++) {
-				this->codebook[c]->kmers.reserve(n / codebook_size);
-			}
+#if USE_OMP
+#pragma omp parallel for schedule(dynamic, 256)
 #endif
+			for (int64_t i = 0; i < N; i++) {
+				Distance d = numeric_limits<Distance>::max();
+				Cluster *closest = FindNearestCluster(*allKmers[i], d);
+				nearest[i] = threshold == 0 || d <= threshold ? (uint32_t)closest->index : Unassigned;
+				distance[i] = d;
+			}
 
-			auto N = (int64_t)n;
+			vector<size_t> start(C + 1, 0);
 
-#if USE_OMP
-#pragma omp parallel for schedule(dynamic, 10)
 			for (int64_t i = 0; i < N; i++) {
-				int threadId = omp_get_thread_num();
-				pKmer kmer = allKmers[i];
-				Distance distance = numeric_limits<Distance>::max();
-				Cluster *closest = FindNearestCluster(*kmer, distance);
-
-				if (threshold == 0 || distance <= threshold) {
-					omp_set_lock(&clusterLock[closest->index]);
-					closest->expectedSize++;
-					closest->Add(*kmer, distance);
-					omp_unset_lock(&clusterLock[closest->index]);
-				}
+				if (nearest[i] != Unassigned) start[nearest[i] + 1]++;
 			}
-#else
+
+			partial_sum(start.begin(), start.end(), start.begin());
+
+			vector<uint32_t> members(start[C]);
+			vector<size_t> next(start.begin(), start.end() - 1);
+
 			for (int64_t i = 0; i < N; i++) {
-				int threadId = 0;
-				pKmer kmer = allKmers[i];
-				Distance dist = numeric_limits<Distance>::max();
-				KmerCluster<D, K> *closest = FindNearestCluster(*kmer, dist);
-
-				if (threshold == 0 || dist <= threshold) {
-					// omp_set_lock(&clusterLock[closest->index]);
-					closest->expectedSize++;
-					closest->Add(*kmer, dist);
-					// omp_unset_lock(&clusterLock[closest->index]);
-				}
+				if (nearest[i] != Unassigned) members[next[nearest[i]]++] = (uint32_t)i;
 			}
-#endif
 
 #if USE_OMP
-#pragma omp parallel for
-			for (uint c = 0; c < codebook_size; c++) {
-				omp_destroy_lock(&clusterLock[c]);
-			}
+#pragma omp parallel for schedule(dynamic, 16)
 #endif
+			for (int64_t c = 0; c < (int64_t)C; c++) {
+				Cluster *cluster = codebook[c];
+				cluster->expectedSize += start[c + 1] - start[c];
+				cluster->kmers.reserve(cluster->kmers.size() + start[c + 1] - start[c]);
+
+				for (size_t m = start[c]; m < start[c + 1]; m++) {
+					cluster->Add(allKmers[members[m]], distance[members[m]]);
+				}
+			}
 		}
 
-	public:
 		vector<Cluster *> &Codebook() { return codebook; }
 
+		/**
+		 *	Finds the cluster whose prototype is nearest to a kmer. Ties go to
+		 *	the cluster with the lowest index.
+		 *	@param kmer The kmer.
+		 *	@param dist Receives the distance to the nearest prototype.
+		 *	@pre kmerData holds the prototype encodings.
+		 */
 		Cluster *FindNearestCluster(K &kmer, Distance &dist) {
-			Cluster *nearestCluster = (pCluster)codebook[0];
 			size_t nearestIdx = 0;
 			KmerWord *seqStr = kmer.PackedEncoding();
 
-			dist = distanceFunction(seqStr, kmerData.row(0), kmerLength);
+			dist = distanceFunction(seqStr, (KmerWord *)kmerData.row(0), kmerLength);
 
-			for (size_t i = 1; i < codebook_size; i++) {
-				Distance d = distanceFunction(seqStr, kmerData.row(i), kmerLength);
+			for (size_t i = 1; i < codebook.size(); i++) {
+				Distance d = distanceFunction(seqStr, (KmerWord *)kmerData.row(i), kmerLength);
 
 				if (d < dist) {
 					dist = d;
-					nearestCluster = (pCluster)codebook[i];
 					nearestIdx = i;
 				}
 			}
 
-			if (nearestIdx == 0 && dist < 100) {
-#pragma omp critical
-				{
-					cerr << "nearest distance:\t" << dist << "\n";
-					cerr << "prototype sequence:\t" << codebook[nearestIdx]->prototype.Substr() << "\n";
-					cerr << "kmer sequence:\t" << kmer.Substr() << "\n";
-
-					cerr << "prototype encoding:";
-					for (int t = 0; t < (int)Alphabet::WordsRequiredToPack(kmerLength, charsPerWord); t++) {
-						KmerWord x = kmerData.row(nearestIdx)[t];
-						cerr << "\t" << x;
-					}
-					cerr << "\n";
-
-					cerr << "kmer encoding:";
-					for (int t = 0; t < (int)Alphabet::WordsRequiredToPack(kmerLength, charsPerWord); t++) {
-						KmerWord y = seqStr[t];
-						cerr << "\t" << y;
-					}
-					cerr << "\n";
-
-					cerr.flush();
-				}
-			}
-
-			return nearestCluster;
+			return codebook[nearestIdx];
 		}
 
 		ostream &Write(ostream &out) const {
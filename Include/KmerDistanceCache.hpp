@@ -6,6 +6,7 @@
 #define __cplusplus 201703L
 #endif
 
+#include <algorithm>
 #include <string>
 #include <ctime>
 #include <cfloat>
@@ -786,7 +787,7 @@ namespace QutBio {
 		*	</summary>
 		*/
 
-		bool IsWithin( KmerWord* sKmerCode, KmerWord* tKmerCode, uint kmerLength, Distance threshold, Distance& result ) {
+		bool IsWithin( const KmerWord* sKmerCode, const KmerWord* tKmerCode, uint kmerLength, Distance threshold, Distance& result ) const {
 			uint numThrees = kmerLength / 3;
 			uint rem = kmerLength % 3;
 			Distance dist = 0;
@@ -839,9 +840,16 @@ namespace QutBio {
 		CacheType* kmerDistances2;
 		uint vocabSize2;
 
+		// Mean distance from each word to all words of the same length,
+		// used to order word positions for early abandonment.
+		vector<double> meanDistances1;
+		vector<double> meanDistances2;
+
 	public:
 		KmerDistanceCache2( Alphabet* alphabet, RawKmerDistanceFunction* dist ) : KmerDistanceCache( alphabet, dist ) {
 			PrecomputeDistances();
+			PrecomputeMeans( kmerDistances1, vocabSize1, meanDistances1 );
+			PrecomputeMeans( kmerDistances2, vocabSize2, meanDistances2 );
 		}
 
 		KmerDistanceCache2( const KmerDistanceCache2& other ) = delete;
@@ -912,7 +920,7 @@ namespace QutBio {
 		*	</summary>
 		*/
 
-		bool IsWithin( const KmerWord* sKmerCode, const KmerWord* tKmerCode, uint kmerLength, Distance threshold, Distance& result ) {
+		bool IsWithin( const KmerWord* sKmerCode, const KmerWord* tKmerCode, uint kmerLength, Distance threshold, Distance& result ) const {
 			uint numTwos = kmerLength / 2;
 			uint rem = kmerLength % 2;
 			Distance dist = 0;
@@ -939,11 +947,83 @@ namespace QutBio {
 			return true;
 		}
 
+		/**
+		*	<summary>
+		*		As IsWithin, but visits the words in the order given by wordOrder, which
+		*		should be obtained from GetWordOrder for sKmerCode. Putting the words most
+		*		likely to contribute a large distance first makes the threshold test fail
+		*		sooner for kmers which are not near s. The result is the same as IsWithin.
+		*	</summary>
+		*/
+
+		bool IsWithin( const KmerWord* sKmerCode, const KmerWord* tKmerCode, uint kmerLength, const uint* wordOrder, Distance threshold, Distance& result ) const {
+			uint words = ( kmerLength + 1 ) / 2;
+			uint lastSingle = kmerLength % 2 == 1 ? words - 1 : words;
+			Distance dist = 0;
+
+			for ( uint i = 0; i < words; i++ ) {
+				uint j = wordOrder[i];
+
+				dist += j == lastSingle
+					? kmerDistances1[sKmerCode[j] * vocabSize1 + tKmerCode[j]]
+					: kmerDistances2[sKmerCode[j] * vocabSize2 + tKmerCode[j]];
+
+				if ( dist > threshold ) {
+					return false;
+				}
+			}
+
+			result = dist;
+			return true;
+		}
+
+		/**
+		*	<summary>
+		*		Gets the word positions of a packed kmer in descending order of their
+		*		mean distance to all possible words, i.e. their expected contribution to
+		*		the distance from the kmer to a random kmer.
+		*	</summary>
+		*	<param name="sKmerCode">The packed kmer.</param>
+		*	<param name="kmerLength">The kmer length.</param>
+		*	<param name="wordOrder">Vector which will be overwritten with (kmerLength + 1) / 2 word positions.</param>
+		*/
+
+		void GetWordOrder( const KmerWord* sKmerCode, uint kmerLength, vector<uint>& wordOrder ) const {
+			uint words = ( kmerLength + 1 ) / 2;
+			uint lastSingle = kmerLength % 2 == 1 ? words - 1 : words;
+
+			auto mean = [&]( uint j ) {
+				return j == lastSingle ? meanDistances1[sKmerCode[j]] : meanDistances2[sKmerCode[j]];
+			};
+
+			wordOrder.resize( words );
+
+			for ( uint j = 0; j < words; j++ ) {
+				wordOrder[j] = j;
+			}
+
+			std::stable_sort( wordOrder.begin(), wordOrder.end(), [&]( uint x, uint y ) { return mean( x ) > mean( y ); } );
+		}
+
 	private:
 		void PrecomputeDistances() {
 			KmerDistanceCache::PrecomputeDistances( 1, kmerDistances1, vocabSize1 );
 			KmerDistanceCache::PrecomputeDistances( 2, kmerDistances2, vocabSize2 );
 		}
+
+		static void PrecomputeMeans( const CacheType* table, uint vocabSize, vector<double>& means ) {
+			means.assign( vocabSize, 0 );
+
+			for ( uint x = 0; x < vocabSize; x++ ) {
+				double sum = 0;
+
+				for ( uint y = 0; y < vocabSize; y++ ) {
+					sum += table[x * vocabSize + y];
+				}
+
+				means[x] = sum / vocabSize;
+			}
+		}
 	};
 
 	/**
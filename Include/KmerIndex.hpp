@@ -1,13 +1,23 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
 #include <unordered_map>
 #include <vector>
 
+#include "Exception.hpp"
 #include "Kmer.hpp"
+#include "RadixSort.hpp"
 #include <cstdio>
 #include <chrono>
 #include <thread>
 
+#if USE_OMP
+#include <omp.h>
+#endif
+
 using namespace std;
 
 namespace QutBio {
@@ -28,27 +38,18 @@ namespace QutBio {
 			**	Parameters:
 			**		dataset:    a list of sequences;
 			**		kmerLength: the word length for tiling;
+			**
+			**	Notes:
+			**		The index is built in parallel (see Build), with the same
+			**		contents and iteration order as if AddKmer were called for
+			**		each kmer of each sequence in turn.
 			*/
 
 		KmerIndex(
 			vector<EncodedFastaSequence *> & dataset,
 			size_t kmerLength
 		) {
-			size_t length = dataset.size();
-
-			for ( size_t i = 0; i < length; i++ ) {
-				auto & seq = *dataset[i];
-				const Symbol*residues{ seq.Sequence().data() };
-				const size_t seqLen{ seq.Sequence().size() };
-
-				if ( seqLen < kmerLength ) continue;
-
-				uint kmerCount = seq.KmerCount( kmerLength );
-
-				for ( size_t kmerPos = 0; kmerPos < kmerCount; kmerPos++ ) {
-					AddKmer( residues, kmerPos, kmerLength, seq );
-				}
-			}
+			Build( dataset, kmerLength );
 		}
 
 		KmerIndex( const KmerIndex && other ) {
@@ -150,6 +151,161 @@ namespace QutBio {
 		size_t size() {
 			return BaseType::size();
 		}
+
+	private:
+		/** A kmer occurrence, the unit sorted by Build. */
+		struct Occurrence {
+			size_t hashCode;
+			uint32_t sequence;
+			uint32_t kmerPosition;
+		};
+
+		/**
+		**	Summary:
+		**		Indexes every kmer of every sequence in parallel.
+		**
+		**		Occurrences are hashed in parallel and grouped by a stable radix
+		**		sort on the low 32 bits of the hash code; the rare runs which
+		**		hold more than one distinct kmer are split by stable partition.
+		**		The Kmer objects, with instances in dataset order, are then
+		**		constructed in parallel, and inserted into the map serially
+		**		in order of first occurrence, which is the order in which
+		**		AddKmer would insert them. The keys, instance lists and
+		**		iteration order of the map are therefore identical to those
+		**		of a serial build.
+		*/
+		void Build( vector<EncodedFastaSequence *> & dataset, size_t kmerLength ) {
+			const size_t N = dataset.size();
+
+			if ( N > numeric_limits<uint32_t>::max() ) {
+				throw Exception( "Too many sequences for KmerIndex.", FileAndLine );
+			}
+
+			// Offset of the first kmer of each sequence in the list of all kmers.
+			vector<size_t> start( N + 1, 0 );
+
+			for ( size_t i = 0; i < N; i++ ) {
+				auto & seq = *dataset[i];
+				size_t kmerCount = seq.Sequence().size() < kmerLength ? 0 : seq.KmerCount( kmerLength );
+				start[i + 1] = start[i] + kmerCount;
+			}
+
+			const size_t total = start[N];
+			vector<Occurrence> occurrences( total );
+
+#if USE_OMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+			for ( int64_t i = 0; i < (int64_t) N; i++ ) {
+				auto residues = dataset[i]->Sequence().data();
+
+				for ( size_t pos = 0; pos < start[i + 1] - start[i]; pos++ ) {
+					Substring key( residues, pos, kmerLength );
+					occurrences[start[i] + pos] = Occurrence{ key.HashCode(), (uint32_t) i, (uint32_t) pos };
+				}
+			}
+
+			auto low = []( const Occurrence & o ) { return (uint64_t) o.hashCode & 0xFFFFFFFF; };
+
+			RadixSort::Sort( occurrences, 0xFFFFFFFF, low );
+
+			auto chars = [&]( const Occurrence & o ) {
+				return dataset[o.sequence]->Sequence().data() + o.kmerPosition;
+			};
+
+			auto same = [&]( const Occurrence & x, const Occurrence & y ) {
+				return x.hashCode == y.hashCode && memcmp( chars( x ), chars( y ), kmerLength * sizeof( Symbol ) ) == 0;
+			};
+
+			vector<size_t> runStart;
+
+			for ( size_t i = 0; i < total; i++ ) {
+				if ( i == 0 || low( occurrences[i] ) != low( occurrences[i - 1] ) ) {
+					runStart.push_back( i );
+				}
+			}
+
+			runStart.push_back( total );
+
+			// Make each kmer contiguous within its run, and mark where each kmer starts.
+			vector<uint8_t> isFirst( total, 0 );
+
+#if USE_OMP
+#pragma omp parallel for schedule(dynamic, 1024)
+#endif
+			for ( int64_t r = 0; r < (int64_t) runStart.size() - 1; r++ ) {
+				auto lo = occurrences.begin() + runStart[r];
+				auto hi = occurrences.begin() + runStart[r + 1];
+
+				while ( lo < hi ) {
+					isFirst[lo - occurrences.begin()] = 1;
+
+					Occurrence first = *lo;
+					auto rest = lo + 1;
+
+					while ( rest < hi && same( *rest, first ) ) rest++;
+
+					if ( rest < hi ) {
+						rest = std::stable_partition( rest, hi, [&]( const Occurrence & o ) { return same( o, first ); } );
+					}
+
+					lo = rest;
+				}
+			}
+
+			vector<size_t> groupStart;
+
+			for ( size_t i = 0; i < total; i++ ) {
+				if ( isFirst[i] ) groupStart.push_back( i );
+			}
+
+			const size_t K = groupStart.size();
+			groupStart.push_back( total );
+
+			// Order the kmers by first occurrence.
+			struct Group {
+				uint64_t firstOccurrence;
+				size_t index;
+			};
+
+			vector<Group> order( K );
+
+#if USE_OMP
+#pragma omp parallel for schedule(static)
+#endif
+			for ( int64_t g = 0; g < (int64_t) K; g++ ) {
+				auto & o = occurrences[groupStart[g]];
+				order[g] = Group{ start[o.sequence] + o.kmerPosition, (size_t) g };
+			}
+
+			RadixSort::Sort( order, total, []( const Group & g ) { return g.firstOccurrence; } );
+
+			vector<Kmer *> created( K );
+
+#if USE_OMP
+#pragma omp parallel for schedule(dynamic, 1024)
+#endif
+			for ( int64_t j = 0; j < (int64_t) K; j++ ) {
+				size_t lo = groupStart[order[j].index];
+				size_t hi = groupStart[order[j].index + 1];
+				auto kmer = new Kmer( *dataset[occurrences[lo].sequence], occurrences[lo].kmerPosition, kmerLength );
+
+				kmer->Reserve( hi - lo );
+
+				for ( size_t i = lo + 1; i < hi; i++ ) {
+					kmer->Add( *dataset[occurrences[i].sequence], occurrences[i].kmerPosition );
+				}
+
+				created[j] = kmer;
+			}
+
+			for ( size_t j = 0; j < K; j++ ) {
+				auto & o = occurrences[groupStart[order[j].index]];
+				Substring key( chars( o ), 0, kmerLength );
+				std::pair<Substring, Kmer *> p( key, created[j] );
+				BaseType::insert( p );
+			}
+		}
 	};
 
 	/**
@@ -0,0 +1,156 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+
+#if defined(_WIN32)
+#include <fstream>
+#include <vector>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "Exception.hpp"
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	Read-only memory map of an entire file. The mapping is released when
+	 *	the object is destroyed. On Windows the file is read into memory
+	 *	instead.
+	 */
+	class MappedFile {
+		const char * data = 0;
+		size_t size = 0;
+
+#if defined(_WIN32)
+		vector<char> contents;
+#endif
+
+	public:
+		/**
+		 *	Map the named file into memory.
+		 *	@param fileName The path of the file to map.
+		 *	@throws Exception if the file cannot be opened or mapped.
+		 */
+		MappedFile( const string & fileName ) {
+#if defined(_WIN32)
+			ifstream str( fileName, ios::binary );
+
+			if ( str.fail() ) {
+				throw Exception( "Unable to open file " + fileName, FileAndLine );
+			}
+
+			contents.assign( istreambuf_iterator<char>( str ), istreambuf_iterator<char>() );
+			data = contents.data();
+			size = contents.size();
+#else
+			int fd = open( fileName.c_str(), O_RDONLY );
+
+			if ( fd < 0 ) {
+				throw Exception( "Unable to open file " + fileName, FileAndLine );
+			}
+
+			struct stat st;
+
+			if ( fstat( fd, &st ) != 0 ) {
+				close( fd );
+				throw Exception( "Unable to stat file " + fileName, FileAndLine );
+			}
+
+			size = st.st_size;
+
+			if ( size > 0 ) {
+				void * p = mmap( 0, size, PROT_READ, MAP_SHARED, fd, 0 );
+
+				if ( p == MAP_FAILED ) {
+					close( fd );
+					throw Exception( "Unable to map file " + fileName, FileAndLine );
+				}
+
+				data = (const char *) p;
+			}
+
+			close( fd );
+#endif
+		}
+
+		MappedFile( const MappedFile & other ) = delete;
+
+		MappedFile & operator=( const MappedFile & other ) = delete;
+
+		virtual ~MappedFile() {
+#if !defined(_WIN32)
+			if ( data ) {
+				munmap( (void *) data, size );
+			}
+#endif
+		}
+
+		const char * Data() const {
+			return data;
+		}
+
+		size_t Size() const {
+			return size;
+		}
+
+		/**
+		 *	Gets the address of a typed object located at a byte offset within the file.
+		 *	@throws Exception if the object would extend past the end of the file.
+		 */
+		template<typename T>
+		const T * At( size_t offset, size_t count = 1 ) const {
+			if ( offset > size || count * sizeof( T ) > size - offset ) {
+				throw Exception( "Offset out of range in mapped file.", FileAndLine );
+			}
+
+			return (const T *) (data + offset);
+		}
+
+		/**
+		 *	Returns true iff the file starts with the supplied tag.
+		 */
+		bool StartsWith( const char * tag, size_t tagLength ) const {
+			return size >= tagLength && memcmp( data, tag, tagLength ) == 0;
+		}
+
+		/**
+		 *	Gets a name, in the same directory as fileName, under which this
+		 *	process may write a replacement for fileName before renaming it
+		 *	into place. The name includes the process ID, so concurrent
+		 *	writers do not share a temporary file.
+		 */
+		static string TempFileName( const string & fileName ) {
+#if defined(_WIN32)
+			int pid = _getpid();
+#else
+			int pid = getpid();
+#endif
+			return fileName + "." + to_string( pid ) + ".tmp";
+		}
+
+		/**
+		 *	Advise the kernel that the whole mapping will be needed soon.
+		 */
+		void WillNeed() const {
+#if !defined(_WIN32)
+			if ( data ) {
+				madvise( (void *) data, size, MADV_WILLNEED );
+			}
+#endif
+		}
+	};
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	Shared output channel for parallel rankers and encoders. Worker
+	 *	threads format each result into a private buffer and Submit it; a
+	 *	dedicated writer thread drains the submitted buffers and writes them
+	 *	to the underlying stream, so that no worker ever blocks on formatting
+	 *	or I/O done by another.
+	 *
+	 *	Hand-off is a lock-free multi-producer stack: Submit pushes with a
+	 *	single compare-and-swap, and the writer detaches the whole stack at
+	 *	once. In ordered mode the writer holds back any buffer that arrives
+	 *	ahead of its turn, so that results appear in sequence-number order
+	 *	(e.g. query order) regardless of which thread produced them.
+	 *
+	 *	Usage:
+	 *		OrderedWriter writer( out );
+	 *		#pragma omp parallel
+	 *		{
+	 *			ostringstream buffer;
+	 *			#pragma omp for
+	 *			for ( q = 0; q < Q; q++ ) {
+	 *				buffer << ...;
+	 *				writer.Submit( q, buffer );
+	 *			}
+	 *		}
+	 *		writer.Close();
+	 */
+	class OrderedWriter {
+		struct Node {
+			size_t seq;
+			string text;
+			Node * next;
+		};
+
+		ostream & out;
+		bool ordered;
+		atomic<Node *> head;
+		atomic<bool> closing;
+		thread writer;
+
+	public:
+		/**
+		 *	Starts a writer thread which drains submitted text to out.
+		 *	@param out The destination stream. It must outlive this object.
+		 *	@param ordered If true, text is written in ascending order of
+		 *		sequence number, starting at 0. Otherwise text is written in
+		 *		order of arrival.
+		 */
+		OrderedWriter( ostream & out, bool ordered = true ) :
+			out( out ), ordered( ordered ), head( nullptr ), closing( false ) {
+			writer = thread( [this]() { Drain(); } );
+		}
+
+		OrderedWriter( const OrderedWriter & other ) = delete;
+
+		OrderedWriter & operator=( const OrderedWriter & other ) = delete;
+
+		virtual ~OrderedWriter() {
+			Close();
+		}
+
+		/**
+		 *	Hands a formatted result to the writer thread. Safe to call
+		 *	concurrently from any number of threads.
+		 *	@param seq The position of this result in the output. In ordered
+		 *		mode each value in 0, 1, 2, ... must be submitted exactly once;
+		 *		output stalls at the first missing value until Close is called.
+		 *	@param text The formatted result.
+		 */
+		void Submit( size_t seq, string && text ) {
+			Node * node = new Node{ seq, std::move( text ), head.load( memory_order_relaxed ) };
+
+			while ( !head.compare_exchange_weak( node->next, node, memory_order_release, memory_order_relaxed ) ) {}
+		}
+
+		/**
+		 *	Hands the contents of a thread-local buffer to the writer thread,
+		 *	and empties the buffer ready for the next result.
+		 */
+		void Submit( size_t seq, ostringstream & buffer ) {
+			Submit( seq, buffer.str() );
+			buffer.str( "" );
+		}
+
+		/**
+		 *	Writes all outstanding results, then stops the writer thread. Any
+		 *	results held back waiting for a missing sequence number are
+		 *	written in order. Must not be called concurrently with Submit.
+		 */
+		void Close() {
+			if ( writer.joinable() ) {
+				closing.store( true, memory_order_release );
+				writer.join();
+			}
+		}
+
+	private:
+		void Drain() {
+			map<size_t, string> pending;
+			size_t next = 0;
+			size_t idle = 0;
+
+			for ( ;;) {
+				Node * list = head.exchange( nullptr, memory_order_acquire );
+
+				if ( !list ) {
+					if ( closing.load( memory_order_acquire ) ) {
+						list = head.exchange( nullptr, memory_order_acquire );
+
+						if ( !list ) break;
+					}
+					else {
+						if ( ++idle < 64 ) {
+							this_thread::yield();
+						}
+						else {
+							this_thread::sleep_for( chrono::microseconds( 100 ) );
+						}
+
+						continue;
+					}
+				}
+
+				idle = 0;
+
+				// The stack yields newest first; reverse it to arrival order.
+				Node * reversed = nullptr;
+
+				while ( list ) {
+					Node * n = list->next;
+					list->next = reversed;
+					reversed = list;
+					list = n;
+				}
+
+				for ( Node * node = reversed; node; ) {
+					if ( !ordered ) {
+						out << node->text;
+					}
+					else if ( node->seq == next ) {
+						out << node->text;
+						next++;
+
+						for ( auto p = pending.begin(); p != pending.end() && p->first == next; p = pending.erase( p ) ) {
+							out << p->second;
+							next++;
+						}
+					}
+					else {
+						pending.emplace( node->seq, std::move( node->text ) );
+					}
+
+					Node * n = node->next;
+					delete node;
+					node = n;
+				}
+			}
+
+			for ( auto & p : pending ) {
+				out << p.second;
+			}
+
+			out.flush();
+		}
+	};
+}
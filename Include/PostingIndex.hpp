@@ -0,0 +1,654 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include "Exception.hpp"
+#include "Types.hpp"
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	Inverted index over sparse binary signatures. Each posting list is
+	 *	split into blocks of up to BlockSize document numbers. A block stores
+	 *	its first document number explicitly, and the remaining gaps
+	 *	(minus one) bit-packed at the smallest width that fits the largest
+	 *	gap in the block.
+	 *
+	 *	The cardinality of every document is retained, so Jaccard similarity
+	 *	can be computed from overlap counts accumulated while scanning
+	 *	posting lists, without touching the document signatures.
+	 *
+	 *	Optionally, documents may be renumbered internally in ascending order
+	 *	of cardinality (impact order: for a fixed overlap, a smaller document
+	 *	has the higher Jaccard similarity), so that every posting list is
+	 *	sorted by impact while remaining delta-codable, and the prefix of a
+	 *	capped list holds its highest-impact documents. Features present in
+	 *	more than a given fraction of documents may also be stop-listed.
+	 *	Posting lists always hold internal document numbers; use DocId to
+	 *	recover the caller's numbering.
+	 */
+	class PostingIndex {
+	public:
+		static const uint BlockSize = 128;
+
+		struct Block {
+			uint32_t first;
+			uint32_t offset;
+			uint8_t width;
+			uint8_t count;
+		};
+
+	private:
+		vector<uint64_t> listStart;
+		vector<uint32_t> listLength;
+		vector<Block> blocks;
+		vector<uint32_t> bits;
+		vector<uint32_t> cardinality;
+		vector<uint32_t> docIds;
+		size_t stopped = 0;
+
+	public:
+		PostingIndex() {}
+
+		/**
+		 *	Build the index.
+		 *	@param D The number of documents.
+		 *	@param F The number of features.
+		 *	@param getFeatures Function which, given document number d in 0..D-1,
+		 *		fills a vector<uint> with the ascending feature numbers of d.
+		 *	@param impactOrder If true, renumber documents in ascending order of
+		 *		cardinality.
+		 *	@param stopFraction Features which occur in more than stopFraction * D
+		 *		documents are stop-listed (given an empty posting list). Their
+		 *		occurrences still count toward document cardinality.
+		 */
+		template<typename GetFeatures>
+		void Build( size_t D, size_t F, GetFeatures getFeatures, bool impactOrder = false, double stopFraction = 1.0 ) {
+			vector<vector<uint>> postings( F );
+			vector<uint> features;
+			vector<uint32_t> internal;
+
+			cardinality.resize( D );
+			docIds.clear();
+
+			if ( impactOrder ) {
+				for ( size_t d = 0; d < D; d++ ) {
+					getFeatures( d, features );
+					cardinality[d] = features.size();
+				}
+
+				OrderByImpact( internal );
+			}
+
+			for ( size_t d = 0; d < D; d++ ) {
+				getFeatures( d, features );
+				uint32_t i = impactOrder ? internal[d] : d;
+				cardinality[i] = features.size();
+
+				for ( auto f : features ) {
+					if ( f >= F ) {
+						throw Exception( "Feature number out of range.", FileAndLine );
+					}
+
+					postings[f].push_back( i );
+				}
+			}
+
+			Reset( F );
+
+			for ( size_t f = 0; f < F; f++ ) {
+				if ( postings[f].size() > stopFraction * D ) {
+					vector<uint>().swap( postings[f] );
+					stopped++;
+				}
+
+				if ( impactOrder ) {
+					std::sort( postings[f].begin(), postings[f].end() );
+				}
+
+				listStart[f] = blocks.size();
+				listLength[f] = postings[f].size();
+				Append( postings[f] );
+				vector<uint>().swap( postings[f] );
+			}
+
+			Finish( F );
+		}
+
+		/**
+		 *	Build the index from existing per-feature posting lists, such as
+		 *	those held by a SignatureDatabase, so that document signatures need
+		 *	not be decoded. Lists are fetched and compressed one at a time. The
+		 *	result is identical to that of Build over the same documents.
+		 *	@param D The number of documents.
+		 *	@param F The number of features.
+		 *	@param getCardinality Function which returns the number of features
+		 *		of document d in 0..D-1.
+		 *	@param getPostings Function which, given feature number f in 0..F-1,
+		 *		fills a vector<uint> with the ascending document numbers which
+		 *		contain f.
+		 *	@param impactOrder If true, renumber documents in ascending order of
+		 *		cardinality.
+		 *	@param stopFraction Features which occur in more than stopFraction * D
+		 *		documents are stop-listed.
+		 */
+		template<typename GetCardinality, typename GetPostings>
+		void BuildFromPostings( size_t D, size_t F, GetCardinality getCardinality, GetPostings getPostings, bool impactOrder = false, double stopFraction = 1.0 ) {
+			vector<uint> docs;
+			vector<uint32_t> internal;
+
+			cardinality.resize( D );
+			docIds.clear();
+
+			for ( size_t d = 0; d < D; d++ ) {
+				cardinality[d] = getCardinality( d );
+			}
+
+			if ( impactOrder ) {
+				OrderByImpact( internal );
+
+				for ( size_t i = 0; i < D; i++ ) {
+					cardinality[i] = getCardinality( docIds[i] );
+				}
+			}
+
+			Reset( F );
+
+			for ( size_t f = 0; f < F; f++ ) {
+				getPostings( f, docs );
+
+				if ( docs.size() > stopFraction * D ) {
+					docs.clear();
+					stopped++;
+				}
+
+				for ( auto & d : docs ) {
+					if ( d >= D ) {
+						throw Exception( "Document number out of range.", FileAndLine );
+					}
+
+					if ( impactOrder ) d = internal[d];
+				}
+
+				if ( impactOrder ) {
+					std::sort( docs.begin(), docs.end() );
+				}
+
+				listStart[f] = blocks.size();
+				listLength[f] = docs.size();
+				Append( docs );
+			}
+
+			Finish( F );
+		}
+
+		size_t DocCount() const {
+			return cardinality.size();
+		}
+
+		size_t FeatureCount() const {
+			return listLength.size();
+		}
+
+		/** Gets the cardinality of internal document d. */
+		uint Cardinality( size_t d ) const {
+			return cardinality[d];
+		}
+
+		/** Maps an internal document number to the number supplied to Build. */
+		uint DocId( uint d ) const {
+			return docIds.empty() ? d : docIds[d];
+		}
+
+		/** Gets the number of stop-listed features. */
+		size_t StoppedCount() const {
+			return stopped;
+		}
+
+		uint PostingLength( uint feature ) const {
+			return feature < listLength.size() ? listLength[feature] : 0;
+		}
+
+		/**
+		 *	Gets the approximate memory footprint of the index, in bytes.
+		 */
+		size_t Bytes() const {
+			return listStart.size() * sizeof( uint64_t )
+				+ listLength.size() * sizeof( uint32_t )
+				+ blocks.size() * sizeof( Block )
+				+ bits.size() * sizeof( uint32_t )
+				+ cardinality.size() * sizeof( uint32_t )
+				+ docIds.size() * sizeof( uint32_t );
+		}
+
+		/**
+		 *	Invoke action(d) for each document d in the posting list of a
+		 *	feature, in ascending order.
+		 */
+		template<typename Action>
+		void Foreach( uint feature, Action action ) const {
+			if ( feature >= listLength.size() ) return;
+
+			uint32_t buffer[BlockSize];
+
+			for ( auto b = listStart[feature]; b < listStart[feature + 1]; b++ ) {
+				uint n = Unpack( blocks[b], buffer );
+
+				for ( uint i = 0; i < n; i++ ) {
+					action( buffer[i] );
+				}
+			}
+		}
+
+		/**
+		 *	Decode the posting list of a feature.
+		 */
+		void GetPostings( uint feature, vector<uint> & docs ) const {
+			docs.clear();
+			docs.reserve( PostingLength( feature ) );
+			Foreach( feature, [&docs]( uint d ) { docs.push_back( d ); } );
+		}
+
+		/**
+		 *	Decode a block into buffer, which must have room for BlockSize
+		 *	elements. Gaps are extracted in a loop with no dependencies
+		 *	between iterations (so the compiler can vectorise it) and then
+		 *	prefix-summed.
+		 *	@returns The number of documents in the block.
+		 */
+		uint Unpack( const Block & block, uint32_t * buffer ) const {
+			const uint n = block.count;
+			const uint width = block.width;
+			const uint32_t * w = bits.data() + block.offset;
+			const uint64_t mask = (uint64_t( 1 ) << width) - 1;
+
+			buffer[0] = block.first;
+
+			for ( uint i = 1; i < n; i++ ) {
+				uint pos = (i - 1) * width;
+				uint word = pos >> 5;
+				uint64_t v = (w[word] | (uint64_t( w[word + 1] ) << 32)) >> (pos & 31);
+				buffer[i] = uint32_t( v & mask ) + 1;
+			}
+
+			for ( uint i = 1; i < n; i++ ) {
+				buffer[i] += buffer[i - 1];
+			}
+
+			return n;
+		}
+
+		/**
+		 *	Forward-only iterator over one posting list. Blocks are decoded
+		 *	on demand; SkipTo passes over whole blocks using their first
+		 *	document number, without unpacking them.
+		 */
+		class Cursor {
+			const PostingIndex * index;
+			uint64_t block, lastBlock;
+			uint pos, count;
+			uint32_t buffer[BlockSize];
+
+		public:
+			static const uint End = numeric_limits<uint>::max();
+
+			Cursor( const PostingIndex & index, uint feature ) : index( &index ), pos( 0 ), count( 0 ) {
+				if ( feature < index.listLength.size() ) {
+					block = index.listStart[feature];
+					lastBlock = index.listStart[feature + 1];
+				}
+				else {
+					block = lastBlock = 0;
+				}
+
+				if ( block < lastBlock ) {
+					count = index.Unpack( index.blocks[block], buffer );
+				}
+			}
+
+			/** Gets the current document, or End if the list is exhausted. */
+			uint Doc() const {
+				return pos < count ? buffer[pos] : End;
+			}
+
+			void Next() {
+				if ( ++pos >= count ) {
+					pos = count = 0;
+
+					if ( ++block < lastBlock ) {
+						count = index->Unpack( index->blocks[block], buffer );
+					}
+				}
+			}
+
+			/** Advance to the first document greater than or equal to target. */
+			void SkipTo( uint target ) {
+				if ( Doc() >= target ) return;
+
+				if ( block + 1 < lastBlock && index->blocks[block + 1].first <= target ) {
+					do {
+						block++;
+					} while ( block + 1 < lastBlock && index->blocks[block + 1].first <= target );
+
+					count = index->Unpack( index->blocks[block], buffer );
+					pos = 0;
+				}
+
+				pos = std::lower_bound( buffer + pos, buffer + count, target ) - buffer;
+
+				if ( pos >= count ) {
+					Next();
+				}
+			}
+		};
+
+	private:
+		/**
+		 *	Sets docIds to the document numbers in ascending order of the
+		 *	cardinalities currently held, and internal to its inverse. The
+		 *	cardinalities are then cleared, to be refilled in internal order.
+		 */
+		void OrderByImpact( vector<uint32_t> & internal ) {
+			const size_t D = cardinality.size();
+
+			docIds.resize( D );
+
+			for ( size_t d = 0; d < D; d++ ) docIds[d] = d;
+
+			std::stable_sort( docIds.begin(), docIds.end(), [this]( uint32_t a, uint32_t b ) {
+				return cardinality[a] < cardinality[b];
+			} );
+
+			internal.resize( D );
+
+			for ( size_t i = 0; i < D; i++ ) {
+				internal[docIds[i]] = i;
+				cardinality[i] = 0;
+			}
+		}
+
+		/** Clears the posting lists in preparation for appending F lists. */
+		void Reset( size_t F ) {
+			listStart.resize( F + 1 );
+			listLength.resize( F );
+			blocks.clear();
+			bits.clear();
+			stopped = 0;
+		}
+
+		/** Closes the list of blocks after F lists have been appended. */
+		void Finish( size_t F ) {
+			listStart[F] = blocks.size();
+
+			// Padding so that Unpack can always read one word past the last.
+			bits.push_back( 0 );
+			bits.push_back( 0 );
+		}
+
+		void Append( const vector<uint> & docs ) {
+			const size_t N = docs.size();
+
+			for ( size_t start = 0; start < N; start += BlockSize ) {
+				size_t end = std::min( N, start + BlockSize );
+
+				uint32_t maxGap = 0;
+
+				for ( size_t i = start + 1; i < end; i++ ) {
+					uint32_t gap = docs[i] - docs[i - 1] - 1;
+					if ( gap > maxGap ) maxGap = gap;
+				}
+
+				uint width = 0;
+
+				while ( width < 32 && (maxGap >> width) != 0 ) width++;
+
+				Block block;
+				block.first = docs[start];
+				block.offset = bits.size();
+				block.width = width;
+				block.count = end - start;
+				blocks.push_back( block );
+
+				uint64_t acc = 0;
+				uint accBits = 0;
+
+				for ( size_t i = start + 1; i < end; i++ ) {
+					acc |= uint64_t( docs[i] - docs[i - 1] - 1 ) << accBits;
+					accBits += width;
+
+					if ( accBits >= 32 ) {
+						bits.push_back( uint32_t( acc ) );
+						acc >>= 32;
+						accBits -= 32;
+					}
+				}
+
+				if ( accBits > 0 ) {
+					bits.push_back( uint32_t( acc ) );
+				}
+			}
+		}
+	};
+
+	/**
+	 *	Per-thread score-at-a-time accumulator over a PostingIndex. Overlap
+	 *	counts are gathered for every document which shares a feature with
+	 *	the query, after which the Jaccard similarity of each such document
+	 *	follows directly from the counts and the cardinalities.
+	 *
+	 *	For approximate ranking, query lists are processed rarest first, and
+	 *	long lists may be capped (only the first maxPostings entries are
+	 *	scanned - with an impact-ordered index these are the highest-impact
+	 *	documents) or deferred (lists longer than deferPostings nominate no
+	 *	new candidates, and are only probed for documents already seen).
+	 *	A value of 0 disables either limit.
+	 */
+	class JaccardAccumulator {
+		const PostingIndex & index;
+		vector<uint32_t> counts;
+		vector<uint> touched;
+		vector<uint> features;
+
+	public:
+		size_t maxPostings = 0;
+		size_t deferPostings = 0;
+
+		JaccardAccumulator( const PostingIndex & index ) : index( index ), counts( index.DocCount() ) {}
+
+		/**
+		 *	Score all documents which share at least one feature with the query.
+		 *	@param query Ascending list of query features.
+		 *	@param visit Function called as visit(d, similarity) for each candidate d,
+		 *		where d is the document number supplied to PostingIndex::Build.
+		 */
+		template<typename Collection, typename Visit>
+		void Score( const Collection & query, Visit visit ) {
+			size_t querySize = 0;
+			features.clear();
+
+			for ( uint f : query ) {
+				querySize++;
+				if ( index.PostingLength( f ) > 0 ) features.push_back( f );
+			}
+
+			if ( maxPostings > 0 || deferPostings > 0 ) {
+				std::sort( features.begin(), features.end(), [this]( uint a, uint b ) {
+					return index.PostingLength( a ) < index.PostingLength( b );
+				} );
+			}
+
+			size_t deferred = features.size();
+
+			for ( size_t i = 0; i < features.size(); i++ ) {
+				uint f = features[i];
+
+				if ( deferPostings > 0 && index.PostingLength( f ) > deferPostings ) {
+					deferred = i;
+					break;
+				}
+
+				if ( maxPostings > 0 && index.PostingLength( f ) > maxPostings ) {
+					PostingIndex::Cursor cursor( index, f );
+
+					for ( size_t j = 0; j < maxPostings; j++, cursor.Next() ) {
+						uint d = cursor.Doc();
+						if ( counts[d]++ == 0 ) touched.push_back( d );
+					}
+				}
+				else {
+					index.Foreach( f, [this]( uint d ) {
+						if ( counts[d]++ == 0 ) touched.push_back( d );
+					} );
+				}
+			}
+
+			if ( deferred < features.size() ) {
+				std::sort( touched.begin(), touched.end() );
+
+				for ( size_t i = deferred; i < features.size(); i++ ) {
+					PostingIndex::Cursor cursor( index, features[i] );
+
+					for ( uint d : touched ) {
+						cursor.SkipTo( d );
+
+						if ( cursor.Doc() == PostingIndex::Cursor::End ) break;
+
+						if ( cursor.Doc() == d ) counts[d]++;
+					}
+				}
+			}
+
+			for ( uint d : touched ) {
+				uint32_t intersect = counts[d];
+				counts[d] = 0;
+				double union_ = querySize + index.Cardinality( d ) - intersect;
+				visit( index.DocId( d ), intersect / union_ );
+			}
+
+			touched.clear();
+		}
+	};
+
+	/**
+	 *	Document-at-a-time top-k Jaccard ranking with MaxScore pruning.
+	 *
+	 *	Every query feature contributes at most 1 to the overlap I between the
+	 *	query and a document d, and J(q,d) = I / (|q| + |d| - I) <= I / |q|.
+	 *	Query lists are ordered from shortest to longest; once the top-k
+	 *	threshold is such that m / |q| cannot enter the result list, the m
+	 *	longest lists become non-essential: they are no longer used to
+	 *	nominate candidates, only probed (with block skipping) for candidates
+	 *	nominated by the shorter lists, and probing stops as soon as the
+	 *	bound computed from |d| shows the candidate cannot qualify.
+	 */
+	class JaccardMaxScore {
+		const PostingIndex & index;
+		vector<uint> features;
+		vector<PostingIndex::Cursor> cursors;
+
+	public:
+		/// Number of candidates nominated, and number fully scored, since construction.
+		size_t nominated = 0, scored = 0;
+
+		JaccardMaxScore( const PostingIndex & index ) : index( index ) {}
+
+		/**
+		 *	Rank the documents which share a feature with the query.
+		 *	@param query Ascending list of query features.
+		 *	@param rankings A KnnVector of (document, 1 - similarity) records,
+		 *		which should be cleared beforehand.
+		 */
+		template<typename Collection, typename Knn>
+		void Rank( const Collection & query, Knn & rankings ) {
+			double Q = 0;
+			features.clear();
+
+			for ( uint f : query ) {
+				Q++;
+				if ( index.PostingLength( f ) > 0 ) features.push_back( f );
+			}
+
+			std::sort( features.begin(), features.end(), [this]( uint a, uint b ) {
+				return index.PostingLength( a ) < index.PostingLength( b );
+			} );
+
+			cursors.clear();
+			cursors.reserve( features.size() );
+
+			for ( uint f : features ) {
+				cursors.emplace_back( index, f );
+			}
+
+			const size_t n = cursors.size();
+			size_t essential = n;
+
+			auto cannotEnter = [&rankings]( double bound ) {
+				return !rankings.canPush( 1.0 - bound );
+			};
+
+			while ( essential > 0 ) {
+				uint d = PostingIndex::Cursor::End;
+
+				for ( size_t i = 0; i < essential; i++ ) {
+					d = std::min( d, cursors[i].Doc() );
+				}
+
+				if ( d == PostingIndex::Cursor::End ) break;
+
+				nominated++;
+
+				uint I = 0;
+
+				for ( size_t i = 0; i < essential; i++ ) {
+					if ( cursors[i].Doc() == d ) {
+						I++;
+						cursors[i].Next();
+					}
+				}
+
+				const double card = index.Cardinality( d );
+				uint remaining = n - essential;
+				bool pruned = false;
+
+				for ( size_t i = essential; i < n; i++ ) {
+					if ( cannotEnter( (I + remaining) / (Q + card - (I + remaining)) ) ) {
+						pruned = true;
+						break;
+					}
+
+					cursors[i].SkipTo( d );
+
+					if ( cursors[i].Doc() == d ) {
+						I++;
+						cursors[i].Next();
+					}
+
+					remaining--;
+				}
+
+				if ( pruned ) continue;
+
+				scored++;
+
+				double distance = 1.0 - I / (Q + card - I);
+
+				if ( rankings.canPush( distance ) ) {
+					rankings.push( index.DocId( d ), distance );
+
+					while ( essential > 0 && cannotEnter( (n - essential + 1) / Q ) ) {
+						essential--;
+					}
+				}
+			}
+		}
+	};
+}
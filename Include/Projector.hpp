@@ -12,7 +12,7 @@
 #include "FreeList.hpp"
 #include "Util.hpp"
 #include "SequenceDistanceFunction.hpp"
-#include "DiagonalGenerator.hpp"
+#include "DiagonalKernel.hpp"
 
 #include <string>
 #include <ctime>
@@ -75,25 +75,6 @@ namespace QutBio {
 		/// </summary>
 		///	<param name="queryBytes"></param>
 
-	protected:
-		typedef struct {
-			Distance * rowMinima;
-			Distance * colMinima;
-		} DataPacket;
-
-		static void ProcessDistance(
-			void * processingObject,
-			size_t queryPos,
-			size_t subjectPos,
-			Distance distance
-		) {
-			DataPacket * data = (DataPacket *)processingObject;
-			Distance * rowMinima = data->rowMinima;
-			Distance * colMinima = data->colMinima;
-			if (distance < rowMinima[queryPos]) rowMinima[queryPos] = distance;
-			if (distance < colMinima[subjectPos]) colMinima[subjectPos] = distance;
-		}
-
 	public: virtual void ComputeDistanceMatrix(
 		// EncodedFastaSequence &querySeq,
 		// EncodedFastaSequence &subjectSeq,
@@ -104,23 +85,18 @@ namespace QutBio {
 		size_t queryKmerCount,
 		size_t subjectKmerCount
 	) {
-		DataPacket data{ rowMinima.data(), colMinima.data() };
-
 		Util::Fill(rowMinima, numeric_limits<Distance>::max());
 		Util::Fill(colMinima, numeric_limits<Distance>::max());
 
-		DiagonalGenerator generator;
-
-		generator.GenerateDistances(
-			// &querySeq, &subjectSeq, 
+		DiagonalKernel::RowColMinima(
 			queryChars,
 			subjectChars,
 			kmerLength,
 			queryKmerCount,
 			subjectKmerCount,
-			distanceLookup,
-			&data,
-			ProcessDistance
+			[this](Symbol q, Symbol s) { return distanceLookup[s.value][q.value]; },
+			rowMinima.data(),
+			colMinima.data()
 		);
 	}
 
@@ -13,6 +13,7 @@
 #include "Util.hpp"
 #include "SequenceDistanceFunction.hpp"
 #include "CharMap.hpp"
+#include "DiagonalKernel.hpp"
 
 #include <string>
 #include <ctime>
@@ -102,46 +103,11 @@ namespace QutBio {
 			memset(rowMinima, 127, m * sizeof(rowMinima[0]));
 			memset(colMinima, 127, n * sizeof(colMinima[0]));
 
-			for ( size_t r = 0; r < m; r++ ) {
-				const int c_upper = r == 0 ? (int) n : 1;
-
-				//	Do the top-right part of the rectangle
-				for ( int c = 0; c < c_upper; c++ ) {
-					Distance buffer[1000];
-					const uint64_t * a = subjectChars + c;
-					const uint64_t * b = queryChars + r;
-					Distance distance = 0;
-
-					size_t diagLength = std::min(m - r, n - c);
-
-					// Prime the circular buffer with the first kmer in the query
-					for ( size_t t = 0; t < kmerLength; t++, a++, b++ ) {
-						Distance currentTerm = (Distance) POPCOUNT((*a) ^ (*b)) >> 1;
-						distance += currentTerm;
-						buffer[t] = currentTerm;
-					}
-
-					if ( distance < rowMinima[r] ) rowMinima[r] = distance;
-					if ( distance < colMinima[c] ) colMinima[c] = distance;
-
-					for ( size_t offset = 1, buffptr = 0;
-						offset < diagLength;
-						a++, b++, offset++, buffptr++
-						) {
-						if ( buffptr >= kmerLength ) {
-							buffptr = 0;
-						}
-
-						distance -= buffer[buffptr];
-						Distance currentTerm = (Distance) POPCOUNT((*a) ^ (*b)) >> 1;
-						buffer[buffptr] = currentTerm;
-						distance += currentTerm;
-
-						if ( distance < rowMinima[r + offset] ) rowMinima[r + offset] = distance;
-						if ( distance < colMinima[c + offset] ) colMinima[c + offset] = distance;
-					}
-				}
-			}
+			DiagonalKernel::RowColMinima(
+				queryChars, subjectChars, kmerLength, m, n,
+				[]( uint64_t a, uint64_t b ) { return (Distance) POPCOUNT( a ^ b ) >> 1; },
+				rowMinima, colMinima
+			);
 		}
 
 	};
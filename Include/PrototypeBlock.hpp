@@ -0,0 +1,217 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "Alphabet.hpp"
+#include "DistanceType.hpp"
+#include "EncodedKmer.hpp"
+#include "Exception.hpp"
+#include "KmerClusterPrototype.hpp"
+#include "KmerDistanceCache.hpp"
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	Cache-blocked brute force comparison of the kmers of a sequence with
+	 *	every prototype in a list.
+	 *
+	 *	The packed prototype encodings are copied into one contiguous array
+	 *	per word position (structure of arrays), so that word j of a tile of
+	 *	prototypes is a single run of 16-bit codes. The word distance table
+	 *	is copied with the query word as the major index, so that the
+	 *	distances from one kmer word to all prototype words are a single row
+	 *	of at most |Σ|² entries which stays in L1 while a tile is processed.
+	 *
+	 *	Kmers are processed in tiles of KmerTile against tiles of ProtoTile
+	 *	prototypes, accumulating one word position at a time over the whole
+	 *	prototype tile. A kmer abandons a prototype tile as soon as every
+	 *	partial sum in it exceeds the bound, which is exact because each word
+	 *	contributes a non-negative distance. Results are identical to calling
+	 *	KmerDistanceCache2 for every (prototype, kmer) pair.
+	 *
+	 *	Words are those of KmerDistanceCache2: two symbols per word, with a
+	 *	final single-symbol word if the kmer length is odd.
+	 */
+	class PrototypeBlock {
+		uint kmerLength;
+		uint words;
+		uint vocabSize1;
+		uint vocabSize2;
+		size_t protoCount;
+
+		// codes[j * protoCount + c] is word j of prototype c.
+		vector<uint16_t> codes;
+
+		// table2[y * |Σ|² + x] is the distance between prototype word x and
+		// kmer word y; table1 is the same for the final single-symbol word
+		// of an odd kmer length.
+		vector<Distance> table2;
+		vector<Distance> table1;
+
+	public:
+		/** The number of kmers processed together against each prototype tile. */
+		static const uint KmerTile = 32;
+
+		/** The number of prototypes in a tile. */
+		static const uint ProtoTile = 128;
+
+		/**
+		 *	Lays out the prototype encodings and distance tables.
+		 *	@param protos The prototypes, each of which is a single kmer.
+		 *	@param distance The distance function used by the encoder.
+		 *	@param alphabet The alphabet used to pack the encodings.
+		 *	@param kmerLength The kmer length.
+		 */
+		PrototypeBlock(
+			vector<KmerClusterPrototype *> & protos,
+			const KmerDistanceCache2 & distance,
+			const Alphabet * alphabet,
+			uint kmerLength
+		) :
+			kmerLength( kmerLength ),
+			words( (kmerLength + 1) / 2 ),
+			vocabSize1( alphabet->Size() ),
+			vocabSize2( alphabet->Size() * alphabet->Size() ),
+			protoCount( protos.size() ) {
+			if ( words > MaxWords ) {
+				throw Exception( "Kmer length is too large for PrototypeBlock.", FileAndLine );
+			}
+
+			if ( vocabSize2 > numeric_limits<uint16_t>::max() + 1u ) {
+				throw Exception( "Alphabet is too large for PrototypeBlock.", FileAndLine );
+			}
+
+			codes.resize( (size_t) words * protoCount );
+
+			for ( size_t c = 0; c < protoCount; c++ ) {
+				EncodedKmer code = protos[c]->PackedEncoding();
+
+				for ( uint j = 0; j < words; j++ ) {
+					codes[j * protoCount + c] = (uint16_t) code[j];
+				}
+			}
+
+			table2.resize( (size_t) vocabSize2 * vocabSize2 );
+
+			for ( uint y = 0; y < vocabSize2; y++ ) {
+				for ( uint x = 0; x < vocabSize2; x++ ) {
+					table2[(size_t) y * vocabSize2 + x] = distance.GetDistance2( x, y );
+				}
+			}
+
+			if ( kmerLength % 2 == 1 ) {
+				table1.resize( (size_t) vocabSize1 * vocabSize1 );
+
+				for ( uint y = 0; y < vocabSize1; y++ ) {
+					for ( uint x = 0; x < vocabSize1; x++ ) {
+						table1[(size_t) y * vocabSize1 + x] = distance.GetDistance1( x, y );
+					}
+				}
+			}
+		}
+
+		/**
+		 *	Visits the prototypes which lie within a distance bound of each of
+		 *	a list of kmers, each with its exact distance. The visitor returns
+		 *	the bound for the remainder of the search for that kmer, which
+		 *	allows a nearest-neighbour search to tighten it. For each kmer,
+		 *	prototypes are visited in ascending order of index, and every
+		 *	prototype at distance <= the bound in force when it is reached is
+		 *	visited.
+		 *	@param kmers The packed encodings of the kmers.
+		 *	@param kmerCount The number of kmers.
+		 *	@param bound The initial distance bound for every kmer.
+		 *	@param visit Function (uint kmerIndex, uint protoIndex, Distance distance) -> Distance newBound.
+		 */
+		template<typename Visitor>
+		void Scan( const EncodedKmer * kmers, size_t kmerCount, Distance bound, Visitor visit ) const {
+			Distance bounds[KmerTile];
+			const Distance * rows[KmerTile][MaxWords];
+			Distance partial[ProtoTile];
+
+			for ( size_t m0 = 0; m0 < kmerCount; m0 += KmerTile ) {
+				const uint mn = (uint) std::min<size_t>( KmerTile, kmerCount - m0 );
+
+				for ( uint i = 0; i < mn; i++ ) {
+					bounds[i] = bound;
+
+					for ( uint j = 0; j < words; j++ ) {
+						rows[i][j] = Row( j, kmers[m0 + i][j] );
+					}
+				}
+
+				for ( size_t c0 = 0; c0 < protoCount; c0 += ProtoTile ) {
+					const uint cn = (uint) std::min<size_t>( ProtoTile, protoCount - c0 );
+
+					for ( uint i = 0; i < mn; i++ ) {
+						if ( !Accumulate( rows[i], c0, cn, bounds[i], partial ) ) continue;
+
+						for ( uint t = 0; t < cn; t++ ) {
+							if ( partial[t] <= bounds[i] ) {
+								bounds[i] = visit( (uint) (m0 + i), (uint) (c0 + t), partial[t] );
+							}
+						}
+					}
+				}
+			}
+		}
+
+		/** Gets the number of prototypes. */
+		size_t Size() const {
+			return protoCount;
+		}
+
+	private:
+		static const uint MaxWords = 64;
+
+		const Distance * Row( uint j, KmerWord kmerWord ) const {
+			return j * 2 + 1 == kmerLength
+				? table1.data() + kmerWord * vocabSize1
+				: table2.data() + kmerWord * vocabSize2;
+		}
+
+		/**
+		 *	Sums the word distances between one kmer and prototypes
+		 *	c0..c0+cn-1 into partial.
+		 *	@returns false if the tile was abandoned because every partial
+		 *		sum exceeded the bound.
+		 */
+		bool Accumulate( const Distance * const * rows, size_t c0, uint cn, Distance bound, Distance * partial ) const {
+			const uint16_t * w = codes.data() + c0;
+			const Distance * row = rows[0];
+
+			for ( uint t = 0; t < cn; t++ ) {
+				partial[t] = row[w[t]];
+			}
+
+			for ( uint j = 1; j < words; j++ ) {
+				Distance least = numeric_limits<Distance>::max();
+
+				for ( uint t = 0; t < cn; t++ ) {
+					least = std::min( least, partial[t] );
+				}
+
+				if ( least > bound ) return false;
+
+				w = codes.data() + j * protoCount + c0;
+				row = rows[j];
+
+				for ( uint t = 0; t < cn; t++ ) {
+					partial[t] += row[w[t]];
+				}
+			}
+
+			return true;
+		}
+	};
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include "Alphabet.hpp"
+#include "DistanceType.hpp"
+#include "EncodedKmer.hpp"
+#include "Exception.hpp"
+#include "KmerClusterPrototype.hpp"
+#include "KmerDistanceCache.hpp"
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	Trie over the packed encodings of a list of prototype kmers, which
+	 *	finds every prototype within a distance threshold of a query kmer
+	 *	without comparing the kmer to each prototype in turn.
+	 *
+	 *	The BLOSUM difference distance, max{ b(a,a) } - b(x,y), is not a
+	 *	metric (d(x,x) > 0 for most x), so triangle-inequality pruning would
+	 *	not be exact. Instead the search exploits the fact that the distance
+	 *	is a sum of non-negative terms, one per packed word: the partial sum
+	 *	along a path from the root, plus the least possible contribution of
+	 *	each remaining word, is a lower bound on the distance to every
+	 *	prototype below that node. A subtree is abandoned as soon as that
+	 *	bound exceeds the threshold, so results are identical to a linear
+	 *	scan.
+	 *
+	 *	Words are those of KmerDistanceCache2: two symbols per word, with a
+	 *	final single-symbol word if the kmer length is odd.
+	 */
+	class PrototypeTrie {
+		struct Node {
+			KmerWord word;
+			uint32_t first;
+			uint32_t last;
+		};
+
+		const KmerDistanceCache2 & distance;
+		uint kmerLength;
+		uint words;
+		uint vocabSize1;
+		uint vocabSize2;
+
+		// levels[j] holds the nodes for word j. Below the last level, the
+		// children of a node are levels[j + 1][first..last); in the last
+		// level, first..last is a range of order.
+		vector<vector<Node>> levels;
+		vector<uint32_t> order;
+
+		// levelMin[j][y] is the least distance between query word y and any
+		// prototype word at level j.
+		vector<vector<Distance>> levelMin;
+
+	public:
+		/**
+		 *	Builds the trie.
+		 *	@param protos The prototypes, each of which is a single kmer.
+		 *	@param distance The distance function used by the encoder.
+		 *	@param alphabet The alphabet used to pack the encodings.
+		 *	@param kmerLength The kmer length.
+		 */
+		PrototypeTrie(
+			vector<KmerClusterPrototype *> & protos,
+			const KmerDistanceCache2 & distance,
+			const Alphabet * alphabet,
+			uint kmerLength
+		) :
+			distance( distance ),
+			kmerLength( kmerLength ),
+			words( (kmerLength + 1) / 2 ),
+			vocabSize1( alphabet->Size() ),
+			vocabSize2( alphabet->Size() * alphabet->Size() ) {
+			if ( words > MaxWords ) {
+				throw Exception( "Kmer length is too large for PrototypeTrie.", FileAndLine );
+			}
+
+			const size_t C = protos.size();
+			vector<EncodedKmer> codes( C );
+
+			for ( size_t c = 0; c < C; c++ ) {
+				codes[c] = protos[c]->PackedEncoding();
+			}
+
+			order.resize( C );
+			std::iota( order.begin(), order.end(), 0 );
+			std::sort( order.begin(), order.end(), [&]( uint32_t x, uint32_t y ) {
+				for ( uint j = 0; j < words; j++ ) {
+					if ( codes[x][j] != codes[y][j] ) return codes[x][j] < codes[y][j];
+				}
+
+				return x < y;
+			} );
+
+			levels.resize( words );
+			levelMin.resize( words );
+
+			if ( C > 0 ) {
+				Build( codes, 0, 0, C );
+			}
+
+			for ( uint j = 0; j < words; j++ ) {
+				uint vocab = WordVocab( j );
+				levelMin[j].assign( vocab, numeric_limits<Distance>::max() );
+
+				for ( auto & node : levels[j] ) {
+					for ( uint y = 0; y < vocab; y++ ) {
+						Distance d = WordDistance( j, node.word, y );
+						if ( d < levelMin[j][y] ) levelMin[j][y] = d;
+					}
+				}
+			}
+		}
+
+		/**
+		 *	Visits the prototypes which may lie within a distance bound of a
+		 *	kmer, each with its exact distance. The visitor returns the bound
+		 *	for the remainder of the search, which allows a nearest-neighbour
+		 *	search to tighten it. Every prototype at distance <= the bound in
+		 *	force when its subtree is reached is visited; prototypes are
+		 *	visited in order of their encodings, not of their indices.
+		 *	@param kmer The packed encoding of the query kmer.
+		 *	@param bound The initial distance bound.
+		 *	@param visit Function (uint protoIndex, Distance distance) -> Distance newBound.
+		 */
+		template<typename Visitor>
+		void Search( EncodedKmer kmer, Distance bound, Visitor visit ) const {
+			if ( levels.empty() || levels[0].empty() ) return;
+
+			// remaining[j] is the least possible distance contributed by words j..words-1.
+			Distance remaining[MaxWords + 1];
+			remaining[words] = 0;
+
+			for ( uint j = words; j-- > 0; ) {
+				remaining[j] = remaining[j + 1] + levelMin[j][kmer[j]];
+			}
+
+			if ( remaining[0] > bound ) return;
+
+			Search( kmer, 0, 0, (uint32_t) levels[0].size(), 0, remaining, bound, visit );
+		}
+
+		/** Gets the number of trie nodes. */
+		size_t NodeCount() const {
+			size_t count = 0;
+			for ( auto & level : levels ) count += level.size();
+			return count;
+		}
+
+	private:
+		static const uint MaxWords = 64;
+
+		uint WordVocab( uint j ) const {
+			return j * 2 + 1 == kmerLength ? vocabSize1 : vocabSize2;
+		}
+
+		Distance WordDistance( uint j, KmerWord protoWord, KmerWord kmerWord ) const {
+			return j * 2 + 1 == kmerLength
+				? distance.GetDistance1( protoWord, kmerWord )
+				: distance.GetDistance2( protoWord, kmerWord );
+		}
+
+		/**
+		 *	Appends the nodes for the runs of equal words at level j within
+		 *	order[lo..hi), then builds their children.
+		 */
+		void Build( const vector<EncodedKmer> & codes, uint j, size_t lo, size_t hi ) {
+			auto & level = levels[j];
+			size_t firstNode = level.size();
+
+			for ( size_t i = lo; i < hi; ) {
+				KmerWord word = codes[order[i]][j];
+				size_t end = i + 1;
+
+				while ( end < hi && codes[order[end]][j] == word ) end++;
+
+				level.push_back( Node{ word, (uint32_t) i, (uint32_t) end } );
+				i = end;
+			}
+
+			size_t lastNode = level.size();
+
+			for ( size_t n = firstNode; n < lastNode; n++ ) {
+				size_t runLo = levels[j][n].first;
+				size_t runHi = levels[j][n].last;
+
+				if ( j + 1 < words ) {
+					levels[j][n].first = (uint32_t) levels[j + 1].size();
+					Build( codes, j + 1, runLo, runHi );
+					levels[j][n].last = (uint32_t) levels[j + 1].size();
+				}
+			}
+		}
+
+		template<typename Visitor>
+		void Search(
+			EncodedKmer kmer,
+			uint j,
+			uint32_t first,
+			uint32_t last,
+			Distance partial,
+			const Distance * remaining,
+			Distance & bound,
+			Visitor & visit
+		) const {
+			const auto & level = levels[j];
+			const KmerWord y = kmer[j];
+
+			for ( uint32_t n = first; n < last; n++ ) {
+				const Node & node = level[n];
+				Distance d = partial + WordDistance( j, node.word, y );
+
+				if ( d + remaining[j + 1] > bound ) continue;
+
+				if ( j + 1 < words ) {
+					Search( kmer, j + 1, node.first, node.last, d, remaining, bound, visit );
+				}
+				else {
+					for ( uint32_t i = node.first; i < node.last && d <= bound; i++ ) {
+						bound = visit( order[i], d );
+					}
+				}
+			}
+		}
+	};
+}
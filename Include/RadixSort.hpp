@@ -0,0 +1,95 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if USE_OMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	Stable, block-parallel least-significant-digit radix sort on
+	 *	unsigned integer keys, one byte per pass.
+	 */
+	class RadixSort {
+	public:
+		/**
+		 *	Sorts items in ascending order of key, preserving the relative
+		 *	order of items with equal keys. Only as many passes are made as
+		 *	there are bytes in maxKey. Each pass splits the array into one
+		 *	block per thread, counts digits per block in parallel, and then
+		 *	scatters the blocks in parallel to disjoint regions of the output.
+		 *	@param items The list to sort.
+		 *	@param maxKey An upper bound on the keys.
+		 *	@param key Function which gets the key of an item, as uint64_t.
+		 */
+		template<typename T, typename Key>
+		static void Sort( vector<T> & items, uint64_t maxKey, Key key ) {
+			const size_t n = items.size();
+			const size_t blocks = BlockCount();
+			const size_t blockSize = ( n + blocks - 1 ) / blocks;
+			vector<T> buffer( n );
+			vector<size_t> offset( blocks * 256 );
+
+			for ( int digit = 0; digit < 64 && ( maxKey >> digit ) != 0; digit += 8 ) {
+				std::fill( offset.begin(), offset.end(), 0 );
+
+#if USE_OMP
+#pragma omp parallel for schedule(static, 1)
+#endif
+				for ( int64_t b = 0; b < (int64_t) blocks; b++ ) {
+					size_t * count = offset.data() + b * 256;
+					size_t end = std::min( n, ( b + 1 ) * blockSize );
+
+					for ( size_t i = b * blockSize; i < end; i++ ) {
+						count[( key( items[i] ) >> digit ) & 255]++;
+					}
+				}
+
+				// Exclusive prefix sum, digit-major then block, so that equal digits keep block order.
+				size_t sum = 0;
+
+				for ( size_t d = 0; d < 256; d++ ) {
+					for ( size_t b = 0; b < blocks; b++ ) {
+						size_t count = offset[b * 256 + d];
+						offset[b * 256 + d] = sum;
+						sum += count;
+					}
+				}
+
+#if USE_OMP
+#pragma omp parallel for schedule(static, 1)
+#endif
+				for ( int64_t b = 0; b < (int64_t) blocks; b++ ) {
+					size_t * next = offset.data() + b * 256;
+					size_t end = std::min( n, ( b + 1 ) * blockSize );
+
+					for ( size_t i = b * blockSize; i < end; i++ ) {
+						buffer[next[( key( items[i] ) >> digit ) & 255]++] = items[i];
+					}
+				}
+
+				items.swap( buffer );
+			}
+		}
+
+		/** Gets the number of blocks into which parallel passes split an array. */
+		static size_t BlockCount() {
+#if USE_OMP
+			return std::max( 1, omp_get_max_threads() );
+#else
+			return 1;
+#endif
+		}
+	};
+}
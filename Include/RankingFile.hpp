@@ -0,0 +1,329 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Exception.hpp"
+#include "MappedFile.hpp"
+#include "OrderedWriter.hpp"
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	Read-only, memory-mapped binary ranking file, as produced by
+	 *	RankingWriter. Holds the same information as the compact text format
+	 *	(queryId subjectId score ... ___eol___ -100000), but query and subject
+	 *	IDs are stored once each in dictionaries and referred to by index, so
+	 *	evaluation tools need not parse or hash a string per ranked document.
+	 *
+	 *	Layout: Header, followed by
+	 *		blocks			one per query, in the order written:
+	 *						Block, then Record[Block::count].
+	 *		queryOffsets	uint64[Q+1]	byte offsets of query IDs within queryChars.
+	 *		queryChars		char[]		concatenated query IDs.
+	 *		subjectOffsets	uint64[S+1]	byte offsets of subject IDs within subjectChars.
+	 *		subjectChars	char[]		concatenated subject IDs.
+	 *	Sections after the blocks are 8-byte aligned.
+	 */
+	class RankingFile {
+	public:
+		struct Header {
+			char tag[8];
+			uint64_t queryCount;
+			uint64_t subjectCount;
+			uint64_t blocks;
+			uint64_t queryOffsets;
+			uint64_t queryChars;
+			uint64_t subjectOffsets;
+			uint64_t subjectChars;
+			uint64_t fileSize;
+		};
+
+		struct Block {
+			uint32_t query;
+			uint32_t count;
+		};
+
+		struct Record {
+			uint32_t subject;
+			float score;
+		};
+
+		static const char * Tag() {
+			return "RANKB01";
+		}
+
+		/**
+		 *	Output file names ending with this extension are written in binary
+		 *	format by RankingWriter.
+		 */
+		static const char * Extension() {
+			return ".rnkb";
+		}
+
+	private:
+		MappedFile file;
+		const Header * header;
+		const uint64_t * queryOffsets;
+		const char * queryChars;
+		const uint64_t * subjectOffsets;
+		const char * subjectChars;
+		vector<const Block *> blocks;
+		size_t recordCount = 0;
+
+	public:
+		/**
+		 *	Map a binary ranking file and locate its query blocks.
+		 *	@param fileName The name of a file created by RankingWriter.
+		 *	@throws Exception if the file is not a valid binary ranking file.
+		 */
+		RankingFile( const string & fileName ) : file( fileName ) {
+			if ( !file.StartsWith( Tag(), sizeof( header->tag ) ) ) {
+				throw Exception( "File " + fileName + " is not a binary ranking file.", FileAndLine );
+			}
+
+			header = file.At<Header>( 0 );
+
+			if ( header->fileSize != file.Size() ) {
+				throw Exception( "File " + fileName + " is truncated or corrupt.", FileAndLine );
+			}
+
+			auto Q = header->queryCount;
+			auto S = header->subjectCount;
+
+			queryOffsets = file.At<uint64_t>( header->queryOffsets, Q + 1 );
+			queryChars = file.At<char>( header->queryChars, queryOffsets[Q] );
+			subjectOffsets = file.At<uint64_t>( header->subjectOffsets, S + 1 );
+			subjectChars = file.At<char>( header->subjectChars, subjectOffsets[S] );
+
+			for ( uint64_t pos = header->blocks; pos < header->queryOffsets; ) {
+				auto block = file.At<Block>( pos );
+				pos += sizeof( Block );
+				file.At<Record>( pos, block->count );
+				pos += block->count * sizeof( Record );
+
+				if ( block->query >= Q ) {
+					throw Exception( "File " + fileName + " contains an invalid query index.", FileAndLine );
+				}
+
+				blocks.push_back( block );
+				recordCount += block->count;
+			}
+		}
+
+		/**
+		 *	Returns true iff the named file exists and carries the binary
+		 *	ranking file tag.
+		 */
+		static bool IsBinary( const string & fileName ) {
+			ifstream str( fileName, ios::binary );
+			char tag[sizeof( Header::tag )] = { 0 };
+			str.read( tag, sizeof( tag ) );
+			return str.gcount() == sizeof( tag ) && memcmp( tag, Tag(), sizeof( tag ) ) == 0;
+		}
+
+		/**
+		 *	Returns true iff the file name ends with Extension().
+		 */
+		static bool IsBinaryName( const string & fileName ) {
+			size_t n = strlen( Extension() );
+			return fileName.size() >= n && fileName.compare( fileName.size() - n, n, Extension() ) == 0;
+		}
+
+		/** Gets the number of entries in the query dictionary. */
+		size_t QueryCount() const {
+			return header->queryCount;
+		}
+
+		/** Gets the number of entries in the subject dictionary. */
+		size_t SubjectCount() const {
+			return header->subjectCount;
+		}
+
+		/** Gets the number of query blocks present in the file. */
+		size_t BlockCount() const {
+			return blocks.size();
+		}
+
+		/** Gets the total number of ranked documents in the file. */
+		size_t RecordCount() const {
+			return recordCount;
+		}
+
+		/** Gets the ID of query q. */
+		string QueryId( size_t q ) const {
+			return string( queryChars + queryOffsets[q], queryOffsets[q + 1] - queryOffsets[q] );
+		}
+
+		/** Gets the ID of subject s. */
+		string SubjectId( size_t s ) const {
+			return string( subjectChars + subjectOffsets[s], subjectOffsets[s + 1] - subjectOffsets[s] );
+		}
+
+		/** Gets the header of block b, which holds the query index and the number of records. */
+		const Block & GetBlock( size_t b ) const {
+			return *blocks[b];
+		}
+
+		/** Gets the records of block b, in ranked order. */
+		const Record * Records( size_t b ) const {
+			return (const Record *) (blocks[b] + 1);
+		}
+	};
+
+	/**
+	 *	Writes rankings from a parallel ranker, in the compact text format or,
+	 *	if the output file name ends with RankingFile::Extension(), in the
+	 *	binary format read by RankingFile. Each thread formats a query's
+	 *	rankings into its own buffer via Submit, and an OrderedWriter writes
+	 *	them in query order.
+	 */
+	class RankingWriter {
+		ofstream out;
+		bool binary;
+		unique_ptr<OrderedWriter> writer;
+
+	public:
+		RankingWriter( const string & fileName ) :
+			out( fileName, RankingFile::IsBinaryName( fileName ) ? ios::out | ios::binary : ios::out ),
+			binary( RankingFile::IsBinaryName( fileName ) ) {
+			if ( out.fail() ) {
+				throw Exception( "Unable to create file " + fileName, FileAndLine );
+			}
+
+			if ( binary ) {
+				RankingFile::Header h;
+				memset( &h, 0, sizeof( h ) );
+				out.write( (const char *) &h, sizeof( h ) );
+			}
+
+			writer.reset( new OrderedWriter( out ) );
+		}
+
+		RankingWriter( const RankingWriter & other ) = delete;
+
+		RankingWriter & operator=( const RankingWriter & other ) = delete;
+
+		virtual ~RankingWriter() {
+			writer.reset();
+		}
+
+		bool IsBinary() const {
+			return binary;
+		}
+
+		/**
+		 *	Formats the rankings for query q and hands them to the writer
+		 *	thread. Safe to call concurrently; each thread supplies its own buffer.
+		 *	@param q The query index; each query must be submitted exactly once.
+		 *	@param queryId The query ID, used by the text format.
+		 *	@param rankings Sorted (distance, subject index) pairs.
+		 *	@param subjectId Function which returns the ID of a subject index, used by the text format.
+		 *	@param buffer Thread-local formatting buffer.
+		 */
+		template<typename Rankings, typename SubjectId>
+		void Submit(
+			size_t q,
+			const string & queryId,
+			Rankings & rankings,
+			SubjectId subjectId,
+			ostringstream & buffer
+		) {
+			if ( binary ) {
+				RankingFile::Block block{ (uint32_t) q, (uint32_t) std::distance( std::begin( rankings ), std::end( rankings ) ) };
+				buffer.write( (const char *) &block, sizeof( block ) );
+
+				for ( auto & ranking : rankings ) {
+					RankingFile::Record record{ (uint32_t) ranking.second, (float) (-ranking.first) };
+					buffer.write( (const char *) &record, sizeof( record ) );
+				}
+			}
+			else {
+				buffer << queryId;
+
+				for ( auto & ranking : rankings ) {
+					buffer << " " << subjectId( ranking.second ) << " " << (-ranking.first);
+				}
+
+				buffer << " ___eol___ -100000\n";
+			}
+
+			writer->Submit( q, buffer );
+		}
+
+		/**
+		 *	Writes all outstanding rankings and, in binary format, the query and
+		 *	subject dictionaries. Must not be called concurrently with Submit.
+		 *	@param Q The number of queries.
+		 *	@param queryId Function which returns the ID of query q.
+		 *	@param S The number of subjects.
+		 *	@param subjectId Function which returns the ID of subject s.
+		 *	@throws Exception if the file cannot be completed.
+		 */
+		template<typename QueryId, typename SubjectId>
+		void Close( size_t Q, QueryId queryId, size_t S, SubjectId subjectId ) {
+			writer->Close();
+
+			if ( !binary ) {
+				out.close();
+				return;
+			}
+
+			RankingFile::Header h;
+			memset( &h, 0, sizeof( h ) );
+			memcpy( h.tag, RankingFile::Tag(), sizeof( h.tag ) );
+			h.queryCount = Q;
+			h.subjectCount = S;
+			h.blocks = sizeof( h );
+
+			uint64_t pos = out.tellp();
+
+			auto writeDictionary = [&]( size_t N, uint64_t & offsetsField, uint64_t & charsField, auto id ) {
+				static const char zeros[8] = { 0 };
+				vector<uint64_t> offsets( N + 1 );
+				string chars;
+
+				for ( size_t i = 0; i < N; i++ ) {
+					offsets[i] = chars.size();
+					chars += id( i );
+				}
+
+				offsets[N] = chars.size();
+
+				uint64_t aligned = (pos + 7) & ~uint64_t( 7 );
+				out.write( zeros, aligned - pos );
+				offsetsField = aligned;
+				out.write( (const char *) offsets.data(), offsets.size() * sizeof( uint64_t ) );
+				charsField = aligned + offsets.size() * sizeof( uint64_t );
+				out.write( chars.data(), chars.size() );
+				pos = charsField + chars.size();
+			};
+
+			writeDictionary( Q, h.queryOffsets, h.queryChars, queryId );
+			writeDictionary( S, h.subjectOffsets, h.subjectChars, subjectId );
+			h.fileSize = pos;
+
+			out.seekp( 0 );
+			out.write( (const char *) &h, sizeof( h ) );
+			out.close();
+
+			if ( out.fail() ) {
+				throw Exception( "Error writing binary ranking file.", FileAndLine );
+			}
+		}
+	};
+}
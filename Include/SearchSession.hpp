@@ -0,0 +1,108 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "Exception.hpp"
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	Request loop for a long-running ranker which has loaded its database
+	 *	and indices once, and then ranks any number of query batches.
+	 *
+	 *	Requests are read one per line from a stream, normally stdin:
+	 *		queryFile outFile	Rank the queries in queryFile, writing rankings to outFile.
+	 *		quit				End the session (as does end of input).
+	 *	Blank lines are ignored. File names may not contain white space.
+	 *
+	 *	Each request gets exactly one reply line on stdout, which is flushed:
+	 *		ready					Once, before the first request is read. Anything
+	 *								written before this is start-up output.
+	 *		ok queryCount seconds	The request succeeded.
+	 *		error message			The request failed; the session continues.
+	 *	While a request is being handled, anything the ranker writes to cout
+	 *	is diverted to cerr, so that stdout carries only replies and a client
+	 *	can drive the session through a pair of pipes.
+	 */
+	class SearchSession {
+	public:
+		/**
+		 *	Function which ranks the queries in a file and returns the number
+		 *	of queries ranked. Errors are reported by throwing.
+		 */
+		using Handler = function<size_t( const string & queryFile, const string & outFile )>;
+
+		/**
+		 *	Serves requests until end of input or quit.
+		 *	@param in The request stream.
+		 *	@param handler Function which handles a request.
+		 *	@returns The number of requests which succeeded.
+		 */
+		static size_t Serve( istream & in, Handler handler ) {
+			ostream reply( cout.rdbuf() );
+			size_t succeeded = 0;
+			string line;
+
+			reply << "ready" << endl;
+
+			while ( getline( in, line ) ) {
+				istringstream words( line );
+				string queryFile, outFile, extra;
+
+				if ( !(words >> queryFile) ) continue;
+
+				if ( queryFile == "quit" ) break;
+
+				if ( !(words >> outFile) || (words >> extra) ) {
+					reply << "error expected 'queryFile outFile' or 'quit'" << endl;
+					continue;
+				}
+
+				auto saved = cout.rdbuf( cerr.rdbuf() );
+				auto start = chrono::steady_clock::now();
+
+				try {
+					if ( !ifstream( queryFile ) ) {
+						throw Exception( "Unable to open query file " + queryFile, FileAndLine );
+					}
+
+					size_t queryCount = handler( queryFile, outFile );
+					chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+					cout.rdbuf( saved );
+					reply << "ok " << queryCount << " " << elapsed.count() << endl;
+					succeeded++;
+				}
+				catch ( std::exception & ex ) {
+					cout.rdbuf( saved );
+					reply << "error " << Flatten( ex.what() ) << endl;
+				}
+			}
+
+			return succeeded;
+		}
+
+	private:
+		static string Flatten( const string & message ) {
+			string result( message );
+
+			for ( auto & ch : result ) {
+				if ( ch == '\n' || ch == '\r' ) ch = ' ';
+			}
+
+			return result;
+		}
+	};
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Exception.hpp"
+#include "Sequence.hpp"
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	Spaced-seed inverted index over a database of sequences, used to
+	 *	nominate a bounded set of candidates for each query before running a
+	 *	full similarity projection.
+	 *
+	 *	A seed pattern such as "11011" selects the positions of a window
+	 *	which must match exactly; '0' positions are ignored, which makes the
+	 *	seed tolerant of substitutions at those positions. Each seed is
+	 *	encoded as a perfect hash over the selected symbols, so the postings
+	 *	are held in a single flat array indexed by seed code (CSR layout).
+	 *	Each database sequence appears at most once in the posting list of a
+	 *	given seed.
+	 *
+	 *	Candidates for a query are the database sequences which share the
+	 *	largest number of distinct seeds with it.
+	 */
+	class SeedFilter {
+		string pattern;
+		vector<size_t> matchPositions;
+		size_t alphabetSize;
+		size_t codeCount = 1;
+		size_t dbSize;
+		vector<uint32_t> postingStart;
+		vector<uint32_t> postings;
+
+	public:
+		/**
+		 *	Builds the index.
+		 *	@param db The database sequences.
+		 *	@param pattern The seed pattern, a string of '1' (match) and '0' (don't care) characters,
+		 *		starting and ending with '1'.
+		 *	@param alphabetSize The number of distinct symbols in the encoded sequences.
+		 *	@throws Exception if the pattern is invalid or yields too many distinct seeds.
+		 */
+		SeedFilter( const vector<Sequence *> & db, const string & pattern, size_t alphabetSize ) :
+			pattern( pattern ), alphabetSize( alphabetSize ), dbSize( db.size() ) {
+			if ( pattern.empty() || pattern.front() != '1' || pattern.back() != '1'
+				|| pattern.find_first_not_of( "01" ) != string::npos ) {
+				throw Exception( "Seed pattern '" + pattern + "' must contain only '0' and '1', and start and end with '1'.", FileAndLine );
+			}
+
+			for ( size_t i = 0; i < pattern.size(); i++ ) {
+				if ( pattern[i] == '1' ) {
+					matchPositions.push_back( i );
+
+					if ( codeCount > MaxCodes() / alphabetSize ) {
+						throw Exception( "Seed pattern '" + pattern + "' has too many match positions for the alphabet.", FileAndLine );
+					}
+
+					codeCount *= alphabetSize;
+				}
+			}
+
+			vector<vector<uint32_t>> seqCodes( db.size() );
+
+#if USE_OMP
+#pragma omp parallel for schedule(dynamic,64)
+#endif
+			for ( size_t d = 0; d < db.size(); d++ ) {
+				GetSeeds( db[d]->Seq(), seqCodes[d] );
+			}
+
+			postingStart.assign( codeCount + 1, 0 );
+
+			for ( auto & codes : seqCodes ) {
+				for ( auto code : codes ) postingStart[code + 1]++;
+			}
+
+			for ( size_t c = 0; c < codeCount; c++ ) {
+				postingStart[c + 1] += postingStart[c];
+			}
+
+			postings.resize( postingStart[codeCount] );
+			vector<uint32_t> next( postingStart.begin(), postingStart.end() - 1 );
+
+			for ( size_t d = 0; d < db.size(); d++ ) {
+				for ( auto code : seqCodes[d] ) postings[next[code]++] = (uint32_t) d;
+			}
+		}
+
+		/**
+		 *	Gets the distinct seed codes present in a sequence, in ascending order.
+		 *	@param seq The sequence.
+		 *	@param codes Vector which will be overwritten with the seed codes.
+		 */
+		void GetSeeds( const vector<Symbol> & seq, vector<uint32_t> & codes ) const {
+			codes.clear();
+
+			if ( seq.size() < pattern.size() ) return;
+
+			for ( size_t i = 0; i + pattern.size() <= seq.size(); i++ ) {
+				size_t code = 0;
+
+				for ( auto offset : matchPositions ) {
+					code = code * alphabetSize + seq[i + offset].value;
+				}
+
+				codes.push_back( (uint32_t) code );
+			}
+
+			std::sort( codes.begin(), codes.end() );
+			codes.erase( std::unique( codes.begin(), codes.end() ), codes.end() );
+		}
+
+		/**
+		 *	Per-thread working storage for GetCandidates.
+		 */
+		struct Workspace {
+			vector<uint32_t> codes;
+			vector<uint32_t> hits;
+			vector<uint32_t> touched;
+		};
+
+		/**
+		 *	Nominates the database sequences which share the most distinct
+		 *	seeds with a query. Sequences which share no seed are never
+		 *	nominated, so fewer than maxCandidates may be returned.
+		 *	@param query The query sequence.
+		 *	@param maxCandidates The maximum number of candidates to return.
+		 *	@param work Thread-local working storage.
+		 *	@param candidates Vector which will be overwritten with the indices
+		 *		of the candidates, in ascending order.
+		 */
+		void GetCandidates(
+			const vector<Symbol> & query,
+			size_t maxCandidates,
+			Workspace & work,
+			vector<uint32_t> & candidates
+		) const {
+			candidates.clear();
+			work.hits.resize( dbSize, 0 );
+			work.touched.clear();
+
+			GetSeeds( query, work.codes );
+
+			for ( auto code : work.codes ) {
+				for ( uint32_t p = postingStart[code]; p < postingStart[code + 1]; p++ ) {
+					auto d = postings[p];
+					if ( work.hits[d]++ == 0 ) work.touched.push_back( d );
+				}
+			}
+
+			if ( work.touched.size() > maxCandidates ) {
+				auto & hits = work.hits;
+				std::nth_element( work.touched.begin(), work.touched.begin() + maxCandidates, work.touched.end(),
+					[&hits]( uint32_t x, uint32_t y ) { return hits[x] > hits[y] || (hits[x] == hits[y] && x < y); }
+				);
+				candidates.assign( work.touched.begin(), work.touched.begin() + maxCandidates );
+			}
+			else {
+				candidates.assign( work.touched.begin(), work.touched.end() );
+			}
+
+			for ( auto d : work.touched ) work.hits[d] = 0;
+
+			std::sort( candidates.begin(), candidates.end() );
+		}
+
+		/** Gets the seed pattern. */
+		const string & Pattern() const {
+			return pattern;
+		}
+
+		/** Gets the total number of (seed, sequence) postings in the index. */
+		size_t PostingCount() const {
+			return postings.size();
+		}
+
+	private:
+		static size_t MaxCodes() {
+			return (size_t) 1 << 28;
+		}
+	};
+}
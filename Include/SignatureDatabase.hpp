@@ -0,0 +1,476 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "Exception.hpp"
+#include "Types.hpp"
+#include "MappedFile.hpp"
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	Variable length (LEB128) coding of unsigned integers, used to store
+	 *	delta-coded feature and document lists.
+	 */
+	struct VarInt {
+		static void Append( uint64_t value, vector<byte> & buffer ) {
+			while ( value >= 0x80 ) {
+				buffer.push_back( (byte) (value | 0x80) );
+				value >>= 7;
+			}
+
+			buffer.push_back( (byte) value );
+		}
+
+		static uint64_t Next( const byte * & p ) {
+			uint64_t value = 0;
+			int shift = 0;
+
+			while ( *p & 0x80 ) {
+				value |= uint64_t( *p++ & 0x7f ) << shift;
+				shift += 7;
+			}
+
+			value |= uint64_t( *p++ ) << shift;
+			return value;
+		}
+
+		/**
+		 *	Append a strictly ascending list, coded as gaps.
+		 */
+		template<typename Collection>
+		static void AppendAscending( const Collection & values, vector<byte> & buffer ) {
+			uint64_t prev = 0;
+
+			for ( auto x : values ) {
+				Append( x - prev, buffer );
+				prev = x;
+			}
+		}
+
+		/**
+		 *	Decode N gap-coded values, replacing the contents of values.
+		 */
+		static void DecodeAscending( const byte * p, size_t N, vector<uint> & values ) {
+			values.resize( N );
+			uint64_t prev = 0;
+
+			for ( size_t i = 0; i < N; i++ ) {
+				prev += Next( p );
+				values[i] = (uint) prev;
+			}
+		}
+	};
+
+	/**
+	 *	Read-only, memory-mapped collection of sparse signatures with prebuilt
+	 *	posting lists. The file is produced by SignatureDatabase::Write (or
+	 *	Convert, from the text format emitted by AAClustSigEncode) and is used
+	 *	in place without parsing.
+	 *
+	 *	Layout: Header, followed by 8-byte aligned sections
+	 *		idOffsets	uint64[N+1]	byte offsets of ID strings within idChars.
+	 *		idChars		char[]		concatenated ID strings.
+	 *		sigOffsets	uint64[N+1]	byte offsets of signatures within sigData.
+	 *		sigSizes	uint32[N]	cardinality of each signature.
+	 *		sigData		byte[]		gap-coded varint feature numbers.
+	 *		postOffsets	uint64[F+1]	byte offsets of posting lists within postData.
+	 *		postSizes	uint32[F]	length of each posting list.
+	 *		postData	byte[]		gap-coded varint signature numbers.
+	 */
+	class SignatureDatabase {
+	public:
+		struct Header {
+			char tag[8];
+			uint64_t sigCount;
+			uint64_t featureCount;
+			uint64_t idOffsets;
+			uint64_t idChars;
+			uint64_t sigOffsets;
+			uint64_t sigSizes;
+			uint64_t sigData;
+			uint64_t postOffsets;
+			uint64_t postSizes;
+			uint64_t postData;
+			uint64_t fileSize;
+		};
+
+		static const char * Tag() {
+			return "SIGDB01";
+		}
+
+	private:
+		MappedFile file;
+		const Header * header;
+		const uint64_t * idOffsets;
+		const char * idChars;
+		const uint64_t * sigOffsets;
+		const uint32_t * sigSizes;
+		const byte * sigData;
+		const uint64_t * postOffsets;
+		const uint32_t * postSizes;
+		const byte * postData;
+
+	public:
+		/**
+		 *	Map a binary signature database.
+		 *	@param fileName The name of a file created by SignatureDatabase::Write.
+		 *	@throws Exception if the file is not a valid signature database.
+		 */
+		SignatureDatabase( const string & fileName ) : file( fileName ) {
+			if ( !file.StartsWith( Tag(), sizeof( header->tag ) ) ) {
+				throw Exception( "File " + fileName + " is not a binary signature database.", FileAndLine );
+			}
+
+			header = file.At<Header>( 0 );
+
+			if ( header->fileSize != file.Size() ) {
+				throw Exception( "File " + fileName + " is truncated or corrupt.", FileAndLine );
+			}
+
+			auto N = header->sigCount;
+			auto F = header->featureCount;
+
+			idOffsets = file.At<uint64_t>( header->idOffsets, N + 1 );
+			idChars = file.At<char>( header->idChars, idOffsets[N] );
+			sigOffsets = file.At<uint64_t>( header->sigOffsets, N + 1 );
+			sigSizes = file.At<uint32_t>( header->sigSizes, N );
+			sigData = file.At<byte>( header->sigData, sigOffsets[N] );
+			postOffsets = file.At<uint64_t>( header->postOffsets, F + 1 );
+			postSizes = file.At<uint32_t>( header->postSizes, F );
+			postData = file.At<byte>( header->postData, postOffsets[F] );
+		}
+
+		/**
+		 *	Returns true iff the named file exists and carries the binary
+		 *	signature database tag.
+		 */
+		static bool IsBinary( const string & fileName ) {
+			ifstream str( fileName, ios::binary );
+			char tag[sizeof( Header::tag )] = { 0 };
+			str.read( tag, sizeof( tag ) );
+			return str.gcount() == sizeof( tag ) && memcmp( tag, Tag(), sizeof( tag ) ) == 0;
+		}
+
+		/** Gets the number of signatures. */
+		size_t Size() const {
+			return header->sigCount;
+		}
+
+		/** Gets the number of distinct features (one more than the largest feature number). */
+		size_t FeatureCount() const {
+			return header->featureCount;
+		}
+
+		/** Gets the sequence ID of signature d. */
+		string Id( size_t d ) const {
+			return string( idChars + idOffsets[d], idOffsets[d + 1] - idOffsets[d] );
+		}
+
+		/** Gets the number of features in signature d. */
+		uint Cardinality( size_t d ) const {
+			return sigSizes[d];
+		}
+
+		/** Decodes the (ascending) features of signature d. */
+		void GetFeatures( size_t d, vector<uint> & features ) const {
+			VarInt::DecodeAscending( sigData + sigOffsets[d], sigSizes[d], features );
+		}
+
+		/** Gets the number of signatures which contain the feature. */
+		uint PostingLength( uint feature ) const {
+			return feature < header->featureCount ? postSizes[feature] : 0;
+		}
+
+		/** Decodes the (ascending) list of signatures which contain the feature. */
+		void GetPostings( uint feature, vector<uint> & docs ) const {
+			if ( feature < header->featureCount ) {
+				VarInt::DecodeAscending( postData + postOffsets[feature], postSizes[feature], docs );
+			}
+			else {
+				docs.clear();
+			}
+		}
+
+		/**
+		 *	Gets the Jaccard similarity between an ordered feature list and signature d.
+		 *	@param query An ascending list of feature numbers.
+		 *	@param d The signature number.
+		 *	@param scratch Working storage, overwritten with the features of d.
+		 */
+		double Similarity( const vector<uint> & query, size_t d, vector<uint> & scratch ) const {
+			GetFeatures( d, scratch );
+
+			size_t m = query.size(), n = scratch.size(), i = 0, j = 0, intersect = 0;
+
+			while ( i < m && j < n ) {
+				uint x = query[i], y = scratch[j];
+
+				if ( x < y ) {
+					i++;
+				}
+				else if ( y < x ) {
+					j++;
+				}
+				else {
+					intersect++;
+					i++;
+					j++;
+				}
+			}
+
+			size_t union_ = m + n - intersect;
+			return union_ == 0 ? 0 : (double) intersect / union_;
+		}
+
+		/**
+		 *	Serialise a list of signatures to a binary signature database.
+		 *	@param ids The sequence IDs.
+		 *	@param features The features of each signature, in ascending order without duplicates.
+		 *	@param fileName The name of the output file.
+		 */
+		static void Write(
+			const vector<string> & ids,
+			const vector<vector<uint>> & features,
+			const string & fileName
+		) {
+			const size_t N = ids.size();
+
+			if ( features.size() != N ) {
+				throw Exception( "Number of IDs does not match number of signatures.", FileAndLine );
+			}
+
+			uint64_t F = 0;
+
+			for ( auto & sig : features ) {
+				if ( sig.size() > 0 && sig.back() + uint64_t( 1 ) > F ) F = sig.back() + uint64_t( 1 );
+			}
+
+			vector<uint64_t> idOffsets( N + 1 );
+			string idChars;
+
+			for ( size_t d = 0; d < N; d++ ) {
+				idOffsets[d] = idChars.size();
+				idChars += ids[d];
+			}
+
+			idOffsets[N] = idChars.size();
+
+			vector<uint64_t> sigOffsets( N + 1 );
+			vector<uint32_t> sigSizes( N );
+			vector<byte> sigData;
+			vector<uint32_t> postSizes( F );
+
+			for ( size_t d = 0; d < N; d++ ) {
+				sigOffsets[d] = sigData.size();
+				sigSizes[d] = features[d].size();
+				VarInt::AppendAscending( features[d], sigData );
+
+				for ( auto f : features[d] ) postSizes[f]++;
+			}
+
+			sigOffsets[N] = sigData.size();
+
+			vector<vector<uint>> postings( F );
+
+			for ( uint64_t f = 0; f < F; f++ ) postings[f].reserve( postSizes[f] );
+
+			for ( size_t d = 0; d < N; d++ ) {
+				for ( auto f : features[d] ) postings[f].push_back( d );
+			}
+
+			vector<uint64_t> postOffsets( F + 1 );
+			vector<byte> postData;
+
+			for ( uint64_t f = 0; f < F; f++ ) {
+				postOffsets[f] = postData.size();
+				VarInt::AppendAscending( postings[f], postData );
+				vector<uint>().swap( postings[f] );
+			}
+
+			postOffsets[F] = postData.size();
+
+			Header h;
+			memset( &h, 0, sizeof( h ) );
+			memcpy( h.tag, Tag(), sizeof( h.tag ) );
+			h.sigCount = N;
+			h.featureCount = F;
+
+			uint64_t pos = sizeof( Header );
+
+			auto place = [&pos]( uint64_t & field, uint64_t bytes ) {
+				field = pos;
+				pos = (pos + bytes + 7) & ~uint64_t( 7 );
+			};
+
+			place( h.idOffsets, idOffsets.size() * sizeof( uint64_t ) );
+			place( h.idChars, idChars.size() );
+			place( h.sigOffsets, sigOffsets.size() * sizeof( uint64_t ) );
+			place( h.sigSizes, sigSizes.size() * sizeof( uint32_t ) );
+			place( h.sigData, sigData.size() );
+			place( h.postOffsets, postOffsets.size() * sizeof( uint64_t ) );
+			place( h.postSizes, postSizes.size() * sizeof( uint32_t ) );
+			place( h.postData, postData.size() );
+			h.fileSize = pos;
+
+			ofstream str( fileName, ios::binary );
+
+			if ( str.fail() ) {
+				throw Exception( "Unable to create file " + fileName, FileAndLine );
+			}
+
+			uint64_t written = 0;
+
+			auto emit = [&]( uint64_t offset, const void * data, uint64_t bytes ) {
+				static const char zeros[8] = { 0 };
+				str.write( zeros, offset - written );
+				str.write( (const char *) data, bytes );
+				written = offset + bytes;
+			};
+
+			emit( 0, &h, sizeof( h ) );
+			emit( h.idOffsets, idOffsets.data(), idOffsets.size() * sizeof( uint64_t ) );
+			emit( h.idChars, idChars.data(), idChars.size() );
+			emit( h.sigOffsets, sigOffsets.data(), sigOffsets.size() * sizeof( uint64_t ) );
+			emit( h.sigSizes, sigSizes.data(), sigSizes.size() * sizeof( uint32_t ) );
+			emit( h.sigData, sigData.data(), sigData.size() );
+			emit( h.postOffsets, postOffsets.data(), postOffsets.size() * sizeof( uint64_t ) );
+			emit( h.postSizes, postSizes.data(), postSizes.size() * sizeof( uint32_t ) );
+			emit( h.postData, postData.data(), postData.size() );
+			emit( h.fileSize, 0, 0 );
+
+			if ( str.fail() ) {
+				throw Exception( "Error writing file " + fileName, FileAndLine );
+			}
+		}
+
+		/**
+		 *	Parse a text signature file as emitted by AAClustSigEncode. Each
+		 *	record is: seqId cardinality feature_1 ... feature_n;
+		 *	Features are sorted and deduplicated.
+		 */
+		static void ReadText(
+			const string & fileName,
+			vector<string> & ids,
+			vector<vector<uint>> & features
+		) {
+			ifstream str( fileName );
+
+			if ( str.fail() ) {
+				throw Exception( "Error reading file " + fileName, FileAndLine );
+			}
+
+			ReadText( str, fileName, ids, features );
+		}
+
+		/**
+		 *	Parse text signature records from a stream, starting at its current
+		 *	position. New records are appended to ids and features.
+		 *	@param fileName The name of the underlying file, for error messages.
+		 */
+		static void ReadText(
+			istream & str,
+			const string & fileName,
+			vector<string> & ids,
+			vector<vector<uint>> & features
+		) {
+			string seqId;
+
+			while ( str >> seqId ) {
+				size_t cardinality = 0;
+				str >> cardinality;
+
+				vector<uint> sig;
+				sig.reserve( cardinality );
+
+				for ( size_t i = 0; i < cardinality; i++ ) {
+					uint64_t t;
+
+					if ( !(str >> t) ) {
+						throw Exception( "Signature for " + seqId + " is truncated in file " + fileName, FileAndLine );
+					}
+
+					sig.push_back( t );
+				}
+
+				str >> ws;
+
+				if ( str.peek() == ';' ) str.ignore( 1 );
+
+				std::sort( sig.begin(), sig.end() );
+				sig.erase( std::unique( sig.begin(), sig.end() ), sig.end() );
+
+				ids.push_back( seqId );
+				features.push_back( std::move( sig ) );
+			}
+		}
+
+		/**
+		 *	Convert a text signature file to a binary signature database.
+		 *	@returns The number of signatures converted.
+		 */
+		static size_t Convert( const string & textFile, const string & binaryFile ) {
+			vector<string> ids;
+			vector<vector<uint>> features;
+			ReadText( textFile, ids, features );
+			Write( ids, features, binaryFile );
+			return ids.size();
+		}
+
+		/**
+		 *	Append signatures to an existing binary signature database. The
+		 *	posting lists are rebuilt, so the file is rewritten in full; the new
+		 *	file is written alongside and renamed over the old one, so that an
+		 *	interrupted update leaves the original intact.
+		 *	@param fileName The name of a file created by Write.
+		 *	@param ids The sequence IDs of the new signatures.
+		 *	@param features The features of each new signature, in ascending order without duplicates.
+		 *	@returns The number of signatures in the updated database.
+		 */
+		static size_t Append(
+			const string & fileName,
+			const vector<string> & ids,
+			const vector<vector<uint>> & features
+		) {
+			vector<string> allIds;
+			vector<vector<uint>> allFeatures;
+
+			{
+				SignatureDatabase db( fileName );
+				const size_t N = db.Size();
+
+				allIds.reserve( N + ids.size() );
+				allFeatures.resize( N );
+
+				for ( size_t d = 0; d < N; d++ ) {
+					allIds.push_back( db.Id( d ) );
+					db.GetFeatures( d, allFeatures[d] );
+				}
+			}
+
+			allIds.insert( allIds.end(), ids.begin(), ids.end() );
+			allFeatures.insert( allFeatures.end(), features.begin(), features.end() );
+
+			string tempFile = MappedFile::TempFileName( fileName );
+			Write( allIds, allFeatures, tempFile );
+
+			if ( std::rename( tempFile.c_str(), fileName.c_str() ) != 0 ) {
+				throw Exception( "Unable to replace file " + fileName + " with " + tempFile, FileAndLine );
+			}
+
+			return allIds.size();
+		}
+	};
+}
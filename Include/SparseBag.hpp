@@ -0,0 +1,232 @@
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201703L
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define SPARSE_BAG_SSE2 1
+#include <emmintrin.h>
+#else
+#define SPARSE_BAG_SSE2 0
+#endif
+
+using namespace std;
+
+namespace QutBio {
+	/**
+	 *	Bag of words stored as a structure of arrays: strictly increasing
+	 *	32-bit keys and the corresponding float weights. This is the compact
+	 *	form of a sorted term frequency vector, used by the bag similarity
+	 *	measures, all of which are functions of the Overlap computed by
+	 *	Intersect.
+	 *
+	 *	Weights are intended to be occurrence counts, which float represents
+	 *	exactly up to 2^24. Products and sums are accumulated in double, so
+	 *	for integer weights the results are exact and do not depend on the
+	 *	order of summation.
+	 */
+	class SparseBag {
+	public:
+		vector<uint32_t> keys;
+		vector<float> weights;
+
+		/** The sum of the weights. */
+		double total = 0;
+
+		/** The sum of the squared weights. */
+		double totalSquared = 0;
+
+		/**
+		 *	Appends a word, which must be greater than every key already present.
+		 */
+		void Append( uint32_t key, float weight ) {
+			keys.push_back( key );
+			weights.push_back( weight );
+			total += weight;
+			totalSquared += (double) weight * weight;
+		}
+
+		size_t Size() const {
+			return keys.size();
+		}
+
+		bool Empty() const {
+			return keys.empty();
+		}
+
+		/**
+		 *	Gets the number of keys less than or equal to key.
+		 */
+		size_t CountUpTo( uint32_t key ) const {
+			return std::upper_bound( keys.begin(), keys.end(), key ) - keys.begin();
+		}
+
+		/**
+		 *	Gets the sum of the squared weights of the keys less than or equal to key.
+		 */
+		double SumSquaredUpTo( uint32_t key ) const {
+			if ( !keys.empty() && keys.back() <= key ) return totalSquared;
+
+			size_t n = CountUpTo( key );
+			double sum = 0;
+
+			for ( size_t i = 0; i < n; i++ ) {
+				sum += (double) weights[i] * weights[i];
+			}
+
+			return sum;
+		}
+
+		/** Statistics of the words common to two bags. */
+		struct Overlap {
+			/** The number of common keys. */
+			size_t matches = 0;
+
+			/** The sum over common keys of the product of weights. */
+			double sumProduct = 0;
+
+			/** The sum over common keys of the lesser weight. */
+			double sumMin = 0;
+		};
+
+		/**
+		 *	Computes the overlap of two bags. If one bag is much larger than
+		 *	the other, the keys of the smaller bag are located in the larger
+		 *	by galloping search; otherwise the bags are merged four keys at a
+		 *	time, comparing each block of one against all rotations of the
+		 *	current block of the other.
+		 */
+		static Overlap Intersect( const SparseBag & a, const SparseBag & b ) {
+			const SparseBag & small = a.Size() <= b.Size() ? a : b;
+			const SparseBag & large = a.Size() <= b.Size() ? b : a;
+
+			if ( small.Size() * GallopRatio < large.Size() ) {
+				return Gallop( small, large );
+			}
+
+			return Merge( a, b );
+		}
+
+	private:
+		/** The length ratio above which Intersect uses galloping search. */
+		static const size_t GallopRatio = 32;
+
+		static void Accumulate( Overlap & result, float x, float y ) {
+			result.matches++;
+			result.sumProduct += (double) x * y;
+			result.sumMin += std::min( x, y );
+		}
+
+		static Overlap Gallop( const SparseBag & small, const SparseBag & large ) {
+			Overlap result;
+			const uint32_t * lo = large.keys.data();
+			const uint32_t * end = lo + large.keys.size();
+
+			for ( size_t i = 0; i < small.keys.size() && lo < end; i++ ) {
+				uint32_t key = small.keys[i];
+				size_t step = 1;
+
+				while ( lo + step < end && lo[step] < key ) {
+					lo += step;
+					step *= 2;
+				}
+
+				lo = std::lower_bound( lo, std::min( lo + step + 1, end ), key );
+
+				if ( lo < end && *lo == key ) {
+					Accumulate( result, small.weights[i], large.weights[lo - large.keys.data()] );
+					lo++;
+				}
+			}
+
+			return result;
+		}
+
+		static Overlap Merge( const SparseBag & a, const SparseBag & b ) {
+			Overlap result;
+			const size_t m = a.keys.size();
+			const size_t n = b.keys.size();
+			size_t i = 0, j = 0;
+
+#if SPARSE_BAG_SSE2
+			const uint32_t * ak = a.keys.data();
+			const uint32_t * bk = b.keys.data();
+			const float * aw = a.weights.data();
+			const float * bw = b.weights.data();
+
+			__m128d product = _mm_setzero_pd();
+			__m128d least = _mm_setzero_pd();
+			size_t matches = 0;
+
+			while ( i + 4 <= m && j + 4 <= n ) {
+				__m128i va = _mm_loadu_si128( (const __m128i *) (ak + i) );
+				__m128i vb = _mm_loadu_si128( (const __m128i *) (bk + j) );
+				__m128 wa = _mm_loadu_ps( aw + i );
+				__m128 wb = _mm_loadu_ps( bw + j );
+				__m128d waLo = _mm_cvtps_pd( wa );
+				__m128d waHi = _mm_cvtps_pd( _mm_movehl_ps( wa, wa ) );
+
+				for ( int r = 0; r < 4; r++ ) {
+					// Lanes of b weights which match the corresponding a key; zero elsewhere.
+					__m128 eq = _mm_castsi128_ps( _mm_cmpeq_epi32( va, vb ) );
+					__m128 wbm = _mm_and_ps( eq, wb );
+					__m128 mn = _mm_min_ps( wa, wbm );
+
+					matches += PopCount4( _mm_movemask_ps( eq ) );
+					product = _mm_add_pd( product, _mm_mul_pd( waLo, _mm_cvtps_pd( wbm ) ) );
+					product = _mm_add_pd( product, _mm_mul_pd( waHi, _mm_cvtps_pd( _mm_movehl_ps( wbm, wbm ) ) ) );
+					least = _mm_add_pd( least, _mm_cvtps_pd( mn ) );
+					least = _mm_add_pd( least, _mm_cvtps_pd( _mm_movehl_ps( mn, mn ) ) );
+
+					vb = _mm_shuffle_epi32( vb, _MM_SHUFFLE( 0, 3, 2, 1 ) );
+					wb = _mm_shuffle_ps( wb, wb, _MM_SHUFFLE( 0, 3, 2, 1 ) );
+				}
+
+				uint32_t aMax = ak[i + 3];
+				uint32_t bMax = bk[j + 3];
+
+				if ( aMax <= bMax ) i += 4;
+				if ( bMax <= aMax ) j += 4;
+			}
+
+			double p[2], l[2];
+			_mm_storeu_pd( p, product );
+			_mm_storeu_pd( l, least );
+			result.matches = matches;
+			result.sumProduct = p[0] + p[1];
+			result.sumMin = l[0] + l[1];
+#endif
+
+			while ( i < m && j < n ) {
+				uint32_t x = a.keys[i];
+				uint32_t y = b.keys[j];
+
+				if ( x < y ) {
+					i++;
+				}
+				else if ( y < x ) {
+					j++;
+				}
+				else {
+					Accumulate( result, a.weights[i], b.weights[j] );
+					i++;
+					j++;
+				}
+			}
+
+			return result;
+		}
+
+		static size_t PopCount4( int mask ) {
+			return (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+		}
+	};
+}
@@ -162,7 +162,7 @@ namespace QutBio {
 		void Sort() {
 			if ( !isOrdered ) {
 				std::sort( features.begin(), features.end() );
-				std::unique( features.begin(), features.end() );
+				features.erase( std::unique( features.begin(), features.end() ), features.end() );
 				isOrdered = true;
 			}
 		}
@@ -68,6 +68,8 @@ namespace QutBio {
 				const FastaSequence * seq = Lookup( seqId );
 				SparseSignature * sig = new SparseSignature( seq );
 				sigStream >> *sig;
+				signatures.push_back( sig );
+				seqId.clear();
 			}
 
 			return signatures;
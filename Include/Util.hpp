@@ -225,6 +225,26 @@ namespace QutBio {
 			}
 		}
 
+		/**
+		 *	Scope guard which calls Free on a collection of pointers when it goes
+		 *	out of scope, whether normally or because an exception propagates.
+		 */
+		template<typename CollectionType>
+		class FreeOnExit {
+			CollectionType & collection;
+
+		public:
+			FreeOnExit( CollectionType & collection ) : collection( collection ) {}
+
+			FreeOnExit( const FreeOnExit & other ) = delete;
+
+			FreeOnExit & operator=( const FreeOnExit & other ) = delete;
+
+			~FreeOnExit() {
+				Free( collection );
+			}
+		};
+
 		template<typename CollectionType, typename ElementType>
 		static void Fill( CollectionType& collection, ElementType value ) {
 			std::fill( collection.begin(), collection.end(), value );
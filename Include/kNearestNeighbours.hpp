@@ -6,24 +6,51 @@
 #define __cplusplus 201703L
 #endif
 
+#include <algorithm>
+#include <iostream>
+#include <limits>
 #include <vector>
 using namespace std;
 
 namespace QutBio {
+	/**
+	*  Restores the max-heap property (with respect to compare) for the
+	*  subtree rooted at position i of a heap stored in data[0..n-1], after
+	*  the item at i has been replaced by one which is no greater.
+	*  Complexity: O(log n).
+	*/
+	template<typename T, typename Compare>
+	void KnnSiftDown(T * data, size_t n, size_t i, const Compare & compare) {
+		T item = data[i];
+
+		for (;;) {
+			size_t child = 2 * i + 1;
+
+			if (child >= n) break;
+
+			if (child + 1 < n && compare(data[child], data[child + 1])) child++;
+
+			if (!compare(item, data[child])) break;
+
+			data[i] = data[child];
+			i = child;
+		}
+
+		data[i] = item;
+	}
+
 	/**
 	*  <p>
-	*      Uses a fixed-size min heap to implement a k-nearest neighbour
+	*      Uses a fixed-size max heap to implement a k-nearest neighbour
 	*      accumulator.
 	*  </p>
 	*  <p>
-	*      The data is stored in approximately ascending order (the heap
-	*      property) with the greatest value at the back of the list. (Usually,
-	*      a min heap would have the smallest value at the front but the
-	*      greatest value could be some place near, but not necessarily
-	*      at, the back.)
 	*       The object has a fixed maximum capacity K, and is organised so that
-	*       the K nearest neighbours are stored (which is why the largest value
-	*       must be at the back). The items are extracted and sorted into true
+	*       the K nearest neighbours are stored, with the greatest of them at
+	*       the root of the heap. A push costs O(log K): while filling the
+	*       item is sifted up; once full, an item smaller than the root
+	*       replaces it and is sifted down, and anything else is rejected by a
+	*       single comparison. The items are extracted and sorted into true
 	*       ascending order afterwards.
 	*  </p>
 	*/
@@ -31,7 +58,7 @@ namespace QutBio {
 	class KnnHeap {
 	protected:
 		vector<T> heap;
-		const Compare & compare;
+		Compare compare;
 		size_t capacity;
 	public:
 		KnnHeap(size_t capacity = 0, const Compare & compare = Compare()) : compare(compare), capacity(capacity) {
@@ -51,19 +78,22 @@ namespace QutBio {
 			heap.clear();
 		}
 
-		void push(const T & item) {
-			size_t last = heap.size() - 1;
+		/**
+		*	Returns true iff an item would be retained by push.
+		*/
+		bool canPush(const T & item) const {
+			return heap.size() < capacity || (capacity > 0 && compare(item, heap.front()));
+		}
 
-			if (last + 1 == capacity) {
-				if (compare(item, heap[last])) {
-					heap[last] = item;
-				}
-			}
-			else {
+		void push(const T & item) {
+			if (heap.size() < capacity) {
 				heap.push_back(item);
+				push_heap(heap.begin(), heap.end(), compare);
+			}
+			else if (capacity > 0 && compare(item, heap.front())) {
+				heap.front() = item;
+				KnnSiftDown(heap.data(), heap.size(), 0, compare);
 			}
-
-			make_heap(heap.rbegin(), heap.rend(), compare);
 		}
 
 		template<typename Collection>
@@ -73,13 +103,29 @@ namespace QutBio {
 			}
 		}
 
+		/**
+		*	Gets the greatest retained item.
+		*/
 		const T & top() const {
-			return heap.back();
+			return heap.front();
 		}
 
 		void pop() {
+			pop_heap(heap.begin(), heap.end(), compare);
 			heap.pop_back();
-			make_heap(heap.rbegin(), heap.rend(), compare);
+		}
+
+		size_t size() const {
+			return heap.size();
+		}
+
+		/**
+		*	Sorts the retained items into ascending order. This destroys the
+		*	heap property, so it should be the last operation before the
+		*	items are read or the heap is cleared.
+		*/
+		void sort() {
+			sort_heap(heap.begin(), heap.end(), compare);
 		}
 
 		bool empty() {
@@ -113,18 +159,18 @@ namespace QutBio {
 
 	/**
 	*  <p>
-	*      Uses a fixed-size unordered vector to implement a k-nearest neighbours list.
+	*      Uses a fixed-size vector to implement a k-nearest neighbours list.
 	*  </p>
 	*  <p>
 	*       The object has a fixed maximum capacity K, and is organised so that
 	*       the K "smallest" items are stored.
-	*		The data is stored in haphazard order - initially the order in which the first
-	*		K items arrive. The location of the largest item in the collection is saved.
-	*		Once the capacity K is reached, the largest item removed if a smaller item is
-	*		inserted, and the container is scanned once again to update the location of
-	*		the largest.
+	*		The records are kept as a max heap on distance, so the record to be
+	*		ejected is always at position ejectPos = 0, and ejectDistance is its
+	*		distance. Once the capacity K is reached, an item with a smaller
+	*		distance replaces the largest and is sifted down in O(log K) steps;
+	*		any other item is rejected by canPush with a single comparison.
 	*		The collection can be sorted into true ascending order at any time by calling
-	*		Sort.
+	*		Sort; the heap is rebuilt if further items are pushed afterwards.
 	*  </p>
 	*/
 	template<typename ElementType, typename Distance>
@@ -135,6 +181,11 @@ namespace QutBio {
 		Distance minDistance;
 		Distance ejectDistance = numeric_limits<Distance>::min();
 		size_t ejectPos = 0;
+		bool sorted = false;
+
+		static bool RecordLess(const Record & lhs, const Record & rhs) {
+			return lhs.first < rhs.first;
+		}
 
 		KnnVector(size_t capacity, Distance minDistance) : capacity(capacity), minDistance(minDistance), ejectDistance(minDistance) {
 			elements.reserve(capacity);
@@ -153,36 +204,36 @@ namespace QutBio {
 			elements.clear();
 			ejectPos = 0;
 			ejectDistance = minDistance;
+			sorted = false;
 		}
 
-		bool canPush(const Distance & distance) {
+		bool canPush(const Distance & distance) const {
 			return elements.size() < capacity || distance < ejectDistance;
 		}
 
+		/**
+		*	Gets the distance an item must beat to enter a full list.
+		*/
+		const Distance & threshold() const {
+			return ejectDistance;
+		}
+
 		void push(const ElementType & item, const Distance & distance) {
-			if (elements.size() < capacity) {
-				if (distance > ejectDistance) {
-					ejectDistance = distance;
-					ejectPos = elements.size();
-				}
+			if (sorted) {
+				make_heap(elements.begin(), elements.end(), RecordLess);
+				sorted = false;
+			}
 
+			if (elements.size() < capacity) {
 				elements.emplace_back(distance, item);
+				push_heap(elements.begin(), elements.end(), RecordLess);
+				ejectDistance = elements.front().first;
 			}
 			else if (distance < ejectDistance) {
-				elements[ejectPos].first = distance;
-				elements[ejectPos].second = item;
-
-				ejectPos = 0;
-				ejectDistance = elements[0].first;
-
-				for (uint i = 1; i < capacity; i++) {
-					Distance d = elements[i].first;
-
-					if (d > ejectDistance) {
-						ejectPos = i;
-						ejectDistance = d;
-					}
-				}
+				elements.front().first = distance;
+				elements.front().second = item;
+				KnnSiftDown(elements.data(), elements.size(), 0, RecordLess);
+				ejectDistance = elements.front().first;
 			}
 		}
 
@@ -191,11 +242,8 @@ namespace QutBio {
 		}
 
 		void sort() {
-			std::sort( elements.begin(), elements.end(), 
-				[] ( const Record & lhs, const Record & rhs ) {
-					return lhs.first < rhs.first;
-				}
-			);
+			std::sort( elements.begin(), elements.end(), RecordLess );
+			sorted = true;
 		}
 
 		typedef typename std::vector<Record>::iterator iterator;
@@ -222,4 +270,94 @@ namespace QutBio {
 			return out;
 		}
 	};
+
+	/**
+	*  <p>
+	*      Batch alternative to KnnVector, with the same interface.
+	*  </p>
+	*  <p>
+	*       Items are appended to a buffer of up to 2K records without any
+	*       ordering work. When the buffer fills, nth_element selects the K
+	*       smallest in O(K) time, the rest are discarded, and the K-th
+	*       distance becomes the rejection threshold for later pushes. Sort
+	*       performs a final select and sorts the K survivors. This wins over
+	*       a heap when most candidates pass the threshold test, e.g. early in
+	*       a query or when K is large.
+	*  </p>
+	*/
+	template<typename ElementType, typename Distance>
+	struct KnnBuffer {
+		using Record = pair<Distance, ElementType>;
+		vector<Record> elements;
+		size_t capacity;
+		Distance minDistance;
+		Distance ejectDistance;
+		bool full = false;
+
+		KnnBuffer(size_t capacity, Distance minDistance) : capacity(capacity), minDistance(minDistance), ejectDistance(minDistance) {
+			elements.reserve(2 * capacity);
+		}
+
+		void setCapacity(size_t capacity) {
+			this->capacity = capacity;
+			elements.reserve(2 * capacity);
+		}
+
+		size_t getCapacity() {
+			return capacity;
+		}
+
+		void clear() {
+			elements.clear();
+			ejectDistance = minDistance;
+			full = false;
+		}
+
+		bool canPush(const Distance & distance) const {
+			return !full || distance < ejectDistance;
+		}
+
+		const Distance & threshold() const {
+			return ejectDistance;
+		}
+
+		void push(const ElementType & item, const Distance & distance) {
+			if (!canPush(distance) || capacity == 0) return;
+
+			if (elements.size() >= 2 * capacity) {
+				select();
+			}
+
+			elements.emplace_back(distance, item);
+		}
+
+		bool empty() {
+			return elements.empty();
+		}
+
+		void sort() {
+			select();
+			std::sort(elements.begin(), elements.end(), KnnVector<ElementType, Distance>::RecordLess);
+		}
+
+		typedef typename std::vector<Record>::iterator iterator;
+
+		iterator begin() {
+			return elements.begin();
+		}
+
+		iterator end() {
+			return elements.end();
+		}
+
+	private:
+		void select() {
+			if (elements.size() < capacity) return;
+
+			nth_element(elements.begin(), elements.begin() + (capacity - 1), elements.end(), KnnVector<ElementType, Distance>::RecordLess);
+			ejectDistance = elements[capacity - 1].first;
+			elements.resize(capacity);
+			full = true;
+		}
+	};
 }
@@ -11,6 +11,9 @@
 #include "KmerClusterPrototype.hpp"
 #include "FileUtil.hpp"
 #include "DataLoader.hpp"
+#include "EncodedDatabase.hpp"
+#include "BinaryCodebook.hpp"
+#include "FrozenKmerIndex.hpp"
 
 #include <bitset>
 #include <cstdio>
@@ -49,14 +52,24 @@ public:
 
 		OMP_TIMER_START(loadTime);
 
-		auto dbSeqs = Load::Fasta(p.fastaFile, p.idIndex, alphabet);
-		auto db = Load::Encoded(dbSeqs, -1, alphabet, p.wordLength,
+		EncodedDatabase database(p.fastaFile, p.encodedCache, p.idIndex, -1, alphabet, p.wordLength,
 			distanceFunction.CharsPerWord(), alphabet->DefaultSymbol());
+		auto & db = database.Sequences();
 
 		cerr << "AAClust: " << db.size() << " sequences loaded.\n";
 
-		KmerIndex kmerIndex(db, p.wordLength);
-		vector<Kmer *> allKmers = kmerIndex.GetKmers();
+		unique_ptr<KmerIndex> kmerIndex;
+		unique_ptr<FrozenKmerIndex> compactIndex;
+		vector<Kmer *> allKmers;
+
+		if (p.compactIndex) {
+			compactIndex.reset(new FrozenKmerIndex(db, p.wordLength, alphabet));
+			allKmers = compactIndex->GetKmers();
+		}
+		else {
+			kmerIndex.reset(new KmerIndex(db, p.wordLength));
+			allKmers = kmerIndex->GetKmers();
+		}
 
 		OMP_TIMER_END(loadTime);
 		OMP_TIMER_START(clusterTime);
@@ -97,11 +110,18 @@ public:
 
 		ofstream protoOut(p.protoOut);
 		ofstream clusterOut(p.clusterOut);
+		unique_ptr<BinaryCodebook::Writer> clusterBin;
+
+		if (p.clusterBin.size() > 0) {
+			clusterBin.reset(new BinaryCodebook::Writer(p.clusterBin, p.wordLength, distanceFunction.CharsPerWord()));
+		}
 
 		auto saveData = [&](KmerClusterPrototype *proto, Cluster *cluster) {
 			if (cluster->kmers.size() > 0) {
 				protoOut << proto;
 				clusterOut << *cluster;
+
+				if (clusterBin) clusterBin->Add(*cluster);
 			}
 		};
 
@@ -117,17 +137,33 @@ public:
 			saveData
 		};
 
-		Cluster::DoExhaustiveIncrementalClustering(
-			allKmers,
-			p.wordLength,
-			p.threshold,
-			alphabet->Size(),
-			distanceFunction,
-			rand,
-			p.increment,
-			createPrototype,
-			process
-		);
+		if (p.parallelSeeding) {
+			Cluster::DoParallelIncrementalClustering(
+				allKmers,
+				p.wordLength,
+				p.threshold,
+				distanceFunction,
+				rand,
+				p.increment,
+				createPrototype,
+				process
+			);
+		}
+		else {
+			Cluster::DoExhaustiveIncrementalClustering(
+				allKmers,
+				p.wordLength,
+				p.threshold,
+				alphabet->Size(),
+				distanceFunction,
+				rand,
+				p.increment,
+				createPrototype,
+				process
+			);
+		}
+
+		if (clusterBin) clusterBin->Close();
 
 		OMP_TIMER_END(clusterTime);
 
@@ -149,11 +185,15 @@ public:
 		int  seed;
 		int idIndex;
 		string clusterOut;
+		string clusterBin;
 		Alphabet * alphabet;
 		SimilarityMatrix * matrix;
 		string homologFile;
+		string encodedCache;
 		bool computeDistances = false;
 		size_t increment = 1000;
+		bool parallelSeeding = false;
+		bool compactIndex = false;
 
 		Params() {
 			arguments->Required(protoOut, "protoOut",
@@ -174,6 +214,11 @@ public:
 			arguments->Required(clusterOut, "clusterOut",
 				"The name a file that will be overwritten with cluster k-mer definitions.");
 
+			arguments->Optional(clusterBin, "clusterBin",
+				"The name of a file that will be overwritten with a binary copy of the cluster \n"
+				"k-mer definitions, which can be loaded in place of clusterOut without parsing. \n"
+				"Omit to write only the text file.");
+
 			arguments->Required(alphabet, matrix);
 
 			arguments->Optional(numThreads, "numThreads", "The number of OpenMP threads to use in parallel regions.");
@@ -193,6 +238,24 @@ public:
 				"The number of random kmers to select on each round to become prototypes."
 			);
 
+			arguments->Optional(parallelSeeding, "parallelSeeding",
+				"If true, each round seeds prototypes from the next 'increment' unassigned kmers, \n"
+				"skipping any that lie within threshold of an earlier seed, and assigns kmers in \n"
+				"parallel. The result does not depend on numThreads. (true|false)."
+			);
+
+			arguments->Optional(compactIndex, "compactIndex",
+				"If true, index kmers by packed integer code with flat instance storage, built \n"
+				"in parallel. This uses less memory and time than the default index, but visits \n"
+				"kmers in a different order, so the clusters differ from the default. Requires \n"
+				"alphabetSize^wordLength <= 2^64. (true|false)."
+			);
+
+			arguments->Optional(encodedCache, "encodedCache",
+				"The name of a cache file for the encoded dataset. If the file was built from the \n"
+				"same FASTA file with the same encoding parameters it is mapped, otherwise it is \n"
+				"(re)written. Omit to disable caching.");
+
 			arguments->Help();
 
 			if (!arguments->Ok()) {
@@ -213,8 +276,12 @@ public:
 				<< "--seed '" << p.seed << "' \\\n"
 				<< "--idIndex '" << p.idIndex << "' \\\n"
 				<< "--clusterOut '" << p.clusterOut << "' \\\n"
+				<< "--clusterBin '" << p.clusterBin << "' \\\n"
 				<< "--matrix '" << p.matrix << "' \\\n"
 				<< "--homologFile '" << p.homologFile << "' \\\n"
+				<< "--encodedCache '" << p.encodedCache << "' \\\n"
+				<< "--parallelSeeding '" << p.parallelSeeding << "' \\\n"
+				<< "--compactIndex '" << p.compactIndex << "' \\\n"
 				<< "--increment '" << p.increment << "'\n";
 
 			return str;
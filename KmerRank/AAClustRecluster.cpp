@@ -6,6 +6,7 @@
 #include "KmerCodebook.hpp"
 #include "KmerDistanceCache.hpp"
 #include "Edge.hpp"
+#include "EncodedDatabase.hpp"
 #include "FastaSequence.hpp"
 #include "Random.hpp"
 #include "Kmer.hpp"
@@ -41,6 +42,7 @@ public:
 		string seqFile;
 		string protoFile;
 		string outFile;
+		string encodedCache;
 		size_t numThreads = 7;
 		size_t wordLength = 0;
 		int idIndex = 0;
@@ -92,6 +94,11 @@ public:
 				"In k-means mode, the clusters are all built concurrently, and nothing \n"
 				"(true|false).");
 
+			OPT(encodedCache,
+				"The name of a cache file for the encoded sequences. If the file was built from \n"
+				"the same seqFile with the same encoding parameters it is mapped, otherwise it is \n"
+				"(re)written. Omit to disable caching.");
+
 			string assignMode = "all";
 
 			OPT(assignMode,
@@ -116,7 +123,7 @@ public:
 				arguments->Fail();
 			}
 
-			if (outFile == seqFile || outFile == protoFile) {
+			if (outFile == seqFile || outFile == protoFile || outFile == encodedCache) {
 				cerr << arguments->ProgName() << ": Output file " << outFile << " will overwrite one of your input files.\n";
 				ok = false;
 			}
@@ -142,8 +149,8 @@ public:
 
 		omp_set_num_threads(p.numThreads);
 
-		auto dbSeqs = Load::Fasta(p.seqFile, p.idIndex, alphabet);
-		auto db = Load::Encoded(dbSeqs, -1, alphabet, p.wordLength, distanceFunction.CharsPerWord(), alphabet->DefaultSymbol());
+		EncodedDatabase database(p.seqFile, p.encodedCache, p.idIndex, -1, alphabet, p.wordLength, distanceFunction.CharsPerWord(), alphabet->DefaultSymbol());
+		auto & db = database.Sequences();
 		cerr << arguments->ProgName() << ": " << db.size() << " sequences loaded.\n";
 
 		auto protoSeqs = Load::Fasta(p.protoFile, 0, alphabet);
@@ -176,8 +183,6 @@ public:
 		cerr << "Database encoded in " << OMP_TIMER(encodeDb) << "s.\n";
 		Util::Free(protos);
 		Util::Free(protoSeqs);
-		Util::Free(db);
-		Util::Free(dbSeqs);
 
 		// SaveSignatures(db, parms.outFile);
 		return 0;
@@ -204,6 +209,7 @@ public:
 #endif
 		{
 			vector<vector<pair<size_t, Distance>>> allocated(C);
+			vector<uint> wordOrder;
 
 			for (auto & a : allocated) {
 				a.reserve((kmers.size() + C - 1) / C);
@@ -217,14 +223,17 @@ public:
 				size_t nearestClusterIdx;
 
 				EncodedKmer kmerCode = kmers[i]->PackedEncoding();
+				distanceFunction.GetWordOrder(kmerCode, K, wordOrder);
 
 				for (uint c = 0; c < C; c++) {
 					auto proto = protos[c];
 					EncodedKmer centroidCode = proto->SingletonKmer()->PackedEncoding();
 
-					auto dist = distanceFunction(centroidCode, kmerCode, K);
+					// Only a strictly nearer prototype displaces the current one.
+					Distance bound = minDist <= threshold ? minDist - 1 : threshold;
+					Distance dist;
 
-					if (dist <= threshold && dist < minDist) {
+					if (distanceFunction.IsWithin(kmerCode, centroidCode, K, wordOrder.data(), bound, dist)) {
 						nearestClusterIdx = c;
 						minDist = dist;
 					}
@@ -272,16 +281,17 @@ public:
 		for (uint c = 0; c < C; c++) {
 			auto & proto = *protos[c];
 			EncodedKmer centroidCode = proto.SingletonKmer()->PackedEncoding();
+			vector<uint> wordOrder;
+			distanceFunction.GetWordOrder(centroidCode, K, wordOrder);
 
 			Cluster cluster(proto.SingletonKmer(), 0, distanceFunction);
 
 			for (auto & kvp : kmers) {
 				auto kmer = kvp.second;
 				EncodedKmer kmerCode = kmer->PackedEncoding();
+				Distance dist;
 
-				auto dist = distanceFunction(centroidCode, kmerCode, K);
-
-				if (dist <= threshold) {
+				if (distanceFunction.IsWithin(centroidCode, kmerCode, K, wordOrder.data(), threshold, dist)) {
 					cluster.Add(kmer, dist);
 				}
 			}
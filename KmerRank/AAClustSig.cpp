@@ -14,11 +14,15 @@
 #include "OmpTimer.h"
 #include "BitSet.hpp"
 #include "kNearestNeighbours.hpp"
+#include "RankingFile.hpp"
 #include "Ranking.hpp"
 #include "SparseSignature.hpp"
+#include "SignatureDatabase.hpp"
+#include "PostingIndex.hpp"
 #include <cstdio>
 #include <stdlib.h>
 #include <omp.h>
+#include <memory>
 #include <set>
 #include <vector>
 #ifndef _GNU_SOURCE
@@ -42,6 +46,8 @@ public:
 	using pCluster = Cluster * ;
 	using Signature = SparseSignature;
 
+	struct Params;
+
 	static int Run() {
 		Params parms;
 
@@ -53,29 +59,311 @@ public:
 			omp_set_num_threads(parms.numThreads);
 		}
 
-		auto querySigs = Signature::Read(parms.querySigs);
-		auto dbSigs = Signature::Read(parms.dbSigs);
-		vector<vector<uint>> dbIndex;
-		Signature::CreatePostingList(dbSigs, dbIndex);
+		// Signatures need only carry an ID, so there is no FASTA file to
+		// consult. Stand-in sequences are created on demand.
+		vector<FastaSequence *> stubs;
 
-		cerr << querySigs.size() << " query signatures loaded from '" << parms.querySigs << "'\n";
-		cerr << dbSigs.size() << " query signatures loaded from '" << parms.dbSigs << "'\n";
+		Signature::Lookup = [&stubs](const string & seqId) {
+			auto seq = new FastaSequence(seqId, "", 0, Alphabets::DEFAULT());
+			stubs.push_back(seq);
+			return seq;
+		};
 
-		//for (auto & qs : querySigs) {
-		//	cerr << "qs.indices.size() = " << qs->indices.size() << "\n";
-		//}
+		auto querySigs = LoadSignatures(parms.querySigs);
+
+		cerr << querySigs.size() << " query signatures loaded from '" << parms.querySigs << "'\n";
 
 		OMP_TIMER_DECLARE(rank);
-		OMP_TIMER_START(rank);
-		RankMerge(querySigs, dbSigs, dbIndex, parms.maxResults, parms.outFile);
-		OMP_TIMER_END(rank);
+
+		if (SignatureDatabase::IsBinary(parms.dbSigs)) {
+			SignatureDatabase db(parms.dbSigs);
+
+			cerr << db.Size() << " db signatures mapped from '" << parms.dbSigs << "'\n";
+
+			if (parms.UseIndex()) {
+				OMP_TIMER_START(rank);
+				RankIndexed(querySigs, db.Size(),
+					[&db](PostingIndex &index, bool impactOrder, double stopFraction) {
+						index.BuildFromPostings(db.Size(), db.FeatureCount(),
+							[&db](size_t d) { return db.Cardinality(d); },
+							[&db](size_t f, vector<uint> &docs) { db.GetPostings(f, docs); },
+							impactOrder, stopFraction);
+					},
+					[&db](size_t d) { return db.Id(d); },
+					parms);
+				OMP_TIMER_END(rank);
+			}
+			else {
+				OMP_TIMER_START(rank);
+				RankMerge(querySigs, db, parms.maxResults, parms.outFile);
+				OMP_TIMER_END(rank);
+			}
+		}
+		else {
+			auto dbSigs = Signature::Read(parms.dbSigs);
+
+			cerr << dbSigs.size() << " db signatures loaded from '" << parms.dbSigs << "'\n";
+
+			if (parms.UseIndex()) {
+				uint F = 0;
+
+				for (auto sig : dbSigs) {
+					if (sig->Size() > 0 && sig->Max() >= F) F = sig->Max() + 1;
+				}
+
+				OMP_TIMER_START(rank);
+				RankIndexed(querySigs, dbSigs.size(),
+					[&dbSigs, F](PostingIndex &index, bool impactOrder, double stopFraction) {
+						index.Build(dbSigs.size(), F,
+							[&dbSigs](size_t d, vector<uint> &features) { features.assign(dbSigs[d]->begin(), dbSigs[d]->end()); },
+							impactOrder, stopFraction);
+					},
+					[&dbSigs](size_t d) { return dbSigs[d]->Sequence()->IdStr(); },
+					parms);
+				OMP_TIMER_END(rank);
+			}
+			else {
+				vector<vector<uint>> dbIndex;
+				Signature::CreatePostingList(dbSigs, dbIndex);
+
+				OMP_TIMER_START(rank);
+				RankMerge(querySigs, dbSigs, dbIndex, parms.maxResults, parms.outFile);
+				OMP_TIMER_END(rank);
+			}
+
+			for (auto sig : dbSigs) delete sig;
+		}
 
 		for (auto sig : querySigs) delete sig;
-		for (auto sig : dbSigs) delete sig;
+		Util::Free(stubs);
 
 		return 0;
 	}
 
+	/**
+	 *	Loads signatures from either a text signature file or a binary
+	 *	signature database.
+	 */
+	static vector<Signature *> LoadSignatures(string &sigFile) {
+		if (!SignatureDatabase::IsBinary(sigFile)) {
+			return Signature::Read(sigFile);
+		}
+
+		SignatureDatabase db(sigFile);
+		vector<Signature *> sigs;
+		vector<uint> features;
+
+		for (size_t d = 0; d < db.Size(); d++) {
+			auto sig = new Signature(Signature::Lookup(db.Id(d)));
+			db.GetFeatures(d, features);
+			sig->Reserve(features.size());
+
+			for (auto f : features) sig->Add(f);
+
+			sigs.push_back(sig);
+		}
+
+		return sigs;
+	}
+
+	/**
+	 *	Ranks a database through a block-compressed posting index. By default,
+	 *	overlap counts are accumulated per document rather than intersecting
+	 *	signatures pairwise. If parms.prune is set, MaxScore dynamic pruning
+	 *	skips documents which cannot enter the top-k. The index may also be
+	 *	impact-ordered and stop-listed, and long lists capped or deferred at
+	 *	query time, which gives approximate rankings. If parms.verify is set,
+	 *	each query is also ranked exhaustively against a complete index, and
+	 *	the recall and time of both methods are reported.
+	 *	@param D The number of database signatures.
+	 *	@param buildIndex Function which builds a PostingIndex over the database,
+	 *		given the impactOrder and stopFraction arguments of PostingIndex::Build.
+	 *	@param dbId Function which returns the sequence ID of signature d.
+	 */
+	template<typename BuildIndex, typename IdFunction>
+	static void RankIndexed(
+		const vector<Signature *> &queries,
+		size_t D,
+		BuildIndex buildIndex,
+		IdFunction dbId,
+		Params &parms //
+	) {
+		PostingIndex index;
+		buildIndex(index, parms.impactOrder, parms.stopFraction);
+
+		cerr << "Posting index occupies " << index.Bytes() << " bytes; "
+			<< index.StoppedCount() << " features stop-listed.\n";
+
+		PostingIndex complete;
+
+		if (parms.verify && index.StoppedCount() > 0) {
+			buildIndex(complete, false, 1.0);
+		}
+
+		const PostingIndex &reference = index.StoppedCount() > 0 ? complete : index;
+
+		uint Q = queries.size();
+		uint maxResults = parms.maxResults;
+		RankingWriter writer(parms.outFile);
+		size_t nominated = 0, scored = 0, mismatches = 0, expected = 0, found = 0;
+		double rankTime = 0, verifyTime = 0;
+
+#if USE_OMP
+#pragma omp parallel reduction(+:nominated,scored,mismatches,expected,found,rankTime,verifyTime)
+#endif
+		{
+			KnnVector<size_t, double> rankings(maxResults, -HUGE_VAL);
+			KnnVector<size_t, double> exhaustive(maxResults, -HUGE_VAL);
+			ostringstream buffer;
+			JaccardMaxScore maxScore(index);
+			vector<size_t> exact;
+
+			// Each accumulator holds a count for every document, so only those in use are created.
+			unique_ptr<JaccardAccumulator> accumulator;
+			unique_ptr<JaccardAccumulator> referenceAccumulator;
+
+			if (!parms.prune) {
+				accumulator.reset(new JaccardAccumulator(index));
+				accumulator->maxPostings = parms.maxPostings;
+				accumulator->deferPostings = parms.deferPostings;
+			}
+
+			if (parms.verify) {
+				referenceAccumulator.reset(new JaccardAccumulator(reference));
+			}
+
+			auto accumulate = [](JaccardAccumulator &accumulator, const Signature &query, KnnVector<size_t, double> &rankings) {
+				rankings.clear();
+
+				accumulator.Score(query, [&rankings](uint d, double similarity) {
+					double distance = 1.0 - similarity;
+
+					if (rankings.canPush(distance)) {
+						rankings.push(d, distance);
+					}
+				});
+
+				rankings.sort();
+			};
+
+#if USE_OMP
+#pragma omp for schedule(dynamic)
+#endif
+			for (uint q = 0; q < Q; q++) {
+				double start = omp_get_wtime();
+
+				if (parms.prune) {
+					rankings.clear();
+					maxScore.Rank(*queries[q], rankings);
+					rankings.sort();
+				}
+				else {
+					accumulate(*accumulator, *queries[q], rankings);
+				}
+
+				rankTime += omp_get_wtime() - start;
+
+				if (parms.verify) {
+					start = omp_get_wtime();
+					accumulate(*referenceAccumulator, *queries[q], exhaustive);
+					verifyTime += omp_get_wtime() - start;
+
+					bool same = rankings.elements.size() == exhaustive.elements.size();
+
+					for (size_t i = 0; same && i < rankings.elements.size(); i++) {
+						same = rankings.elements[i].first == exhaustive.elements[i].first;
+					}
+
+					if (!same) mismatches++;
+
+					exact.clear();
+
+					for (auto &r : exhaustive) exact.push_back(r.second);
+
+					std::sort(exact.begin(), exact.end());
+					expected += exact.size();
+
+					for (auto &r : rankings) {
+						if (std::binary_search(exact.begin(), exact.end(), r.second)) found++;
+					}
+				}
+
+				writer.Submit(q, queries[q]->Sequence()->IdStr(), rankings, dbId, buffer);
+			}
+
+			nominated += maxScore.nominated;
+			scored += maxScore.scored;
+		}
+
+		writer.Close(Q, [&queries](size_t q) -> const string & { return queries[q]->Sequence()->IdStr(); }, D, dbId);
+
+		if (parms.prune) {
+			cerr << "MaxScore: " << nominated << " candidates nominated, " << scored << " fully scored.\n";
+		}
+
+		if (parms.verify) {
+			cerr << "Verification: " << mismatches << " of " << Q << " queries differ from exhaustive ranking.\n";
+			cerr << "Verification: recall = " << (expected == 0 ? 1.0 : (double) found / expected)
+				<< "; ranking time = " << rankTime << "s; exhaustive time = " << verifyTime
+				<< "s (summed over threads).\n";
+		}
+	}
+
+	/**
+	 *	Ranks a memory-mapped signature database, using the prebuilt posting
+	 *	lists in place.
+	 */
+	static void RankMerge(
+		const vector<Signature *> &queries,
+		const SignatureDatabase &database,
+		uint maxResults,
+		string &outFile //
+	) {
+		uint Q = queries.size();
+		RankingWriter writer(outFile);
+		auto subjectId = [&database](size_t d) { return database.Id(d); };
+
+#if USE_OMP
+#pragma omp parallel
+#endif
+		{
+			KnnVector<size_t, double> rankings(maxResults, -HUGE_VAL);
+			ostringstream buffer;
+			BitSet processed(database.Size());
+			vector<uint> queryFeatures, postings, scratch;
+
+#if USE_OMP
+#pragma omp for schedule(dynamic)
+#endif
+			for (uint q = 0; q < Q; q++) {
+				rankings.clear();
+				processed.Clear();
+				queryFeatures.assign(queries[q]->begin(), queries[q]->end());
+
+				for (uint c : queryFeatures) {
+					database.GetPostings(c, postings);
+
+					for (uint d : postings) {
+						if (!processed.Contains(d)) {
+							processed.Insert(d);
+							double distance = 1.0 - database.Similarity(queryFeatures, d, scratch);
+
+							if (rankings.canPush(distance)) {
+								rankings.push(d, distance);
+							}
+						}
+					}
+				}
+
+				rankings.sort();
+
+				writer.Submit(q, queries[q]->Sequence()->IdStr(), rankings, subjectId, buffer);
+			}
+		}
+
+		writer.Close(Q, [&queries](size_t q) -> const string & { return queries[q]->Sequence()->IdStr(); }, database.Size(), subjectId);
+	}
+
 	static void RankMerge(
 		const vector<Signature *> &queries,
 		const vector<Signature *> &database,
@@ -90,7 +378,8 @@ public:
 #define INTERLEAVE 1
 
 #if INTERLEAVE
-		ofstream out(outFile);
+		RankingWriter writer(outFile);
+		auto subjectId = [&database](size_t d) -> const string & { return database[d]->Sequence()->IdStr(); };
 #else
 		KnnVector<size_t, double> exemplar(maxResults);
 		vector<KnnVector<size_t, double>> allRankings(Q, exemplar);
@@ -102,7 +391,8 @@ public:
 		{
 
 #if INTERLEAVE
-			KnnVector<size_t, double> rankings(maxResults, HUGE_VAL);
+			KnnVector<size_t, double> rankings(maxResults, -HUGE_VAL);
+			ostringstream buffer;
 #endif
 			BitSet processed(database.size());
 
@@ -138,23 +428,14 @@ public:
 				rankings.sort();
 
 #if INTERLEAVE
-#if USE_OMP
-#pragma omp critical
-#endif
-				{
-					out << queries[q]->Sequence()->IdStr();
-
-					for (auto & ranking : rankings) {
-						out << " " << database[ranking.second]->Sequence()->IdStr() << " " << (-ranking.first);
-					}
-
-					out << " ___eol___ -100000\n";
-				}
+				writer.Submit(q, queries[q]->Sequence()->IdStr(), rankings, subjectId, buffer);
 #endif
 			}
 
 		}
-#if ! INTERLEAVE
+#if INTERLEAVE
+		writer.Close(Q, [&queries](size_t q) -> const string & { return queries[q]->Sequence()->IdStr(); }, database.size(), subjectId);
+#else
 		{
 			ofstream out(outFile);
 
@@ -179,6 +460,17 @@ public:
 		size_t numThreads = 8;
 		bool ok = true;
 		uint maxResults = 1000;
+		bool accumulate = false;
+		bool prune = false;
+		bool verify = false;
+		bool impactOrder = false;
+		double stopFraction = 1.0;
+		size_t maxPostings = 0;
+		size_t deferPostings = 0;
+
+		bool UseIndex() const {
+			return accumulate || prune || impactOrder || stopFraction < 1.0 || maxPostings > 0 || deferPostings > 0;
+		}
 
 		Params() {
 
@@ -193,17 +485,53 @@ public:
 "--help       Gets this text.",
 "",
 "--dbSigs     Required. The name of the file which contains signatures for the ",
-"             reference sequences.",
+"             reference sequences. This may be either a text signature file ",
+"             or a binary signature database created by AAClustSigConvert. ",
+"             A binary database is memory-mapped and used without parsing.",
 "",
 "--querySigs  Required. The name of the file which contains signatures for the ",
-"             query sequences.",
+"             query sequences (text or binary).",
 "",
 "--outFile    Required. The name of the output file. This will be a CSV ",
 "             document with records containing two fields: the prototype ",
-"             sequence ID and information gain.",
+"             sequence ID and information gain. If the name ends with ",
+"             '.rnkb', rankings are written in binary format for the ",
+"             trec_eval tools.",
 "",
 "--numThreads Optional; default value = '# cores'. The number of OpenMP ",
 "             threads to use in parallel regions.",
+"",
+"--accumulate Optional; default value = false. If true, the database is held ",
+"             in a block-compressed posting index and similarities are ",
+"             computed from overlap counts accumulated while scanning the ",
+"             posting lists, instead of intersecting each candidate ",
+"             signature with the query.",
+"",
+"--prune      Optional; default value = false. If true, use MaxScore dynamic ",
+"             pruning over the posting index to skip database signatures ",
+"             which cannot enter the top --maxResults. Implies --accumulate.",
+"",
+"--verify     Optional; default value = false. If true, each query is also ",
+"             ranked exhaustively against a complete posting index. The ",
+"             number of queries whose ranking differs, the recall of the ",
+"             top --maxResults, and the time taken by each method are ",
+"             reported.",
+"",
+"--impactOrder Optional; default value = false. If true, database signatures ",
+"             are renumbered within the posting index in ascending order of ",
+"             cardinality, so that every posting list is ordered by impact.",
+"",
+"--stopFraction Optional; default value = 1. Features which occur in more than ",
+"             this fraction of database signatures are stop-listed.",
+"",
+"--maxPostings Optional; default value = 0 (no limit). Posting lists are ",
+"             processed rarest first, and at most this many entries of a ",
+"             longer list are scanned. Combine with --impactOrder so that ",
+"             the highest-impact entries are retained. Ignored by --prune.",
+"",
+"--deferPostings Optional; default value = 0 (no limit). Posting lists longer ",
+"             than this nominate no candidates; they are only probed for ",
+"             signatures found in shorter lists. Ignored by --prune.",
 "",
 				};
 
@@ -239,6 +567,41 @@ public:
 					<< maxResults << ".\n";
 			}
 
+			if (arguments->IsDefined("accumulate") && !arguments->Get("accumulate", accumulate)) {
+				cerr << arguments->ProgName() << ": Error - invalid boolean data for argument '--accumulate'.\n";
+				ok = false;
+			}
+
+			if (arguments->IsDefined("prune") && !arguments->Get("prune", prune)) {
+				cerr << arguments->ProgName() << ": Error - invalid boolean data for argument '--prune'.\n";
+				ok = false;
+			}
+
+			if (arguments->IsDefined("verify") && !arguments->Get("verify", verify)) {
+				cerr << arguments->ProgName() << ": Error - invalid boolean data for argument '--verify'.\n";
+				ok = false;
+			}
+
+			if (arguments->IsDefined("impactOrder") && !arguments->Get("impactOrder", impactOrder)) {
+				cerr << arguments->ProgName() << ": Error - invalid boolean data for argument '--impactOrder'.\n";
+				ok = false;
+			}
+
+			if (arguments->IsDefined("stopFraction") && !(arguments->Get("stopFraction", stopFraction) && stopFraction > 0)) {
+				cerr << arguments->ProgName() << ": Error - argument '--stopFraction' must be a positive number.\n";
+				ok = false;
+			}
+
+			if (arguments->IsDefined("maxPostings") && !arguments->Get("maxPostings", maxPostings)) {
+				cerr << arguments->ProgName() << ": Error - invalid integer data for argument '--maxPostings'.\n";
+				ok = false;
+			}
+
+			if (arguments->IsDefined("deferPostings") && !arguments->Get("deferPostings", deferPostings)) {
+				cerr << arguments->ProgName() << ": Error - invalid integer data for argument '--deferPostings'.\n";
+				ok = false;
+			}
+
 			if (outFile == dbSigs || outFile == querySigs) {
 				cerr << arguments->ProgName() << ": Output file " << outFile << " will overwrite one of your input files.\n";
 				ok = false;
@@ -0,0 +1,101 @@
+#include "Args.hpp"
+#include "Exception.hpp"
+#include "SignatureDatabase.hpp"
+#include <cstdio>
+#include <stdlib.h>
+#include <omp.h>
+#include <vector>
+
+using namespace QutBio;
+using namespace std;
+
+// Singletons.
+Args *arguments;
+
+struct AAClustSigConvert {
+public:
+	static int Run() {
+		Params parms;
+
+		if (!parms.ok) {
+			return 1;
+		}
+
+		size_t N = SignatureDatabase::Convert(parms.inFile, parms.outFile);
+
+		SignatureDatabase db(parms.outFile);
+
+		cerr << arguments->ProgName() << ": " << N << " signatures converted from '" << parms.inFile
+			<< "' to '" << parms.outFile << "'.\n";
+		cerr << arguments->ProgName() << ": " << db.FeatureCount() << " features indexed.\n";
+
+		return 0;
+	}
+
+	struct Params {
+	public:
+		string inFile;
+		string outFile;
+		bool ok = true;
+
+		Params() {
+
+			if (arguments->IsDefined("help")) {
+				vector<string> text{
+"AAClustSigConvert: Converts a text signature file produced by AAClustSigEncode",
+"             to a compact binary signature database. The binary database holds",
+"             delta-coded signatures and prebuilt posting lists, and is memory-",
+"             mapped by AAClustSig so that no parsing or indexing is required ",
+"             at startup.",
+"",
+"--help       Gets this text.",
+"",
+"--inFile     Required. The name of a text signature file.",
+"",
+"--outFile    Required. The name of the binary signature database which will ",
+"             be created.",
+"",
+				};
+
+				for (auto s : text) {
+					cerr << s << "\n";
+				}
+			}
+
+			if (!arguments->Get("inFile", inFile)) {
+				cerr << arguments->ProgName() << ": error - required argument '--inFile' not set.\n";
+				ok = false;
+			}
+
+			if (!arguments->Get("outFile", outFile)) {
+				cerr << arguments->ProgName() << ": error - required argument '--outFile' not set.\n";
+				ok = false;
+			}
+
+			if (outFile == inFile) {
+				cerr << arguments->ProgName() << ": Output file " << outFile << " will overwrite your input file.\n";
+				ok = false;
+			}
+		}
+	};
+};
+
+int main(int argc, char *argv[]) {
+	try {
+		Args args(argc, argv);
+
+		arguments = &args;
+
+		double start_time = omp_get_wtime();
+		int retCode = AAClustSigConvert::Run();
+		double end_time = omp_get_wtime();
+
+		cout << "Elapsed time: " << (end_time - start_time) << "s" << endl;
+
+		return retCode;
+	}
+	catch (Exception &ex) {
+		cerr << ex.File() << "(" << ex.Line() << "): " << ex.what() << "\n";
+		return 1;
+	}
+}
@@ -6,6 +6,7 @@
 #include "KmerCodebook.hpp"
 #include "KmerDistanceCache.hpp"
 #include "Edge.hpp"
+#include "EncodedDatabase.hpp"
 #include "FastaSequence.hpp"
 #include "Random.hpp"
 #include "Kmer.hpp"
@@ -14,11 +15,17 @@
 #include "OmpTimer.h"
 #include "BitSet.hpp"
 #include "kNearestNeighbours.hpp"
+#include "OrderedWriter.hpp"
+#include "PrototypeBlock.hpp"
+#include "PrototypeTrie.hpp"
 #include "Ranking.hpp"
+#include "SignatureDatabase.hpp"
 #include <cstdio>
 #include <stdlib.h>
 #include <omp.h>
 #include <set>
+#include <sstream>
+#include <unordered_set>
 #include <vector>
 
 using namespace QutBio;
@@ -40,6 +47,7 @@ public:
 		string seqFile;
 		string protoFile;
 		string outFile;
+		string sigDb;
 		size_t numThreads = 7;
 		size_t wordLength = 0;
 		int idIndex = 0;
@@ -50,6 +58,8 @@ public:
 		SimilarityMatrix *matrix;
 		Distance threshold;
 		bool assignNearest = false;
+		bool useIndex = true;
+		bool append = false;
 
 		Params() {
 
@@ -86,7 +96,19 @@ public:
 					"--matrixFile   Optional. File name for custom similarity matrix. Use this to specify some matrix ",
 					"                         other than BLOSUM, or if a custom alphabet is in use.",
 					"--assignNearest Opt.     Boolean, default = false. Assign k-mers to only one cluster instead of all that fall ",
-					"                         within threshold."
+					"                         within threshold.",
+					"--useIndex     Optional; Boolean, default = true. If true, prototypes are searched through a trie",
+					"                         which skips those that cannot lie within threshold of a kmer. If false, every",
+					"                         kmer is compared with every prototype by a cache-blocked scan. Signatures are",
+					"                         the same either way.",
+					"--append       Optional; Boolean, default = false. If true, sequences whose IDs already have",
+					"                         signatures in outFile are skipped, and signatures for the remaining",
+					"                         sequences are appended to outFile. The prototypes, threshold and word",
+					"                         length must be the same as those used to create outFile.",
+					"--sigDb        Optional. The name of a binary signature database (see AAClustSigConvert) which",
+					"                         will be brought up to date with outFile. In append mode, new signatures",
+					"                         are added to the existing database if it matches outFile; otherwise the",
+					"                         database is rebuilt from outFile."
 				};
 
 				for ( auto s : text ) {
@@ -143,9 +165,23 @@ public:
 				ok = false;
 			}
 
+			if ( arguments->IsDefined( "useIndex" ) && !arguments->Get( "useIndex", useIndex ) ) {
+				cerr << arguments->ProgName() << ": Error - invalid boolean data for argument '--useIndex'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "append" ) && !arguments->Get( "append", append ) ) {
+				cerr << arguments->ProgName() << ": Error - invalid boolean data for argument '--append'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "sigDb" ) ) {
+				arguments->Get( "sigDb", sigDb );
+			}
+
 			arguments->Required(alphabet, matrix);
 
-			if ( outFile == seqFile || outFile == protoFile ) {
+			if ( outFile == seqFile || outFile == protoFile || (!sigDb.empty() && (sigDb == outFile || sigDb == seqFile || sigDb == protoFile)) ) {
 				cerr << arguments->ProgName() << ": Output file " << outFile << " will overwrite one of your input files.\n";
 				ok = false;
 			}
@@ -172,7 +208,25 @@ public:
 		omp_set_num_threads( p.numThreads );
 
 		auto dbSeqs = Load::Fasta(p.seqFile, p.idIndex, alphabet);
-		auto db = Load::Encoded(dbSeqs, -1, alphabet, p.wordLength, distanceFunction.CharsPerWord(), alphabet->DefaultSymbol());
+		auto pending = dbSeqs;
+		size_t existingCount = 0;
+		streamoff existingSize = 0;
+
+		if ( p.append ) {
+			unordered_set<string> encoded;
+			existingSize = ReadEncodedIds( p.outFile, encoded, existingCount );
+			pending.clear();
+
+			for ( auto seq : dbSeqs ) {
+				if ( encoded.count( seq->IdStr() ) == 0 ) pending.push_back( seq );
+			}
+
+			cerr << arguments->ProgName() << ": " << (dbSeqs.size() - pending.size()) << " of " << dbSeqs.size()
+				<< " sequences already encoded in '" << p.outFile << "'.\n";
+		}
+
+		EncodedDatabase database(pending, -1, alphabet, p.wordLength, distanceFunction.CharsPerWord(), alphabet->DefaultSymbol());
+		auto & db = database.Sequences();
 		cerr << arguments->ProgName() << ": " << db.size() << " sequences loaded.\n";
 
 		auto protoSeqs = Load::Fasta(p.protoFile, 0, alphabet);
@@ -183,17 +237,31 @@ public:
 		Index<Proto> protoIndex(protos);
 		KmerIndex kmerIndex(db, p.wordLength);
 
+		unique_ptr<PrototypeTrie> trie;
+		unique_ptr<PrototypeBlock> block;
+
+		if ( p.useIndex ) {
+			trie.reset( new PrototypeTrie( protos, distanceFunction, alphabet, p.wordLength ) );
+			cerr << arguments->ProgName() << ": prototype trie has " << trie->NodeCount() << " nodes.\n";
+		}
+		else {
+			block.reset( new PrototypeBlock( protos, distanceFunction, alphabet, p.wordLength ) );
+		}
+
 		OMP_TIMER_DECLARE( encodeDb );
 		OMP_TIMER_START( encodeDb );
 
-		Encode( db, protos, distanceFunction, p.wordLength, p.threshold, p.assignNearest, p.outFile );
+		Encode( db, protos, distanceFunction, trie.get(), block.get(), p.wordLength, p.threshold, p.assignNearest, p.append, p.outFile );
 
 		OMP_TIMER_END( encodeDb );
 
 		cerr << "Database encoded in " << OMP_TIMER( encodeDb ) << "s.\n";
+
+		if ( !p.sigDb.empty() ) {
+			UpdateSignatureDatabase( p, existingCount, existingSize );
+		}
 		Util::Free(protos);
 		Util::Free(protoSeqs);
-		Util::Free(db);
 		Util::Free(dbSeqs);
 
 		// SaveSignatures(db, parms.outFile);
@@ -204,25 +272,140 @@ public:
 		vector<Seq *> &sequences,
 		vector<Proto *> &protos,
 		DistanceFunction &distanceFunction,
+		const PrototypeTrie *trie,
+		const PrototypeBlock *block,
 		uint K,
 		Distance threshold,
 		bool assignNearest,
+		bool append,
 		string &outFile //
 	) {
 		if ( assignNearest ) {
-			EncodeNearest( sequences, protos, distanceFunction, K, threshold, outFile );
+			EncodeNearest( sequences, protos, distanceFunction, trie, block, K, threshold, append, outFile );
+		}
+		else {
+			EncodeAny( sequences, protos, distanceFunction, trie, block, K, threshold, append, outFile );
+		}
+	}
+
+	/**
+	 *	Collects the sequence IDs of the signatures in an existing text
+	 *	signature file. A missing file has no signatures.
+	 *	@param fileName The name of the signature file.
+	 *	@param ids Set which will receive the IDs.
+	 *	@param count Variable which will be overwritten with the number of records.
+	 *	@returns The size of the file in bytes.
+	 *	@throws Exception if the last record is incomplete, which happens when
+	 *		an earlier run was interrupted.
+	 */
+	static streamoff ReadEncodedIds( const string &fileName, unordered_set<string> &ids, size_t &count ) {
+		ifstream str( fileName, ios::binary );
+		count = 0;
+
+		if ( !str ) return 0;
+
+		string line;
+		streamoff size = 0;
+		bool complete = true;
+
+		while ( getline( str, line ) ) {
+			complete = !str.eof();
+			size += line.size() + (complete ? 1 : 0);
+
+			auto end = line.find( ' ' );
+
+			if ( end == 0 || end == string::npos ) {
+				if ( line.empty() ) continue;
+
+				complete = false;
+				break;
+			}
+
+			ids.insert( line.substr( 0, end ) );
+			count++;
+		}
+
+		if ( !complete ) {
+			throw Exception( "The last record of signature file " + fileName + " is incomplete. "
+				"Remove it before appending.", FileAndLine );
+		}
+
+		return size;
+	}
+
+	/**
+	 *	Brings a binary signature database up to date with the text signature
+	 *	file. If the database holds exactly the records which were in the text
+	 *	file before this run, the new records are appended to it; otherwise it
+	 *	is rebuilt from the whole text file.
+	 */
+	static void UpdateSignatureDatabase( Params &p, size_t existingCount, streamoff existingSize ) {
+		bool canAppend = existingSize > 0 && SignatureDatabase::IsBinary( p.sigDb )
+			&& DatabaseMatches( p.sigDb, p.outFile, existingCount, existingSize );
+
+		if ( canAppend ) {
+			ifstream str( p.outFile );
+			str.seekg( existingSize );
+
+			vector<string> ids;
+			vector<vector<uint>> features;
+			SignatureDatabase::ReadText( str, p.outFile, ids, features );
+
+			size_t N = SignatureDatabase::Append( p.sigDb, ids, features );
+			cerr << arguments->ProgName() << ": " << ids.size() << " signatures appended to '" << p.sigDb
+				<< "', which now holds " << N << ".\n";
 		}
 		else {
-			EncodeAny( sequences, protos, distanceFunction, K, threshold, outFile );
+			size_t N = SignatureDatabase::Convert( p.outFile, p.sigDb );
+			cerr << arguments->ProgName() << ": '" << p.sigDb << "' rebuilt with " << N << " signatures.\n";
 		}
 	}
 
+	/**
+	 *	Determines whether a binary signature database holds the same records,
+	 *	in the same order, as the leading part of a text signature file.
+	 *	@param sigDb The name of the binary signature database.
+	 *	@param textFile The name of the text signature file.
+	 *	@param count The number of records in the leading part of the text file.
+	 *	@param size The size in bytes of the leading part of the text file.
+	 */
+	static bool DatabaseMatches( const string &sigDb, const string &textFile, size_t count, streamoff size ) {
+		SignatureDatabase db( sigDb );
+
+		if ( db.Size() != count ) return false;
+
+		ifstream str( textFile, ios::binary );
+		string text( (size_t) size, '\0' );
+
+		if ( !str.read( &text[0], size ) ) return false;
+
+		istringstream textStr( text );
+		vector<string> ids;
+		vector<vector<uint>> features;
+		SignatureDatabase::ReadText( textStr, textFile, ids, features );
+
+		if ( ids.size() != count ) return false;
+
+		vector<uint> dbFeatures;
+
+		for ( size_t d = 0; d < count; d++ ) {
+			db.GetFeatures( d, dbFeatures );
+
+			if ( db.Id( d ) != ids[d] || dbFeatures != features[d] ) return false;
+		}
+
+		return true;
+	}
+
 	static void EncodeNearest(
 		vector<Seq *> &sequences,
 		vector<Proto *> &protos,
 		DistanceFunction &distanceFunction,
+		const PrototypeTrie *trie,
+		const PrototypeBlock *block,
 		uint K,
 		Distance threshold,
+		bool append,
 		string &outFile //
 	) {
 		const uint Q = sequences.size();
@@ -230,7 +413,8 @@ public:
 
 #define INTERLEAVE 1
 #if INTERLEAVE
-		ofstream str( outFile );
+		ofstream str( outFile, append ? ios::app : ios::out );
+		OrderedWriter writer( str );
 #else
 		vector<BitSet> signatures;
 
@@ -246,7 +430,12 @@ public:
 		{
 #if INTERLEAVE
 			BitSet signature( C );
+			ostringstream buffer;
 #endif
+			vector<EncodedKmer> kmers;
+			vector<Distance> nearestDistance;
+			vector<uint> nearestIndex;
+
 #pragma omp for schedule(guided)
 			for ( uint q = 0; q < Q; q++ ) {
 				auto & seq = *sequences[q];
@@ -257,38 +446,62 @@ public:
 				BitSet & signature = signatures[q];
 #endif
 
-				for ( uint m = 0; m < M; m++ ) {
-					EncodedKmer kmerCode = seq.GetEncodedKmer( m );
-					Distance nearestDistance = numeric_limits<Distance>::max();
-					uint nearestIndex = 0;
+				if ( trie ) {
+					for ( uint m = 0; m < M; m++ ) {
+						EncodedKmer kmerCode = seq.GetEncodedKmer( m );
+						Distance nearestDistance = numeric_limits<Distance>::max();
+						uint nearestIndex = 0;
+
+						// Ties go to the lowest index, as in the blocked scan.
+						trie->Search( kmerCode, threshold, [&]( uint c, Distance dist ) {
+							if ( dist < nearestDistance || (dist == nearestDistance && c < nearestIndex) ) {
+								nearestIndex = c;
+								nearestDistance = dist;
+							}
 
-					for ( uint c = 0; c < C; c++ ) {
-                        auto & proto = *protos[c];
-						EncodedKmer centroidCode = proto.SingletonKmer()->PackedEncoding();
-						auto dist = distanceFunction( centroidCode, kmerCode, K );
+							return nearestDistance;
+						} );
 
-						if ( dist <= threshold && dist < nearestDistance ) {
-							nearestIndex = c;
-							nearestDistance = dist;
+						if ( nearestDistance < numeric_limits<Distance>::max() ) {
+							signature.Insert( nearestIndex );
 						}
 					}
+				}
+				else {
+					kmers.resize( M );
+					nearestDistance.assign( M, numeric_limits<Distance>::max() );
+					nearestIndex.assign( M, 0 );
 
-					if ( nearestDistance < numeric_limits<Distance>::max() ) {
-						signature.Insert( nearestIndex );
+					for ( uint m = 0; m < M; m++ ) {
+						kmers[m] = seq.GetEncodedKmer( m );
+					}
+
+					// Prototypes arrive in ascending order for each kmer, so ties go to the lowest index.
+					block->Scan( kmers.data(), M, threshold, [&]( uint m, uint c, Distance dist ) {
+						if ( dist < nearestDistance[m] ) {
+							nearestIndex[m] = c;
+							nearestDistance[m] = dist;
+						}
+
+						return nearestDistance[m];
+					} );
+
+					for ( uint m = 0; m < M; m++ ) {
+						if ( nearestDistance[m] < numeric_limits<Distance>::max() ) {
+							signature.Insert( nearestIndex[m] );
+						}
 					}
 				}
 
 #if INTERLEAVE
-#pragma omp critical
-				{
-					str << seq.IdStr() << " " << signature << "\n";
-				}
+				buffer << seq.IdStr() << " " << signature << "\n";
+				writer.Submit( q, buffer );
 #endif
 			}
 		}
 
 #if !INTERLEAVE
-		ofstream str( outFile );
+		ofstream str( outFile, append ? ios::app : ios::out );
 
 		for ( uint q = 0; q < Q; q++ ) {
 			str << sequences[q]->IdStr() << " " << signatures[q] << "\n";
@@ -301,8 +514,11 @@ public:
 		vector<Seq *> &sequences,
 		vector<Proto *> &protos,
 		DistanceFunction &distanceFunction,
+		const PrototypeTrie *trie,
+		const PrototypeBlock *block,
 		uint K,
 		Distance threshold,
+		bool append,
 		string &outFile //
 	) {
 		const uint Q = sequences.size();
@@ -310,7 +526,8 @@ public:
 
 #define INTERLEAVE 1
 #if INTERLEAVE
-		ofstream str( outFile );
+		ofstream str( outFile, append ? ios::app : ios::out );
+		OrderedWriter writer( str );
 #else
 		vector<BitSet> signatures;
 
@@ -323,7 +540,10 @@ public:
 		{
 #if INTERLEAVE
 			BitSet signature( C );
+			ostringstream buffer;
 #endif
+			vector<EncodedKmer> kmers;
+
 #pragma omp for schedule(guided)
 			for ( uint q = 0; q < Q; q++ ) {
 				auto & seq = *sequences[q];
@@ -334,32 +554,36 @@ public:
 				BitSet & signature = signatures[q];
 #endif
 
-				for ( uint c = 0; c < C; c++ ) {
-                    auto & proto = *protos[c];
-					EncodedKmer centroidCode = proto.PackedEncoding();
-
+				if ( trie ) {
 					for ( uint m = 0; m < M; m++ ) {
-						EncodedKmer kmerCode = seq.GetEncodedKmer( m );
-						auto dist = distanceFunction( centroidCode, kmerCode, K );
-
-						if ( dist <= threshold ) {
+						trie->Search( seq.GetEncodedKmer( m ), threshold, [&]( uint c, Distance dist ) {
 							signature.Insert( c );
-							break;
-						}
+							return threshold;
+						} );
 					}
 				}
+				else {
+					kmers.resize( M );
 
-#if INTERLEAVE
-#pragma omp critical
-				{
-					str << seq.IdStr() << " " << signature << "\n";
+					for ( uint m = 0; m < M; m++ ) {
+						kmers[m] = seq.GetEncodedKmer( m );
+					}
+
+					block->Scan( kmers.data(), M, threshold, [&]( uint m, uint c, Distance dist ) {
+						signature.Insert( c );
+						return threshold;
+					} );
 				}
+
+#if INTERLEAVE
+				buffer << seq.IdStr() << " " << signature << "\n";
+				writer.Submit( q, buffer );
 #endif
 			}
 		}
 
 #if !INTERLEAVE
-		ofstream str( outFile );
+		ofstream str( outFile, append ? ios::app : ios::out );
 
 		for ( uint q = 0; q < Q; q++ ) {
 			str << sequences[q]->IdStr() << " " << signatures[q] << "\n";
@@ -167,19 +167,29 @@ public:
 		Index<Proto> protoIndex(protos);
 
 
-		FILE * f = fopen(p.clusterFile.c_str(), "r");
+		Codebook * codebook = 0;
 
-		if (!f) {
-			ostringstream cerr;
-			(cerr << arguments->ProgName() << ": " << p.clusterFile << " cannot be opened for reading.\n").flush();
-			throw Exception(cerr.str(), FileAndLine);
+		if (BinaryCodebook::IsBinary(p.clusterFile)) {
+			BinaryCodebook saved(p.clusterFile);
+			codebook = new Codebook(
+				alphabet, distanceFunction, distanceFunction.CharsPerWord(),
+				p.wordLength, seqIndex, protoIndex, kmerIndex, saved);
 		}
+		else {
+			FILE * f = fopen(p.clusterFile.c_str(), "r");
 
-		Codebook * codebook = new Codebook(
-			alphabet, distanceFunction, distanceFunction.CharsPerWord(),
-			p.wordLength, seqIndex, protoIndex, kmerIndex, f);
+			if (!f) {
+				ostringstream cerr;
+				(cerr << arguments->ProgName() << ": " << p.clusterFile << " cannot be opened for reading.\n").flush();
+				throw Exception(cerr.str(), FileAndLine);
+			}
+
+			codebook = new Codebook(
+				alphabet, distanceFunction, distanceFunction.CharsPerWord(),
+				p.wordLength, seqIndex, protoIndex, kmerIndex, f);
 
-		fclose(f);
+			fclose(f);
+		}
 
 		if (codebook->Size() == 0) {
 			ostringstream cerr;
@@ -6,6 +6,7 @@
 #include "Random.hpp"
 #include "Kmer.hpp"
 #include "KmerIndex.hpp"
+#include "FrozenKmerIndex.hpp"
 #include "OmpTimer.h"
 #include "KmerCluster.hpp"
 
@@ -60,8 +61,17 @@ public:
 
         cerr << arguments->ProgName() << ": " << N << " sequences loaded.\n";
 
-        KmerIndex kmerIndex( db, parms.wordLength );
-        auto kmers = kmerIndex.GetKmers();
+        unique_ptr<KmerIndex> kmerIndex;
+        unique_ptr<FrozenKmerIndex> compactIndex;
+
+        if ( parms.compactIndex ) {
+            compactIndex.reset( new FrozenKmerIndex( db, parms.wordLength, alphabet ) );
+        }
+        else {
+            kmerIndex.reset( new KmerIndex( db, parms.wordLength ) );
+        }
+
+        auto kmers = compactIndex ? compactIndex->GetKmers() : kmerIndex->GetKmers();
         auto K = kmers.size();
 
         OMP_TIMER_END( loadTime );
@@ -87,7 +97,12 @@ public:
         Node * currentNode = new Node();
         size_t thresholdIdx = 0;
 
-        ClusterKmersByThresholdRecursive( kmerIndex, alphabet, parms.wordLength, distanceFunction.CharsPerWord(), threshold, thresholdIdx, distanceFunction, parms.increment, parms.minClusterSize, rand, currentNode );
+        if ( compactIndex ) {
+            ClusterKmersByThresholdRecursive( *compactIndex, alphabet, parms.wordLength, distanceFunction.CharsPerWord(), threshold, thresholdIdx, distanceFunction, parms.increment, parms.minClusterSize, rand, currentNode );
+        }
+        else {
+            ClusterKmersByThresholdRecursive( *kmerIndex, alphabet, parms.wordLength, distanceFunction.CharsPerWord(), threshold, thresholdIdx, distanceFunction, parms.increment, parms.minClusterSize, rand, currentNode );
+        }
 
 
         OMP_TIMER_END( clusterTime );
@@ -230,6 +245,7 @@ public:
         bool isCaseSensitive = false;
         size_t increment = 1;
         size_t minClusterSize = 10;
+        bool compactIndex = false;
 
         Params() {
             if ( arguments->IsDefined( "help" ) ) {
@@ -251,7 +267,8 @@ public:
     "--matrixId     Optional, default = 62, but you need either --matrixId or --matrixFile. BLOSUM Matrix ID, one of { 35, 40, 45, 50, 62, 80, 100 }. This is ignored if a custom similarity matrix file is specified.",
     "--matrixFile   Optional, but you need either --matrixId or --matrixFile. File name for custom similarity matrix. Use this to specify some matrix other than BLOSUM, or if a custom alphabet is in use.",
     "--isCaseSensitive Optional, default = false. Should symbols be treated as case-sensitive.",
-    "--increment    Required. Number of random kmers to recruit on each round. A figure of about 100 seems to provide a reasonable trade-off between speed and quality."
+    "--increment    Required. Number of random kmers to recruit on each round. A figure of about 100 seems to provide a reasonable trade-off between speed and quality.",
+    "--compactIndex Optional, default = false. If true, index kmers by packed integer code with flat instance storage, built in parallel. Uses less memory and time than the default index, but visits kmers in a different order. Requires alphabetSize^wordLength <= 2^64."
                 };
 
                 for ( auto s : text ) {
@@ -358,6 +375,10 @@ public:
                 cerr << arguments->ProgName() << ": note  - optional argument '--wordLength' not set; running with default value " << wordLength << ".\n";
             }
 
+            if ( !arguments->Get( "compactIndex", compactIndex ) ) {
+                cerr << arguments->ProgName() << ": note  - optional argument '--compactIndex' not set; running with default value " << compactIndex << ".\n";
+            }
+
             if ( !ok ) {
                 cerr << "Invalid command line arguments supplied. For help, run: AAClust --help\n";
                 return;
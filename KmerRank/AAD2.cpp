@@ -14,9 +14,13 @@
 #include "OmpTimer.h"
 #include "BitSet.hpp"
 #include "kNearestNeighbours.hpp"
+#include "RankingFile.hpp"
 #include "Ranking.hpp"
 #include "FragmentAggregationMode.hpp"
+#include "SearchSession.hpp"
 #include "Simproj.hpp"
+#include "SparseBag.hpp"
+#include "FrozenKmerIndex.hpp"
 
 #include <cstdio>
 #include <stdlib.h>
@@ -166,6 +170,7 @@ public:
 		D2Mode* d2Mode = D2Mode::D2();
 		size_t fragLength = string::npos;
 		FragmentAggregationMode* fragMode = FragmentAggregationMode::BestOfBest();
+		bool session = false;
 
 		Params() {
 
@@ -178,7 +183,8 @@ public:
 "               which contains amino acid sequences that have been clustered.",
 "--queryFile    Required. The name of a file containing the prototypes."
 "--outFile      Required. The name of a file which will be overwritten with ",
-"               ranking records.",
+"               ranking records. If the name ends with '.rnkb', rankings are ",
+"               written in binary format for the trec_eval tools.",
 "--idIndex      Required. The 0-origin position of the sequence ID field in ",
 "               the pipe-separated definition line.",
 "--wordLength   Required; The word length used for kmer tiling.",
@@ -230,6 +236,13 @@ public:
 "               taken as a single fragment. In practice, some fragments will be",
 "               stretched by 1 to ensure that the entire sequence is covered ",
 "               evenly.",
+"--session      Optional; default value = false. If true, load and index the ",
+"               database once, then rank query batches requested on stdin, ",
+"               one 'queryFile outFile' pair per line, until end of input or ",
+"               'quit'. One reply line is written to stdout per request: ",
+"               'ok queryCount seconds' or 'error message'. Other output goes ",
+"               to stderr while a request runs. --queryFile and --outFile are ",
+"               not used.",
 "               ",
 				};
 
@@ -246,7 +259,12 @@ public:
 				ok = false;
 			}
 
-			if ( !arguments->Get( "queryFile", this->queryFile ) ) {
+			if ( arguments->IsDefined( "session" ) && !arguments->Get( "session", session ) ) {
+				cout << arguments->ProgName() << ": error - invalid boolean data for argument '--session'.\n";
+				ok = false;
+			}
+
+			if ( !arguments->Get( "queryFile", this->queryFile ) && !session ) {
 				cout << arguments->ProgName() << ": error - required argument '--queryFile' not "
 					"supplied.\n";
 				ok = false;
@@ -281,7 +299,7 @@ public:
 				ok = false;
 			}
 
-			if ( !arguments->Get( "outFile", outFile ) ) {
+			if ( !arguments->Get( "outFile", outFile ) && !session ) {
 				cout << arguments->ProgName() << ": note - required argument '--outFile' not provided.\n";
 				ok = false;
 			}
@@ -306,6 +324,8 @@ public:
 
 		TermFreqRecord( const Substring& key, double value ) : first( key.HashCode() ), second( value ) {}
 
+		TermFreqRecord( size_t key, double value ) : first( key ), second( value ) {}
+
 		friend bool operator<( const T& lhs, const T& rhs ) {
 			return lhs.first < rhs.first;
 		}
@@ -352,12 +372,8 @@ public:
 		auto db = Load::Encoded( dbSeqs, -1, alphabet, p.wordLength, 1, alphabet->DefaultSymbol() );
 		cout << arguments->ProgName() << ": " << db.size() << " reference sequences loaded.\n";
 
-		auto querySeqs = Load::Fasta( p.queryFile, p.idIndex, alphabet );
-		auto query = Load::Encoded( querySeqs, -1, alphabet, p.wordLength, 1, alphabet->DefaultSymbol() );
-		cout << arguments->ProgName() << ": " << query.size() << " query sequences loaded.\n";
-
 		auto symbolHistogram = FastaSequence::GetSymbolHistogram( dbSeqs );
-		KmerHashIndex idx( db, p.wordLength, alphabet );
+		FrozenKmerIndex idx( db, p.wordLength, alphabet );
 		cout << arguments->ProgName() << ": " << idx.size() << " k-mers indexed from database.\n";
 
 		vector<vector<TermFreqVector>> dbTerms( db.size() );
@@ -365,225 +381,411 @@ public:
 		CreateTermVectors( db, dbTerms, dbSummaryTfv, p, alphabet );
 		cout << arguments->ProgName() << ": Term Occurrence vectors generated from database.\n";
 
-		vector<vector<TermFreqVector>> queryTerms( query.size() );
-		vector<TermFreqVector> querySummaryTfv( query.size() );
-		CreateTermVectors( query, queryTerms, querySummaryTfv, p, alphabet );
-		cout << arguments->ProgName() << ": Term Occurrence vectors generated from query set.\n";
+		const bool packed = UsePackedBags( p, alphabet );
+		vector<vector<SparseBag>> dbBags;
+
+		if ( packed ) {
+			PackBags( dbTerms, dbBags );
+		}
+
+		auto rankQueries = [&]( const string & queryFile, const string & outFile ) -> size_t {
+			auto querySeqs = Load::Fasta( queryFile, p.idIndex, alphabet );
+			Util::FreeOnExit<decltype( querySeqs )> freeQuerySeqs( querySeqs );
+			auto query = Load::Encoded( querySeqs, -1, alphabet, p.wordLength, 1, alphabet->DefaultSymbol() );
+			Util::FreeOnExit<decltype( query )> freeQuery( query );
+			cout << arguments->ProgName() << ": " << query.size() << " query sequences loaded.\n";
+
+			vector<vector<TermFreqVector>> queryTerms( query.size() );
+			vector<TermFreqVector> querySummaryTfv( query.size() );
+			CreateTermVectors( query, queryTerms, querySummaryTfv, p, alphabet );
+			cout << arguments->ProgName() << ": Term Occurrence vectors generated from query set.\n";
+
+			vector<vector<SparseBag>> queryBags;
+
+			if ( packed ) {
+				PackBags( queryTerms, queryBags );
+			}
+
+			//for ( auto & bag: queryBags ) {
+			//	for ( auto &x: bag ) {
+			//		cout << x.first << " --> " << x.second << "\n";
+			//	}
+			//	cout << "\n";
+			//}
+
+			OMP_TIMER_DECLARE( rankTime );
+			OMP_TIMER_START( rankTime );
+
+			if ( packed ) {
+				RankQueriesPacked( p, query, queryBags, querySummaryTfv, db, dbBags, dbSummaryTfv, idx, outFile );
+			}
+			else {
+				RankQueries( p, query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, symbolHistogram, outFile );
+			}
+
+			OMP_TIMER_END( rankTime );
 
-		//for ( auto & bag: queryBags ) {
-		//	for ( auto &x: bag ) {
-		//		cout << x.first << " --> " << x.second << "\n";
-		//	}
-		//	cout << "\n";
-		//}
+#if USE_OMP
+			cout << "Ranking completed in " << OMP_TIMER( rankTime ) << "s.\n";
+#endif
 
-		OMP_TIMER_DECLARE( rankTime );
-		OMP_TIMER_START( rankTime );
+			return query.size();
+		};
 
+		if ( p.session ) {
+			SearchSession::Serve( cin, rankQueries );
+		}
+		else {
+			rankQueries( p.queryFile, p.outFile );
+		}
+
+		Util::Free( db );
+		Util::Free( dbSeqs );
+
+		return 0;
+	}
+
+	/**
+	 *	Ranks a batch of queries against the database, using the D2 variant
+	 *	and fragment aggregation mode selected in p.
+	 */
+	static void RankQueries(
+		Params & p,
+		vector<EncodedFastaSequence*>& query,
+		vector<vector<TermFreqVector>>& queryTerms,
+		vector<TermFreqVector>& querySummaryTfv,
+
+		vector<EncodedFastaSequence*>& db,
+		vector<vector<TermFreqVector>>& dbTerms,
+		vector<TermFreqVector>& dbSummaryTfv,
+
+		const FrozenKmerIndex& idx,
+		Histogram<Symbol>& symbolHistogram,
+		string outFile //
+	) {
 		if ( p.d2Mode == D2Mode::D2() ) {
 			if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
-				Rank<D2, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, D2, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
-				Rank<D2, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, D2, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
-				Rank<D2, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, D2, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
-				Rank<D2, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, D2, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 		}
 #if WANT_D2_STAR
 		else if ( p.d2Mode == D2Mode::D2S() ) {
 			if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
-				RankP<D2S, BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2S, BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
-				RankP<D2S, HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2S, HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
-				RankP<D2S, HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2S, HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
-				RankP<D2S, Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2S, Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 		}
 #endif
 		else if ( p.d2Mode == D2Mode::E() ) {
 			if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
-				Rank<E, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, E, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
-				Rank<E, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, E, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
-				Rank<E, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, E, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
-				Rank<E, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, E, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 		}
 		else if ( p.d2Mode == D2Mode::E_norm() ) {
 			if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
-				Rank<E, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, E, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
-				Rank<E, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, E, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
-				Rank<E, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, E, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
-				Rank<E, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, E, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 		}
 #if WANT_D2_STAR
 		else if ( p.d2Mode == D2Mode::D2S_missing() ) {
 			if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
-				RankP<D2S_missing, BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2S_missing, BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
-				RankP<D2S_missing, HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2S_missing, HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
-				RankP<D2S_missing, HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2S_missing, HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
-				RankP<D2S_missing, Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2S_missing, Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 		}
 		else if ( p.d2Mode == D2Mode::D2Star() ) {
 			if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
-				RankP<D2Star, BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2Star, BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
-				RankP<D2Star, HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2Star, HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
-				RankP<D2Star, HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2Star, HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
-				RankP<D2Star, Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2Star, Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 		}
 		else if ( p.d2Mode == D2Mode::D2Star_missing() ) {
 			if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
-				RankP<D2Star_missing, BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2Star_missing, BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
-				RankP<D2Star_missing, HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2Star_missing, HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
-				RankP<D2Star_missing, HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2Star_missing, HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
-				RankP<D2Star_missing, Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2Star_missing, Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 		}
 		else if ( p.d2Mode == D2Mode::D2S_observed() ) {
 			if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
-				RankP<D2S_observed, BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2S_observed, BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
-				RankP<D2S_observed, HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2S_observed, HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
-				RankP<D2S_observed, HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2S_observed, HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
-				RankP<D2S_observed, Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, p.outFile );
+				RankP<D2S_observed, Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, symbolHistogram, outFile );
 		}
 #endif
 		else if ( p.d2Mode == D2Mode::Cosine() ) {
 			// normalisation has already been taken care of.
 			if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
-				Rank<D2, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, D2, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
-				Rank<D2, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, D2, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
-				Rank<D2, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, D2, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
-				Rank<D2, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, D2, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 		}
 		else if ( p.d2Mode == D2Mode::Jaccard() ) {
 			if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
-				Rank<Jaccard, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, Jaccard, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
-				Rank<Jaccard, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, Jaccard, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
-				Rank<Jaccard, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, Jaccard, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
-				Rank<Jaccard, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, Jaccard, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 		}
 		else if ( p.d2Mode == D2Mode::Min() ) {
 			if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
-				Rank<Min, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, Min, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
-				Rank<Min, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, Min, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
-				Rank<Min, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, Min, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
-				Rank<Min, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, Min, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 		}
 		else if ( p.d2Mode == D2Mode::MinNormMin() ) {
 			if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
-				Rank<MinNormMin, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, MinNormMin, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
-				Rank<MinNormMin, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, MinNormMin, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
-				Rank<MinNormMin, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, MinNormMin, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
-				Rank<MinNormMin, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, MinNormMin, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 		}
 		else if ( p.d2Mode == D2Mode::MinNormMax() ) {
 			if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
-				Rank<MinNormMax, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, MinNormMax, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
-				Rank<MinNormMax, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, MinNormMax, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
-				Rank<MinNormMax, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, MinNormMax, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
-				Rank<MinNormMax, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, MinNormMax, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 		}
 		else if ( p.d2Mode == D2Mode::MinNormAvg() ) {
 			if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
-				Rank<MinNormAvg, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, MinNormAvg, Simproj::BestOfBest>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
-				Rank<MinNormAvg, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, MinNormAvg, Simproj::HausdorffAverageAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
-				Rank<MinNormAvg, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, MinNormAvg, Simproj::HausdorffAverage>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 
 			else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
-				Rank<MinNormAvg, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, p.outFile );
+				Rank<TermFreqVector, MinNormAvg, Simproj::Hausdorff>( query, queryTerms, querySummaryTfv, db, dbTerms, dbSummaryTfv, idx, p.maxResults, outFile );
 		}
 		else {
 			throw Exception( "Whatever d2 mode you entered is not implemented in the present version.", FileAndLine );
 		}
-		OMP_TIMER_END( rankTime );
+	}
+
+	/**
+	 *	Returns true iff fragments can be compared as packed bags: the D2
+	 *	variant selected in p has a packed implementation, and every kmer
+	 *	hash code fits in 32 bits. The normalised variants need weights in
+	 *	double precision, and the probability-weighted variants use
+	 *	TermFreqVector.
+	 */
+	static bool UsePackedBags( const Params & p, const Alphabet * alphabet ) {
+		if ( pow( (double) alphabet->Size(), p.wordLength ) > (double) numeric_limits<uint32_t>::max() + 1 ) {
+			return false;
+		}
+
+		return p.d2Mode == D2Mode::D2()
+			|| p.d2Mode == D2Mode::E()
+			|| p.d2Mode == D2Mode::Jaccard()
+			|| p.d2Mode == D2Mode::Min()
+			|| p.d2Mode == D2Mode::MinNormMin()
+			|| p.d2Mode == D2Mode::MinNormMax()
+			|| p.d2Mode == D2Mode::MinNormAvg();
+	}
+
+	/**
+	 *	Converts per-fragment term frequency vectors to packed bags, and
+	 *	releases the term frequency vectors.
+	 *	@pre UsePackedBags returned true.
+	 *	@throws Exception if a count cannot be represented exactly as a float.
+	 */
+	static void PackBags( vector<vector<TermFreqVector>>& terms, vector<vector<SparseBag>>& packed ) {
+		const int64_t N = (int64_t) terms.size();
+		bool ok = true;
+		packed.resize( N );
 
 #if USE_OMP
-		cout << "Ranking completed in " << OMP_TIMER( rankTime ) << "s.\n";
+#pragma omp parallel for schedule(dynamic, 64) reduction(&&:ok)
 #endif
+		for ( int64_t i = 0; i < N; i++ ) {
+			packed[i].resize( terms[i].size() );
 
-		Util::Free( query );
-		Util::Free( querySeqs );
-		Util::Free( db );
-		Util::Free( dbSeqs );
+			for ( size_t f = 0; f < terms[i].size(); f++ ) {
+				for ( auto& term : terms[i][f] ) {
+					ok = ok && (double) (float) term.second == term.second;
+					packed[i][f].Append( (uint32_t) term.first, (float) term.second );
+				}
+			}
 
-		return 0;
+			vector<TermFreqVector>().swap( terms[i] );
+		}
+
+		if ( !ok ) {
+			throw Exception( "Term count too large to pack.", FileAndLine );
+		}
+	}
+
+	/**
+	 *	Ranks a batch of queries against the database using packed bags.
+	 *	@pre UsePackedBags returned true.
+	 */
+	static void RankQueriesPacked(
+		Params & p,
+		vector<EncodedFastaSequence*>& query,
+		vector<vector<SparseBag>>& queryBags,
+		vector<TermFreqVector>& querySummaryTfv,
+
+		vector<EncodedFastaSequence*>& db,
+		vector<vector<SparseBag>>& dbBags,
+		vector<TermFreqVector>& dbSummaryTfv,
+
+		const FrozenKmerIndex& idx,
+		string outFile //
+	) {
+		if ( p.d2Mode == D2Mode::D2() )
+			RankByFragMode<D2>( p, query, queryBags, querySummaryTfv, db, dbBags, dbSummaryTfv, idx, outFile );
+
+		else if ( p.d2Mode == D2Mode::E() )
+			RankByFragMode<E>( p, query, queryBags, querySummaryTfv, db, dbBags, dbSummaryTfv, idx, outFile );
+
+		else if ( p.d2Mode == D2Mode::Jaccard() )
+			RankByFragMode<Jaccard>( p, query, queryBags, querySummaryTfv, db, dbBags, dbSummaryTfv, idx, outFile );
+
+		else if ( p.d2Mode == D2Mode::Min() )
+			RankByFragMode<Min>( p, query, queryBags, querySummaryTfv, db, dbBags, dbSummaryTfv, idx, outFile );
+
+		else if ( p.d2Mode == D2Mode::MinNormMin() )
+			RankByFragMode<MinNormMin>( p, query, queryBags, querySummaryTfv, db, dbBags, dbSummaryTfv, idx, outFile );
+
+		else if ( p.d2Mode == D2Mode::MinNormMax() )
+			RankByFragMode<MinNormMax>( p, query, queryBags, querySummaryTfv, db, dbBags, dbSummaryTfv, idx, outFile );
+
+		else if ( p.d2Mode == D2Mode::MinNormAvg() )
+			RankByFragMode<MinNormAvg>( p, query, queryBags, querySummaryTfv, db, dbBags, dbSummaryTfv, idx, outFile );
+
+		else
+			throw Exception( "D2 mode has no packed implementation.", FileAndLine );
+	}
+
+	template<double( *cmp )( const SparseBag& x, const SparseBag& y )>
+	static void RankByFragMode(
+		Params & p,
+		vector<EncodedFastaSequence*>& query,
+		vector<vector<SparseBag>>& queryBags,
+		vector<TermFreqVector>& querySummaryTfv,
+
+		vector<EncodedFastaSequence*>& db,
+		vector<vector<SparseBag>>& dbBags,
+		vector<TermFreqVector>& dbSummaryTfv,
+
+		const FrozenKmerIndex& idx,
+		string& outFile //
+	) {
+		if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
+			Rank<SparseBag, cmp, Simproj::BestOfBest>( query, queryBags, querySummaryTfv, db, dbBags, dbSummaryTfv, idx, p.maxResults, outFile );
+
+		else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
+			Rank<SparseBag, cmp, Simproj::HausdorffAverageAverage>( query, queryBags, querySummaryTfv, db, dbBags, dbSummaryTfv, idx, p.maxResults, outFile );
+
+		else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
+			Rank<SparseBag, cmp, Simproj::HausdorffAverage>( query, queryBags, querySummaryTfv, db, dbBags, dbSummaryTfv, idx, p.maxResults, outFile );
+
+		else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
+			Rank<SparseBag, cmp, Simproj::Hausdorff>( query, queryBags, querySummaryTfv, db, dbBags, dbSummaryTfv, idx, p.maxResults, outFile );
 	}
 
+	/**
+	 *	Builds the per-fragment and whole-sequence term frequency vectors of
+	 *	each sequence, sorted by kmer hash code. The hash codes of the kmers
+	 *	of a sequence are collected into an array in position order; since
+	 *	each fragment covers a contiguous run of positions, the vector of a
+	 *	fragment is obtained by sorting its run and counting equal codes,
+	 *	and the summary vector likewise from the whole array. Sequences are
+	 *	processed in parallel.
+	 */
 	static void CreateTermVectors(
 		vector<EncodedFastaSequence*>& db,
 		vector<vector<TermFreqVector>>& terms,
@@ -591,46 +793,69 @@ public:
 		AAD2::Params& parms,
 		const Alphabet * alphabet
 	) {
-		uint i = 0;
+		const bool normalise = parms.d2Mode == D2Mode::Cosine() || parms.d2Mode == D2Mode::E_norm();
 
-		for ( auto seq_ : db ) {
-			auto& seq = *seq_;
-			seq.position = i;
+#if USE_OMP
+#pragma omp parallel
+#endif
+		{
+			vector<size_t> codes;
+			vector<size_t> run;
 
-			TermFreqVector& summaryTfv = summaryTerms[i];
-			vector<TermFreqVector>& frags = terms[i];
+#if USE_OMP
+#pragma omp for schedule(dynamic, 16)
+#endif
+			for ( int64_t i = 0; i < (int64_t) db.size(); i++ ) {
+				auto& seq = *db[i];
+				seq.position = (uint) i;
 
-			i++;
+				TermFreqVector& summaryTfv = summaryTerms[i];
+				vector<TermFreqVector>& frags = terms[i];
 
-			size_t kmerCount = seq.KmerCount( parms.wordLength );
-			size_t fragCount = Fragment::GetCount( kmerCount, parms.fragLength );
-			double stepSize = Fragment::GetRealStepSize( kmerCount, parms.fragLength, fragCount );
+				size_t kmerCount = seq.KmerCount( parms.wordLength );
+				size_t fragCount = Fragment::GetCount( kmerCount, parms.fragLength );
+				double stepSize = Fragment::GetRealStepSize( kmerCount, parms.fragLength, fragCount );
 
-			frags.resize( fragCount );
+				frags.resize( fragCount );
+				codes.resize( kmerCount );
 
-			auto process = [&frags, &summaryTfv, stepSize, alphabet]( EncodedFastaSequence* seq, size_t pos, size_t length ) {
-				size_t fragIdx = (size_t) ( pos / stepSize );
-				TermFreqVector& tfv = frags[fragIdx];
-				Substring s( seq->Sequence().data(), pos, length, alphabet );
-				tfv[s] ++;
-				summaryTfv[s] ++;
-			};
+				for ( size_t pos = 0; pos < kmerCount; pos++ ) {
+					codes[pos] = Substring( seq.Sequence().data(), pos, parms.wordLength, alphabet ).HashCode();
+				}
 
-			seq.SelectKmers( parms.wordLength, process );
+				for ( size_t lo = 0, hi; lo < kmerCount; lo = hi ) {
+					size_t fragIdx = (size_t) ( lo / stepSize );
 
-			if ( parms.d2Mode == D2Mode::Cosine() || parms.d2Mode == D2Mode::E_norm() ) {
-				for ( auto& tfv : frags ) {
-					Normalise( tfv );
+					for ( hi = lo + 1; hi < kmerCount && (size_t) ( hi / stepSize ) == fragIdx; hi++ ) {}
+
+					run.assign( codes.begin() + lo, codes.begin() + hi );
+					CountTerms( run, frags[fragIdx] );
 				}
 
-				Normalise( summaryTfv );
-			}
+				CountTerms( codes, summaryTfv );
 
-			for ( auto& tfv : frags ) {
-				std::sort( tfv.begin(), tfv.end() );
+				if ( normalise ) {
+					for ( auto& tfv : frags ) {
+						Normalise( tfv );
+					}
+
+					Normalise( summaryTfv );
+				}
 			}
+		}
+	}
+
+	/**
+	 *	Sorts a list of kmer hash codes and appends one record per distinct
+	 *	code, with its number of occurrences, to a term frequency vector.
+	 */
+	static void CountTerms( vector<size_t>& codes, TermFreqVector& tfv ) {
+		std::sort( codes.begin(), codes.end() );
+
+		for ( size_t lo = 0, hi; lo < codes.size(); lo = hi ) {
+			for ( hi = lo + 1; hi < codes.size() && codes[hi] == codes[lo]; hi++ ) {}
 
-			std::sort( summaryTfv.begin(), summaryTfv.end() );
+			tfv.emplace_back( codes[lo], (double) ( hi - lo ) );
 		}
 	}
 
@@ -658,22 +883,23 @@ public:
 
 	using BagSimilarityProb = double( * )( const TermFreqVector& x, const TermFreqVector& y, const double p[256] );
 
-	template<BagSimilarity cmp, Aggregator agg>
+	template<typename Bag, double( *cmp )( const Bag& x, const Bag& y ), Aggregator agg>
 	static void Rank(
 		vector<EncodedFastaSequence*>& query,
-		vector<vector<TermFreqVector>>& queryBags,
+		vector<vector<Bag>>& queryBags,
 		vector<TermFreqVector>& querySummaryTfvs,
 
 		vector<EncodedFastaSequence*>& db,
-		vector<vector<TermFreqVector>>& dbBags,
+		vector<vector<Bag>>& dbBags,
 		vector<TermFreqVector>& dbSummaryTfvs,
 
-		KmerHashIndex& dbIndex,
+		const FrozenKmerIndex& dbIndex,
 		uint maxResults,
 		string& outFile //
 	) {
 		const uint Q = query.size();
-		ofstream out( outFile );
+		RankingWriter writer( outFile );
+		auto subjectId = [&db]( size_t d ) -> const string & { return db[d]->IdStr(); };
 
 		size_t maxQueryFragCount = GetMaxFragCount( queryBags );
 		size_t maxDbFragCount = GetMaxFragCount( dbBags );
@@ -685,6 +911,7 @@ public:
 			// cout << "Running with " << omp_get_num_threads() << " threads.\n";
 
 			KnnVector<size_t, double> rankings( maxResults, -HUGE_VAL );
+			ostringstream buffer;
 			BitSet processed( db.size() );
 			vector<double> rowMinima( maxQueryFragCount );
 			vector<double> colMinima( maxDbFragCount );
@@ -701,21 +928,14 @@ public:
 				processed.Clear();
 
 				for ( auto c : querySummaryTfv ) {
-					auto dbKmer = dbIndex[c.first];
-
-					if ( dbKmer == 0 ) continue;
-
-					// cout << dbKmer->Substr() << "\n";
-
-					for ( auto instance : dbKmer->Instances() ) {
-						auto& seq = instance.sequence;
-						size_t d = seq.position;
+					for ( auto & instance : dbIndex.Find( c.first ) ) {
+						size_t d = instance.sequence;
 
 						if ( !processed.Contains( d ) ) {
 							processed.Insert( d );
 
-							vector<TermFreqVector>& queryFrags = queryBags[q];
-							vector<TermFreqVector>& dbFrags = dbBags[d];
+							vector<Bag>& queryFrags = queryBags[q];
+							vector<Bag>& dbFrags = dbBags[d];
 
 							size_t m = queryFrags.size();
 							size_t n = dbFrags.size();
@@ -747,24 +967,16 @@ public:
 
 				rankings.sort();
 
-#if USE_OMP
-#pragma omp critical
-#endif
-				{
-					out << query[q]->IdStr();
-
-					for ( auto& ranking : rankings ) {
-						out << " " << db[ranking.second]->IdStr() << " " << ( -ranking.first );
-					}
-
-					out << " ___eol___ -100000\n";
-				}
+				writer.Submit( q, query[q]->IdStr(), rankings, subjectId, buffer );
 			}
 
 		}
+
+		writer.Close( Q, [&query]( size_t q ) -> const string & { return query[q]->IdStr(); }, db.size(), subjectId );
 	}
 
-	static size_t GetMaxFragCount( std::vector<std::vector<AAD2::TermFreqVector>>& queryBags ) {
+	template<typename Bag>
+	static size_t GetMaxFragCount( std::vector<std::vector<Bag>>& queryBags ) {
 		size_t maxQueryFragCount = 0;
 
 		for ( auto& queryFragList : queryBags ) {
@@ -788,7 +1000,7 @@ public:
 		vector<vector<TermFreqVector>>& dbBags,
 		vector<TermFreqVector>& dbSummaryTfvs,
 
-		KmerHashIndex& dbIndex,
+		const FrozenKmerIndex& dbIndex,
 		uint maxResults,
 		Histogram<byte>& symbolHist,
 		string& outFile //
@@ -804,7 +1016,8 @@ public:
 		}
 
 		const uint Q = query.size();
-		ofstream out( outFile );
+		RankingWriter writer( outFile );
+		auto subjectId = [&db]( size_t d ) -> const string & { return db[d]->IdStr(); };
 
 		size_t maxQueryFragCount = GetMaxFragCount( queryBags );
 		size_t maxDbFragCount = GetMaxFragCount( dbBags );
@@ -812,6 +1025,7 @@ public:
 #pragma omp parallel
 		{
 			KnnVector<size_t, double> rankings( maxResults, -HUGE_VAL );
+			ostringstream buffer;
 			BitSet processed( db.size() );
 			vector<double> rowMinima( maxQueryFragCount );
 			vector<double> colMinima( maxDbFragCount );
@@ -824,13 +1038,8 @@ public:
 				processed.Clear();
 
 				for ( auto c : querySummaryTfv ) {
-					auto dbKmer = dbIndex[c.first];
-
-					if ( dbKmer == 0 ) continue;
-
-					for ( auto instance : dbKmer->Instances() ) {
-						auto& seq = instance.sequence;
-						size_t d = seq.position;
+					for ( auto & instance : dbIndex.Find( c.first ) ) {
+						size_t d = instance.sequence;
 
 						if ( !processed.Contains( d ) ) {
 							processed.Insert( d );
@@ -862,18 +1071,11 @@ public:
 
 				rankings.sort();
 
-#pragma omp critical
-				{
-					out << query[q]->IdStr();
-
-					for ( auto& ranking : rankings ) {
-						out << " " << db[ranking.second]->IdStr() << " " << ( -ranking.first );
-					}
-
-					out << " ___eol___ -100000\n";
-				}
+				writer.Submit( q, query[q]->IdStr(), rankings, subjectId, buffer );
 			}
 		}
+
+		writer.Close( Q, [&query]( size_t q ) -> const string & { return query[q]->IdStr(); }, db.size(), subjectId );
 	}
 
 	static double D2( const TermFreqVector& a, const TermFreqVector& b ) {
@@ -979,7 +1181,7 @@ public:
 			aLen += p->second;
 		}
 
-		for ( auto p = j; p != j; p++ ) {
+		for ( auto p = j; p != n; p++ ) {
 			bLen += p->second;
 		}
 
@@ -1018,7 +1220,7 @@ public:
 			aLen += p->second;
 		}
 
-		for ( auto p = j; p != j; p++ ) {
+		for ( auto p = j; p != n; p++ ) {
 			bLen += p->second;
 		}
 
@@ -1057,7 +1259,7 @@ public:
 			aLen += p->second;
 		}
 
-		for ( auto p = j; p != j; p++ ) {
+		for ( auto p = j; p != n; p++ ) {
 			bLen += p->second;
 		}
 
@@ -1114,6 +1316,54 @@ public:
 		return 1 - intersect / union_;
 	}
 
+	// Versions of the count-based measures for packed bags. Each gives
+	// exactly the same result as its TermFreqVector counterpart, including
+	// E and Jaccard, which only count words up to the lesser of the two
+	// largest keys.
+
+	static double D2( const SparseBag& a, const SparseBag& b ) {
+		return -SparseBag::Intersect( a, b ).sumProduct;
+	}
+
+	static double E( const SparseBag& a, const SparseBag& b ) {
+		if ( a.Empty() || b.Empty() ) return 0;
+
+		uint32_t last = std::min( a.keys.back(), b.keys.back() );
+		auto overlap = SparseBag::Intersect( a, b );
+		return a.SumSquaredUpTo( last ) + b.SumSquaredUpTo( last ) - 2 * overlap.sumProduct;
+	}
+
+	static double Min( const SparseBag& a, const SparseBag& b ) {
+		return -SparseBag::Intersect( a, b ).sumMin;
+	}
+
+	static double MinNormMin( const SparseBag& a, const SparseBag& b ) {
+		auto len = std::min( a.total, b.total );
+		return len == 0 ? 0 : -SparseBag::Intersect( a, b ).sumMin / len;
+	}
+
+	static double MinNormMax( const SparseBag& a, const SparseBag& b ) {
+		auto len = std::max( a.total, b.total );
+		return len == 0 ? 0 : -SparseBag::Intersect( a, b ).sumMin / len;
+	}
+
+	static double MinNormAvg( const SparseBag& a, const SparseBag& b ) {
+		auto len = ( a.total + b.total ) / 2;
+		return len == 0 ? 0 : -SparseBag::Intersect( a, b ).sumMin / len;
+	}
+
+	static double Jaccard( const SparseBag& a, const SparseBag& b ) {
+		double union_ = 0, intersect = 0;
+
+		if ( !a.Empty() && !b.Empty() ) {
+			uint32_t last = std::min( a.keys.back(), b.keys.back() );
+			intersect = (double) SparseBag::Intersect( a, b ).matches;
+			union_ = a.CountUpTo( last ) + b.CountUpTo( last ) - intersect;
+		}
+
+		return 1 - intersect / union_;
+	}
+
 #if WANT_D2_STAR
 
 	static double D2S( const TermFreqVector& a, const TermFreqVector& b, const double p[256] ) {
@@ -14,6 +14,7 @@
 #include "OmpTimer.h"
 #include "BitSet.hpp"
 #include "kNearestNeighbours.hpp"
+#include "RankingFile.hpp"
 #include "Ranking.hpp"
 #include "FragmentAggregationMode.hpp"
 
@@ -172,7 +173,8 @@ public:
 "               which contains amino acid sequences that have been clustered.",
 "--queryFile    Required. The name of a file containing the prototypes."
 "--outFile      Required. The name of a file which will be overwritten with ",
-"               ranking records.",
+"               ranking records. If the name ends with '.rnkb', rankings are ",
+"               written in binary format for the trec_eval tools.",
 "--idIndex      Required. The 0-origin position of the sequence ID field in ",
 "               the pipe-separated definition line.",
 "--wordLength   Required; The word length used for kmer tiling.",
@@ -594,7 +596,8 @@ public:
 		string &outFile //
 	) {
 		const uint Q = query.size();
-		ofstream out( outFile );
+		RankingWriter writer( outFile );
+		auto subjectId = [&db]( size_t d ) -> const string & { return db[d]->IdStr(); };
 
 		size_t maxQueryFragCount = GetMaxFragCount( queryBags );
 		size_t maxDbFragCount = GetMaxFragCount( dbBags );
@@ -602,6 +605,7 @@ public:
 #pragma omp parallel
 		{
 			KnnVector<size_t, double> rankings( maxResults, -HUGE_VAL );
+			ostringstream buffer;
 			vector<double> rowMinima( maxQueryFragCount );
 			vector<double> colMinima( maxDbFragCount );
 
@@ -639,19 +643,12 @@ public:
 
 				rankings.sort();
 
-#pragma omp critical
-				{
-					out << query[q]->IdStr();
-
-					for ( auto & ranking : rankings ) {
-						out << " " << db[ranking.second]->IdStr() << " " << (-ranking.first);
-					}
-
-					out << " ___eol___ -100000\n";
-				}
+				writer.Submit( q, query[q]->IdStr(), rankings, subjectId, buffer );
 			}
 
 		}
+
+		writer.Close( Q, [&query]( size_t q ) -> const string & { return query[q]->IdStr(); }, db.size(), subjectId );
 	}
 
 	static size_t GetMaxFragCount( std::vector<std::vector<AAD2::TermFreqVector>> & queryBags ) {
@@ -694,7 +691,8 @@ public:
 		}
 
 		const uint Q = query.size();
-		ofstream out( outFile );
+		RankingWriter writer( outFile );
+		auto subjectId = [&db]( size_t d ) -> const string & { return db[d]->IdStr(); };
 
 		size_t maxQueryFragCount = GetMaxFragCount( queryBags );
 		size_t maxDbFragCount = GetMaxFragCount( dbBags );
@@ -702,6 +700,7 @@ public:
 #pragma omp parallel
 		{
 			KnnVector<size_t, double> rankings( maxResults, -HUGE_VAL );
+			ostringstream buffer;
 			BitSet processed( db.size() );
 			vector<double> rowMinima( maxQueryFragCount );
 			vector<double> colMinima( maxDbFragCount );
@@ -752,18 +751,11 @@ public:
 
 				rankings.sort();
 
-#pragma omp critical
-				{
-					out << query[q]->IdStr();
-
-					for ( auto & ranking : rankings ) {
-						out << " " << db[ranking.second]->IdStr() << " " << (-ranking.first);
-					}
-
-					out << " ___eol___ -100000\n";
-				}
+				writer.Submit( q, query[q]->IdStr(), rankings, subjectId, buffer );
 			}
 		}
+
+		writer.Close( Q, [&query]( size_t q ) -> const string & { return query[q]->IdStr(); }, db.size(), subjectId );
 	}
 
 	static double BestOfBest( const vector<double> & rowMinima, size_t rowCount, const vector<double> & colMinima, size_t colCount ) {
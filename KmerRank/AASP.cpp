@@ -4,8 +4,11 @@
 #include "Random.hpp"
 #include "OmpTimer.h"
 #include "kNearestNeighbours.hpp"
+#include "RankingFile.hpp"
 #include "Ranking.hpp"
 #include "FragmentAggregationMode.hpp"
+#include "SearchSession.hpp"
+#include "SeedFilter.hpp"
 #include "Simproj.hpp"
 #include "Sequence.hpp"
 #include "Fragment.hpp"
@@ -38,6 +41,10 @@ public:
 		bool ok = true;
 		int maxResults = 500;
 		size_t fragLength = 1;
+		size_t candidates = 0;
+		string seedPattern = "111";
+		bool checkRecall = false;
+		bool session = false;
 		FragmentAggregationMode* fragMode = FragmentAggregationMode::HausdorffAverageAverage();
 		const SubstitutionMatrix* matrix = &SubstitutionMatrix::Blosum62();
 
@@ -53,7 +60,8 @@ public:
 "               which contains amino acid sequences that have been clustered.",
 "--queryFile    Required. The name of a file containing the prototypes."
 "--outFile      Required. The name of a file which will be overwritten with ",
-"               ranking records.",
+"               ranking records. If the name ends with '.rnkb', rankings are ",
+"               written in binary format for the trec_eval tools.",
 "--idIndex      Required. The 0-origin position of the sequence ID field in ",
 "               the pipe-separated definition line.",
 "--wordLength   Required; The word length used for kmer tiling.",
@@ -76,7 +84,28 @@ public:
 "				is greater than 1, some fragments will be stretched or squashed to ",
 "				ensure that the entire sequence is covered as evenly as possible.",
 "--matrixFile   Optional path to text document containing a substitution matrix. ",
-"				Default is built-in BLOSUM-62."
+"				Default is built-in BLOSUM-62.",
+"--candidates   Optional; default value = 0. If non-zero, a spaced-seed index ",
+"               over the database nominates at most this many candidates per ",
+"               query, ranked by the number of distinct seeds shared with the ",
+"               query, and only those candidates are compared by similarity ",
+"               projection. Larger values trade speed for recall. If 0, every ",
+"               query is compared with every database sequence.",
+"--seedPattern  Optional; default value = 111. Seed pattern used when ",
+"               --candidates is non-zero: a string of '1' (must match) and '0' ",
+"               (don't care) characters which starts and ends with '1'.",
+"--checkRecall  Optional; default value = false. If true, and --candidates is ",
+"               non-zero, every query is also compared with every database ",
+"               sequence, and the number of true top maxResults hits dropped ",
+"               by the prefilter is reported. Output rankings are those of the ",
+"               prefilter.",
+"--session      Optional; default value = false. If true, load and index the ",
+"               database once, then rank query batches requested on stdin, ",
+"               one 'queryFile outFile' pair per line, until end of input or ",
+"               'quit'. One reply line is written to stdout per request: ",
+"               'ok queryCount seconds' or 'error message'. Other output goes ",
+"               to stderr while a request runs. --queryFile and --outFile are ",
+"               not used.",
 "               ",
 				};
 
@@ -93,7 +122,12 @@ public:
 				ok = false;
 			}
 
-			if ( !arguments->Get( "queryFile", this->queryFile ) ) {
+			if ( arguments->IsDefined( "session" ) && !arguments->Get( "session", session ) ) {
+				cout << arguments->ProgName() << ": error - invalid boolean data for argument '--session'.\n";
+				ok = false;
+			}
+
+			if ( !arguments->Get( "queryFile", this->queryFile ) && !session ) {
 				cout << arguments->ProgName() << ": error - required argument '--queryFile' not "
 					"supplied.\n";
 				ok = false;
@@ -120,7 +154,7 @@ public:
 				ok = false;
 			}
 
-			if ( !arguments->Get( "outFile", outFile ) ) {
+			if ( !arguments->Get( "outFile", outFile ) && !session ) {
 				cout << arguments->ProgName() << ": note - required argument '--outFile' not provided.\n";
 				ok = false;
 			}
@@ -135,6 +169,21 @@ public:
 					<< "Default value " << fragLength << " will be used.\n";
 			}
 
+			if ( arguments->IsDefined( "candidates" ) && !arguments->Get( "candidates", candidates ) ) {
+				cout << arguments->ProgName() << ": error - invalid integer data for argument '--candidates'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "seedPattern" ) && !arguments->Get( "seedPattern", seedPattern ) ) {
+				cout << arguments->ProgName() << ": error - argument '--seedPattern' requires a value.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "checkRecall" ) && !arguments->Get( "checkRecall", checkRecall ) ) {
+				cout << arguments->ProgName() << ": error - invalid boolean data for argument '--checkRecall'.\n";
+				ok = false;
+			}
+
 			string matrixFile;
 			if ( arguments->Get( "matrixFile", matrixFile ) ) {
 				ifstream f(matrixFile);
@@ -160,43 +209,65 @@ public:
 		vector<Sequence*> db = Load( *p.matrix, p.dbFile, p.idIndex );;
 		cout << arguments->ProgName() << ": " << db.size() << " reference sequences loaded.\n";
 
-		vector<Sequence*> query = Load(  *p.matrix, p.queryFile, p.idIndex );
-		cout << arguments->ProgName() << ": " << query.size() << " query sequences loaded.\n";
+		unique_ptr<SeedFilter> filter;
 
-		auto cleanup = [&db, &query]() {
-			Util::Free( query );
-			Util::Free( db );
-		};
+		if ( p.candidates > 0 ) {
+			OMP_TIMER_DECLARE( indexTime );
+			OMP_TIMER_START( indexTime );
 
-		OMP_TIMER_DECLARE( rankTime );
-		OMP_TIMER_START( rankTime );
+			filter.reset( new SeedFilter( db, p.seedPattern, p.matrix->Size() ) );
 
-		if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
-			Rank<Simproj::BestOfBest>( query, db, p.wordLength, p.fragLength, *p.matrix, p.maxResults, p.outFile );
+			OMP_TIMER_END( indexTime );
+			cout << arguments->ProgName() << ": seed index built with " << filter->PostingCount() << " postings";
+#if USE_OMP
+			cout << " in " << OMP_TIMER( indexTime ) << "s";
+#endif
+			cout << ".\n";
+		}
 
-		else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
-			Rank<Simproj::HausdorffAverageAverage>( query, db, p.wordLength, p.fragLength, *p.matrix, p.maxResults, p.outFile );
+		auto rankQueries = [&]( const string & queryFile, const string & outFile ) -> size_t {
+			vector<Sequence*> query = Load( *p.matrix, queryFile, p.idIndex );
+			Util::FreeOnExit<vector<Sequence*>> freeQuery( query );
+			cout << arguments->ProgName() << ": " << query.size() << " query sequences loaded.\n";
 
-		else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
-			Rank<Simproj::HausdorffAverage>( query, db, p.wordLength, p.fragLength, *p.matrix, p.maxResults, p.outFile );
+			string out( outFile );
 
-		else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
-			Rank<Simproj::Hausdorff>( query, db, p.wordLength, p.fragLength, *p.matrix, p.maxResults, p.outFile );
+			OMP_TIMER_DECLARE( rankTime );
+			OMP_TIMER_START( rankTime );
 
-		else {
-			cout << "Unknown fragMode.\n";
-			cleanup();
-			return 1;
-		}
+			if ( p.fragMode == FragmentAggregationMode::BestOfBest() )
+				Rank<Simproj::BestOfBest>( query, db, p.wordLength, p.fragLength, *p.matrix, p.maxResults, out, filter.get(), p.candidates, p.checkRecall );
+
+			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverageAverage() )
+				Rank<Simproj::HausdorffAverageAverage>( query, db, p.wordLength, p.fragLength, *p.matrix, p.maxResults, out, filter.get(), p.candidates, p.checkRecall );
 
+			else if ( p.fragMode == FragmentAggregationMode::HausdorffAverage() )
+				Rank<Simproj::HausdorffAverage>( query, db, p.wordLength, p.fragLength, *p.matrix, p.maxResults, out, filter.get(), p.candidates, p.checkRecall );
 
-		OMP_TIMER_END( rankTime );
+			else if ( p.fragMode == FragmentAggregationMode::Hausdorff() )
+				Rank<Simproj::Hausdorff>( query, db, p.wordLength, p.fragLength, *p.matrix, p.maxResults, out, filter.get(), p.candidates, p.checkRecall );
+
+			else {
+				throw Exception( "Unknown fragMode.", FileAndLine );
+			}
+
+			OMP_TIMER_END( rankTime );
 
 #if USE_OMP
-		cout << "Ranking completed in " << OMP_TIMER( rankTime ) << "s.\n";
+			cout << "Ranking completed in " << OMP_TIMER( rankTime ) << "s.\n";
 #endif
 
-		cleanup();
+			return query.size();
+		};
+
+		if ( p.session ) {
+			SearchSession::Serve( cin, rankQueries );
+		}
+		else {
+			rankQueries( p.queryFile, p.outFile );
+		}
+
+		Util::Free( db );
 		return 0;
 	}
 
@@ -232,11 +303,15 @@ public:
 		size_t fragLength,
 		const SubstitutionMatrix & matrix,
 		uint maxResults,
-		string& outFile //
+		string& outFile,
+		const SeedFilter * filter,
+		size_t maxCandidates,
+		bool checkRecall //
 	) {
 		const uint Q = query.size();
 		const uint R = db.size();
-		ofstream out( outFile );
+		RankingWriter writer( outFile );
+		auto subjectId = [&db]( size_t d ) -> const string & { return db[d]->IdString(); };
 
 		auto getFragCount = [k, fragLength]( const Sequence* seq ) -> size_t {
 			auto kmerCount = seq->Seq().size() + 1 - k;
@@ -247,6 +322,11 @@ public:
 		size_t maxQueryFragCount = Util::Max( query.begin(), query.end(), getFragCount, 0 );
 		size_t maxDbFragCount = Util::Max( db.begin(), db.end(), getFragCount, 0 );
 
+		// When checking recall, everything is compared and the candidate set only filters the output.
+		const bool exhaustive = filter == nullptr || checkRecall;
+		size_t trueHits = 0;
+		size_t droppedHits = 0;
+
 #if USE_OMP
 #pragma omp parallel
 #endif
@@ -254,6 +334,10 @@ public:
 			// cout << "Running with " << omp_get_num_threads() << " threads.\n";
 
 			KnnVector<size_t, double> rankings( maxResults, -HUGE_VAL );
+			KnnVector<size_t, double> fullRankings( checkRecall ? maxResults : 0, -HUGE_VAL );
+			SeedFilter::Workspace work;
+			vector<uint32_t> candidates;
+			ostringstream buffer;
 			vector<int> rowMinima( maxQueryFragCount );
 			vector<int> colMinima( maxDbFragCount );
 
@@ -266,8 +350,7 @@ public:
 				const auto& querySeq = query[q]->Seq();
 
 				if (querySeq.size() < k) {
-					out << query[q]->IdString();
-					out << " ___eol___ -100000\n";
+					writer.Submit( q, query[q]->IdString(), rankings, subjectId, buffer );
 					continue;
 				}
 
@@ -275,7 +358,18 @@ public:
 				size_t queryFragCount = Fragment::GetCount( m, fragLength );
 				double queryStepSize = Fragment::GetRealStepSize( m, fragLength, queryFragCount );
 
-				for ( uint r = 0; r < R; r++ ) {
+				if ( filter ) {
+					filter->GetCandidates( querySeq, maxCandidates, work, candidates );
+				}
+
+				if ( checkRecall ) {
+					fullRankings.clear();
+				}
+
+				const size_t C = exhaustive ? R : candidates.size();
+
+				for ( uint c = 0; c < C; c++ ) {
+					const uint r = exhaustive ? c : candidates[c];
 					const auto& refSeq = db[r]->Seq();
 
 					if (refSeq.size() < k) continue;
@@ -309,6 +403,12 @@ public:
 
 					// cout << query.at(q)->IdStr() << "\t" << seq.IdStr() << "\t" << distance << "\n";
 
+					if ( checkRecall && fullRankings.canPush( distance ) ) {
+						fullRankings.push( r, distance );
+					}
+
+					if ( filter && !std::binary_search( candidates.begin(), candidates.end(), r ) ) continue;
+
 					if ( rankings.canPush( distance ) ) {
 						rankings.push( r, distance );
 					}
@@ -316,21 +416,36 @@ public:
 
 				rankings.sort();
 
-#if USE_OMP
-#pragma omp critical
-#endif
-				{
-					out << query[q]->IdString();
+				if ( checkRecall ) {
+					size_t total = 0, dropped = 0;
 
-					for ( auto& ranking : rankings ) {
-						out << " " << db[ranking.second]->IdString() << " " << ( -ranking.first );
+					for ( auto & hit : fullRankings ) {
+						total++;
+
+						if ( !std::binary_search( candidates.begin(), candidates.end(), (uint32_t) hit.second ) ) dropped++;
 					}
 
-					out << " ___eol___ -100000\n";
+#if USE_OMP
+#pragma omp atomic
+#endif
+					trueHits += total;
+#if USE_OMP
+#pragma omp atomic
+#endif
+					droppedHits += dropped;
 				}
+
+				writer.Submit( q, query[q]->IdString(), rankings, subjectId, buffer );
 			}
 
 		}
+
+		writer.Close( Q, [&query]( size_t q ) -> const string & { return query[q]->IdString(); }, db.size(), subjectId );
+
+		if ( checkRecall ) {
+			cout << arguments->ProgName() << ": prefilter dropped " << droppedHits << " of " << trueHits
+				<< " true top-" << maxResults << " hits (recall " << (trueHits ? 1.0 - (double) droppedHits / trueHits : 1.0) << ").\n";
+		}
 	}
 };
 
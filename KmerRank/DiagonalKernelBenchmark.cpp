@@ -0,0 +1,179 @@
+#include "Args.hpp"
+#include "DiagonalKernel.hpp"
+#include "Exception.hpp"
+#include "Random.hpp"
+#include "SimilarityMatrix.hpp"
+#include <cstdio>
+#include <omp.h>
+#include <vector>
+
+using namespace QutBio;
+using namespace std;
+
+// Singletons.
+Args *arguments;
+
+/**
+ *	Microbenchmark for DiagonalKernel, which computes the row and column
+ *	minima of the kmer distance matrix in the Projector rankers. Runs the
+ *	scalar and AVX2 paths over random protein sequences of typical lengths,
+ *	using BLOSUM62 distances, and checks that both give the same minima.
+ */
+struct DiagonalKernelBenchmark {
+public:
+	static int Run() {
+		Params parms;
+
+		if (!parms.ok) {
+			return 1;
+		}
+
+		auto matrix = SimilarityMatrix::Blosum62();
+		auto alphabet = Alphabets::AA();
+		const string residues = "ARNDCQEGHILKMFPSTWYV";
+		UniformIntRandom<size_t> rand(parms.seed, 0, residues.size() - 1);
+
+		auto term = [matrix](Symbol q, Symbol s) { return matrix->Difference(s, q); };
+
+		auto randomSequence = [&](size_t length) {
+			vector<Symbol> seq(length);
+			for (auto & s : seq) s = alphabet->Encode(residues[rand()]);
+			return seq;
+		};
+
+		cout << "k,length,method,seconds,cellsPerSecond\n";
+
+		if (!DiagonalKernel::HasAvx2()) {
+			cerr << "AVX2 is not available on this processor; only the scalar path will be timed.\n";
+		}
+
+		for (size_t k : parms.kmerLengths) {
+			for (size_t length : { (size_t) 100, (size_t) 300, (size_t) 1000 }) {
+				if (length < k) continue;
+
+				vector<vector<Symbol>> seqs;
+
+				for (size_t i = 0; i < 2 * parms.pairs; i++) {
+					seqs.push_back(randomSequence(length));
+				}
+
+				const size_t m = length - k + 1;
+				const double cells = (double) parms.pairs * m * m;
+
+				vector<Distance> rowScalar(parms.pairs * m), colScalar(parms.pairs * m);
+				vector<Distance> rowSimd(parms.pairs * m), colSimd(parms.pairs * m);
+
+				auto run = [&](const string & method, vector<Distance> & rowMinima, vector<Distance> & colMinima, bool simd) {
+					double start = omp_get_wtime();
+
+					for (size_t r = 0; r < parms.repeats; r++) {
+						std::fill(rowMinima.begin(), rowMinima.end(), numeric_limits<Distance>::max());
+						std::fill(colMinima.begin(), colMinima.end(), numeric_limits<Distance>::max());
+
+						for (size_t p = 0; p < parms.pairs; p++) {
+							auto query = seqs[2 * p].data();
+							auto subject = seqs[2 * p + 1].data();
+							auto rows = rowMinima.data() + p * m;
+							auto cols = colMinima.data() + p * m;
+
+							if (simd) {
+								DiagonalKernel::RowColMinimaSimd(query, subject, k, m, m, term, rows, cols);
+							}
+							else {
+								DiagonalKernel::RowColMinimaScalar(query, subject, k, m, m, term, rows, cols);
+							}
+						}
+					}
+
+					double seconds = omp_get_wtime() - start;
+					cout << k << "," << length << "," << method << "," << seconds << ","
+						<< (parms.repeats * cells / seconds) << "\n";
+				};
+
+				run("Scalar", rowScalar, colScalar, false);
+
+				if (DiagonalKernel::HasAvx2()) {
+					run("AVX2", rowSimd, colSimd, true);
+
+					if (rowSimd != rowScalar || colSimd != colScalar) {
+						cerr << "Mismatch: k = " << k << ", length = " << length << "\n";
+					}
+				}
+			}
+		}
+
+		return 0;
+	}
+
+	struct Params {
+	public:
+		size_t pairs = 100;
+		size_t repeats = 10;
+		size_t seed = 1;
+		vector<size_t> kmerLengths{ 3, 5, 10 };
+		bool ok = true;
+
+		Params() {
+
+			if (arguments->IsDefined("help")) {
+				vector<string> text{
+"DiagonalKernelBenchmark: Measures throughput, in kmer distance matrix cells",
+"             per second, of the scalar and AVX2 paths of DiagonalKernel for ",
+"             random protein sequences of length 100, 300 and 1000, under ",
+"             BLOSUM62. Results are written to stdout as CSV.",
+"",
+"--help       Gets this text.",
+"",
+"--pairs      Optional; default value = 100. The number of sequence pairs ",
+"             compared for each length.",
+"",
+"--repeats    Optional; default value = 10. The number of passes over the ",
+"             sequence pairs.",
+"",
+"--kmerLength Optional; default value = 3 5 10. One or more kmer lengths.",
+"",
+"--seed       Optional; default value = 1. Random number seed.",
+"",
+				};
+
+				for (auto s : text) {
+					cerr << s << "\n";
+				}
+			}
+
+			if (arguments->IsDefined("pairs") && !arguments->Get("pairs", pairs)) {
+				cerr << arguments->ProgName() << ": error - invalid integer data for argument '--pairs'.\n";
+				ok = false;
+			}
+
+			if (arguments->IsDefined("repeats") && !arguments->Get("repeats", repeats)) {
+				cerr << arguments->ProgName() << ": error - invalid integer data for argument '--repeats'.\n";
+				ok = false;
+			}
+
+			if (arguments->IsDefined("kmerLength") && !arguments->Get("kmerLength", kmerLengths)) {
+				cerr << arguments->ProgName() << ": error - invalid integer data for argument '--kmerLength'.\n";
+				ok = false;
+			}
+
+			if (arguments->IsDefined("seed") && !arguments->Get("seed", seed)) {
+				cerr << arguments->ProgName() << ": error - invalid integer data for argument '--seed'.\n";
+				ok = false;
+			}
+		}
+	};
+};
+
+int main(int argc, char *argv[]) {
+	try {
+		Args args(argc, argv);
+
+		arguments = &args;
+
+		return DiagonalKernelBenchmark::Run();
+	}
+	catch (Exception &ex) {
+		cerr << ex.File() << "(" << ex.Line() << "): " << ex.what() << "\n";
+		return 1;
+	}
+}
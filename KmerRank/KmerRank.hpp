@@ -222,26 +222,42 @@ namespace KmerQuery {
 				prototypes = Load::Prototypes( protoSeqs, parms.alphabet, parms.kmerLength, distanceFunction.CharsPerWord() );
 				Index<Proto> protoIndex( prototypes );
 
-				FILE * f = fopen( parms.codebookFile.c_str(), "r" );
-
-				if ( !f ) {
-					ostringstream cerr;
-					cerr << "Codebook " << parms.codebookFile << " cannot be opened for reading.\n";
-					throw Exception( cerr.str(), FileAndLine );
+				if ( BinaryCodebook::IsBinary( parms.codebookFile ) ) {
+					BinaryCodebook saved( parms.codebookFile );
+					codebook = new Codebook(
+						parms.alphabet,
+						distanceFunction,
+						distanceFunction.CharsPerWord(),
+						parms.kmerLength,
+						seqIdx,
+						protoIndex,
+						kmerIdx,
+						saved,
+						parms.balancedClusterSize
+					);
 				}
+				else {
+					FILE * f = fopen( parms.codebookFile.c_str(), "r" );
 
-				codebook = new Codebook(
-					parms.alphabet,
-					distanceFunction,
-					distanceFunction.CharsPerWord(),
-					parms.kmerLength,
-					seqIdx,
-					protoIndex,
-					kmerIdx,
-					f,
-					parms.balancedClusterSize
-				);
-				fclose( f );
+					if ( !f ) {
+						ostringstream cerr;
+						cerr << "Codebook " << parms.codebookFile << " cannot be opened for reading.\n";
+						throw Exception( cerr.str(), FileAndLine );
+					}
+
+					codebook = new Codebook(
+						parms.alphabet,
+						distanceFunction,
+						distanceFunction.CharsPerWord(),
+						parms.kmerLength,
+						seqIdx,
+						protoIndex,
+						kmerIdx,
+						f,
+						parms.balancedClusterSize
+					);
+					fclose( f );
+				}
 
 				if ( codebook->Size() == 0 ) {
 					ostringstream cerr;
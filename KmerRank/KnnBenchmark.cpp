@@ -0,0 +1,286 @@
+#include "Args.hpp"
+#include "Exception.hpp"
+#include "Random.hpp"
+#include "kNearestNeighbours.hpp"
+#include <cstdio>
+#include <cmath>
+#include <omp.h>
+#include <vector>
+
+using namespace QutBio;
+using namespace std;
+
+// Singletons.
+Args *arguments;
+
+/**
+ *	Microbenchmark for the bounded top-k containers in kNearestNeighbours.hpp.
+ *	Streams random candidate distances through the current KnnHeap,
+ *	KnnVector and KnnBuffer, and through copies of the previous
+ *	implementations (make_heap after every KnnHeap push; full rescan after
+ *	every KnnVector replacement), checking that all retain the same
+ *	distances.
+ */
+struct KnnBenchmark {
+public:
+	/// KnnHeap::push as it was: rebuilds the whole heap on every push.
+	struct LegacyHeap {
+		vector<double> heap;
+		size_t capacity;
+
+		LegacyHeap(size_t capacity) : capacity(capacity) {
+			heap.reserve(capacity);
+		}
+
+		void clear() {
+			heap.clear();
+		}
+
+		void push(double item) {
+			size_t last = heap.size() - 1;
+
+			if (last + 1 == capacity) {
+				if (item < heap[last]) {
+					heap[last] = item;
+				}
+			}
+			else {
+				heap.push_back(item);
+			}
+
+			make_heap(heap.rbegin(), heap.rend());
+		}
+	};
+
+	/// KnnVector::push as it was: rescans all K entries after a replacement.
+	struct LegacyVector {
+		vector<pair<double, size_t>> elements;
+		size_t capacity;
+		double ejectDistance = -HUGE_VAL;
+		size_t ejectPos = 0;
+
+		LegacyVector(size_t capacity) : capacity(capacity) {
+			elements.reserve(capacity);
+		}
+
+		void clear() {
+			elements.clear();
+			ejectPos = 0;
+			ejectDistance = -HUGE_VAL;
+		}
+
+		bool canPush(double distance) {
+			return elements.size() < capacity || distance < ejectDistance;
+		}
+
+		void push(size_t item, double distance) {
+			if (elements.size() < capacity) {
+				if (distance > ejectDistance) {
+					ejectDistance = distance;
+					ejectPos = elements.size();
+				}
+
+				elements.emplace_back(distance, item);
+			}
+			else if (distance < ejectDistance) {
+				elements[ejectPos].first = distance;
+				elements[ejectPos].second = item;
+
+				ejectPos = 0;
+				ejectDistance = elements[0].first;
+
+				for (size_t i = 1; i < capacity; i++) {
+					double d = elements[i].first;
+
+					if (d > ejectDistance) {
+						ejectPos = i;
+						ejectDistance = d;
+					}
+				}
+			}
+		}
+	};
+
+	static int Run() {
+		Params parms;
+
+		if (!parms.ok) {
+			return 1;
+		}
+
+		UniformRealRandom rand(parms.seed);
+		vector<double> candidates(parms.candidates);
+
+		cout << "k,method,seconds,candidatesPerSecond\n";
+
+		for (size_t k : { (size_t) 10, (size_t) 100, (size_t) 500, (size_t) 1000 }) {
+			// Descending distances are the worst case: every candidate enters the list.
+			for (string order : { "random", "descending" }) {
+				for (auto & c : candidates) c = rand();
+
+				if (order == "descending") {
+					std::sort(candidates.begin(), candidates.end(), greater<double>());
+				}
+
+				vector<double> expected(candidates);
+				std::sort(expected.begin(), expected.end());
+				expected.resize(std::min(k, expected.size()));
+
+				auto report = [&](const string & method, double seconds, vector<double> got) {
+					std::sort(got.begin(), got.end());
+
+					if (got != expected) {
+						cerr << "Mismatch: k = " << k << ", method = " << method << "\n";
+					}
+
+					cout << k << "," << order << "/" << method << "," << seconds << ","
+						<< (parms.repeats * candidates.size() / seconds) << "\n";
+				};
+
+				{
+					LegacyHeap knn(k);
+					double start = omp_get_wtime();
+
+					for (size_t r = 0; r < parms.repeats; r++) {
+						knn.clear();
+						for (auto c : candidates) knn.push(c);
+					}
+
+					report("LegacyHeap", omp_get_wtime() - start, knn.heap);
+				}
+				{
+					KnnHeap<double> knn(k);
+					double start = omp_get_wtime();
+
+					for (size_t r = 0; r < parms.repeats; r++) {
+						knn.clear();
+						for (auto c : candidates) knn.push(c);
+					}
+
+					double seconds = omp_get_wtime() - start;
+					report("KnnHeap", seconds, vector<double>(knn.begin(), knn.end()));
+				}
+				{
+					LegacyVector knn(k);
+					double start = omp_get_wtime();
+
+					for (size_t r = 0; r < parms.repeats; r++) {
+						knn.clear();
+
+						for (size_t i = 0; i < candidates.size(); i++) {
+							if (knn.canPush(candidates[i])) knn.push(i, candidates[i]);
+						}
+					}
+
+					double seconds = omp_get_wtime() - start;
+					vector<double> got;
+					for (auto & e : knn.elements) got.push_back(e.first);
+					report("LegacyVector", seconds, got);
+				}
+				{
+					KnnVector<size_t, double> knn(k, -HUGE_VAL);
+					double start = omp_get_wtime();
+
+					for (size_t r = 0; r < parms.repeats; r++) {
+						knn.clear();
+
+						for (size_t i = 0; i < candidates.size(); i++) {
+							if (knn.canPush(candidates[i])) knn.push(i, candidates[i]);
+						}
+
+						knn.sort();
+					}
+
+					double seconds = omp_get_wtime() - start;
+					vector<double> got;
+					for (auto & e : knn) got.push_back(e.first);
+					report("KnnVector", seconds, got);
+				}
+				{
+					KnnBuffer<size_t, double> knn(k, -HUGE_VAL);
+					double start = omp_get_wtime();
+
+					for (size_t r = 0; r < parms.repeats; r++) {
+						knn.clear();
+
+						for (size_t i = 0; i < candidates.size(); i++) {
+							if (knn.canPush(candidates[i])) knn.push(i, candidates[i]);
+						}
+
+						knn.sort();
+					}
+
+					double seconds = omp_get_wtime() - start;
+					vector<double> got;
+					for (auto & e : knn) got.push_back(e.first);
+					report("KnnBuffer", seconds, got);
+				}
+			}
+		}
+
+		return 0;
+	}
+
+	struct Params {
+	public:
+		size_t candidates = 100000;
+		size_t repeats = 10;
+		size_t seed = 1;
+		bool ok = true;
+
+		Params() {
+
+			if (arguments->IsDefined("help")) {
+				vector<string> text{
+"KnnBenchmark: Measures throughput of the bounded top-k containers used by the",
+"             rankers (KnnHeap, KnnVector, KnnBuffer) against the previous ",
+"             implementations, for k in { 10, 100, 500, 1000 }. Results are ",
+"             written to stdout as CSV.",
+"",
+"--help       Gets this text.",
+"",
+"--candidates Optional; default value = 100000. The number of candidate ",
+"             distances streamed per query.",
+"",
+"--repeats    Optional; default value = 10. The number of queries.",
+"",
+"--seed       Optional; default value = 1. Random number seed.",
+"",
+				};
+
+				for (auto s : text) {
+					cerr << s << "\n";
+				}
+			}
+
+			if (arguments->IsDefined("candidates") && !arguments->Get("candidates", candidates)) {
+				cerr << arguments->ProgName() << ": error - invalid integer data for argument '--candidates'.\n";
+				ok = false;
+			}
+
+			if (arguments->IsDefined("repeats") && !arguments->Get("repeats", repeats)) {
+				cerr << arguments->ProgName() << ": error - invalid integer data for argument '--repeats'.\n";
+				ok = false;
+			}
+
+			if (arguments->IsDefined("seed") && !arguments->Get("seed", seed)) {
+				cerr << arguments->ProgName() << ": error - invalid integer data for argument '--seed'.\n";
+				ok = false;
+			}
+		}
+	};
+};
+
+int main(int argc, char *argv[]) {
+	try {
+		Args args(argc, argv);
+
+		arguments = &args;
+
+		return KnnBenchmark::Run();
+	}
+	catch (Exception &ex) {
+		cerr << ex.File() << "(" << ex.Line() << "): " << ex.what() << "\n";
+		return 1;
+	}
+}
@@ -15,6 +15,7 @@
 #include <Args.hpp>
 #include <Alphabet.hpp>
 #include <Domain.hpp>
+#include <FastaLoader.hpp>
 #include <FastaSequence.hpp>
 #include <KmerCodebook.hpp>
 #include <OmpTimer.h>
@@ -43,7 +44,7 @@ struct GetLargestProtosByClass {
 		BlosumDifferenceFunction dist(SimilarityMatrix::Blosum62());
 		DistanceFunction distanceFunction(alphabet, &dist);
 
-		auto dbSeqs = FastaSequence::Read(parms.db, parms.idIndex, alphabet);
+		auto dbSeqs = FastaLoader::Read(parms.db, parms.idIndex, alphabet);
 		auto db = Load::Encoded(dbSeqs, parms.classIndex, alphabet, parms.kmerLength, 
 			distanceFunction.CharsPerWord(), alphabet->DefaultSymbol());
 
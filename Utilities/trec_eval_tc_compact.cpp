@@ -1,7 +1,8 @@
 // Complete rewrite of Timothy Chappell's trec_eval program.
 //
 //	This program reads a .homologs file (in place of .qrels)
-//	and a "compact rankings" file as emitted by COV-Jacc.
+//	and a "compact rankings" file as emitted by COV-Jacc, or a binary
+//	ranking file (see RankingFile.hpp).
 //
 //	Not intended to be compatible with trec_eval; however, the
 //	interpolated precision/recall curves generated are numerically 
@@ -26,8 +27,10 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <limits>
 
 #include "Array.hpp"
+#include "RankingFile.hpp"
 
 using namespace std;
 
@@ -172,7 +175,65 @@ namespace QutBio {
 
 			//n = 0;
 
-			while ( !feof( rankingStream ) ) {
+			if ( RankingFile::IsBinary( rankingFile ) ) {
+				fclose( rankingStream );
+				rankingStream = 0;
+
+				RankingFile rankingData( rankingFile );
+
+				// Resolve each query and subject ID once, rather than once per ranked document.
+				vector<size_t> queryTopicIds( rankingData.QueryCount() );
+				vector<size_t> subjectDocIds( rankingData.SubjectCount() );
+
+				for ( size_t q = 0; q < queryTopicIds.size(); q++ ) {
+					queryTopicIds[q] = GetTopicId( rankingData.QueryId( q ), topicIds, topicNames, qrels, relevantDocumentCount );
+				}
+
+				for ( size_t s = 0; s < subjectDocIds.size(); s++ ) {
+					subjectDocIds[s] = GetDocId( rankingData.SubjectId( s ), docIds, docNames );
+				}
+
+				vector<Ranking> rankings;
+
+				for ( size_t b = 0; b < rankingData.BlockCount(); b++ ) {
+					auto & block = rankingData.GetBlock( b );
+					auto records = rankingData.Records( b );
+					size_t topicId = queryTopicIds[block.query];
+					auto & relevantDocs = qrels[topicId];
+
+					retrievedResultsFor[topicId] = true;
+					rankings.clear();
+
+					size_t numReturned = block.count;
+					size_t numRelevantReturned = 0;
+
+					for ( size_t i = 0; i < numReturned; i++ ) {
+						bool relevant = relevantDocs.find( subjectDocIds[records[i].subject] ) != relevantDocs.end();
+						rankings.emplace_back( -records[i].score, relevant );
+
+						if ( relevant ) numRelevantReturned++;
+					}
+
+					overallReturned += numReturned;
+					overallRelevantReturned += numRelevantReturned;
+
+					ProcessAndPrint(
+						interpolationPoints,
+						rankings,
+						relevantDocumentCount,
+						topicId,
+						averageIprec,
+						topicNames,
+						numReturned,
+						numRelevantReturned,
+						summaryStream,
+						meanAveragePrecision,
+						topicRetCount
+					);
+				}
+			}
+
+			while ( rankingStream && !feof( rankingStream ) ) {
 				char topic_[257];
 				double score;
 				char delimiter;
@@ -206,19 +267,7 @@ namespace QutBio {
 					// cerr << "topic(" << topic_ << ") doc(" << doc_ << ") score(" << score << ") delimiter(" << int(delimiter) << ")\n";
 
 
-					string doc( doc_ );
-					size_t docId;
-
-					auto docPos = docIds.find( doc );
-
-					if ( docPos == docIds.end() ) {
-						docId = docNames.size();
-						docNames.push_back( doc );
-						docIds.emplace( doc, docId );
-					}
-					else {
-						docId = docPos->second;
-					}
+					size_t docId = GetDocId( doc_, docIds, docNames );
 
 					bool relevant = qrels[topicId].find( docId ) != qrels[topicId].end();
 
@@ -303,6 +352,8 @@ namespace QutBio {
 
 			fprintf( summaryStream, "\n" );
 
+			if ( rankingStream ) fclose( rankingStream );
+
 			fclose( summaryStream );
 
 			fprintf( stderr, "Finished.\n" );
@@ -359,6 +410,26 @@ namespace QutBio {
 			return topicId;
 		}
 
+		static size_t GetDocId(
+			const string & doc,
+			unordered_map<string, size_t> & docIds,
+			vector<string> & docNames
+		) {
+			auto docPos = docIds.find( doc );
+			size_t docId;
+
+			if ( docPos == docIds.end() ) {
+				docId = docNames.size();
+				docNames.push_back( doc );
+				docIds.emplace( doc, docId );
+			}
+			else {
+				docId = docPos->second;
+			}
+
+			return docId;
+		}
+
 		static void PrintTopic(
 			const char * topicName,
 			size_t relevantDocumentCount,
@@ -462,5 +533,11 @@ namespace QutBio {
 }
 
 int main( int argc, char ** argv ) {
-	return QutBio::TrecEval::main( argc, argv );
+	try {
+		return QutBio::TrecEval::main( argc, argv );
+	}
+	catch ( QutBio::Exception & ex ) {
+		cerr << "Unhandled exception : " << ex.what() << " - " << ex.File() << "(" << ex.Line() << ")" << endl;
+		return 1;
+	}
 }